@@ -10,6 +10,7 @@ extern "C" {
   #include <libavcodec/avcodec.h>
   #include <libavformat/avformat.h>
   #include <libswresample/swresample.h>
+  #include <libswscale/swscale.h>
   }
 //}}}
 
@@ -101,6 +102,22 @@ public:
   int av_read_play(AVFormatContext *s) { return ::av_read_play(s); }
   int av_read_pause(AVFormatContext *s) { return ::av_read_pause(s); }
   int av_seek_frame(AVFormatContext *s, int stream_index, int64_t timestamp, int flags) { return ::av_seek_frame(s, stream_index, timestamp, flags); }
+  //{{{
+  int avformat_flush(AVFormatContext *s)
+  {
+  #if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57,25,100)
+    return ::avformat_flush(s);
+  #else
+    // older lavf has no flush, drop each stream's parser, reopened on its next packet
+    for (unsigned int i = 0; i < s->nb_streams; i++)
+      if (s->streams[i]->parser) {
+        ::av_parser_close(s->streams[i]->parser);
+        s->streams[i]->parser = NULL;
+        }
+    return 0;
+  #endif
+  }
+  //}}}
 
   //{{{
   int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
@@ -239,5 +256,16 @@ public:
   virtual int swr_init (struct SwrContext *s) { return ::swr_init(s); }
   virtual void swr_free (struct SwrContext **s){ return ::swr_free(s); }
   virtual int swr_convert (struct SwrContext *s, uint8_t **out, int out_count, const uint8_t **in , int in_count){ return ::swr_convert(s, out, out_count, in, in_count); }
+  virtual int swr_set_compensation (struct SwrContext *s, int sample_delta, int compensation_distance) { return ::swr_set_compensation(s, sample_delta, compensation_distance); }
+  };
+//}}}
+//{{{
+class cSwScale {
+public:
+  virtual ~cSwScale() {}
+
+  virtual struct SwsContext *sws_getCachedContext (struct SwsContext *context, int srcW, int srcH, enum AVPixelFormat srcFormat, int dstW, int dstH, enum AVPixelFormat dstFormat, int flags, SwsFilter *srcFilter, SwsFilter *dstFilter, const double *param) { return ::sws_getCachedContext(context, srcW, srcH, srcFormat, dstW, dstH, dstFormat, flags, srcFilter, dstFilter, param); }
+  virtual int sws_scale (struct SwsContext *c, const uint8_t *const srcSlice[], const int srcStride[], int srcSliceY, int srcSliceH, uint8_t *const dst[], const int dstStride[]) { return ::sws_scale(c, srcSlice, srcStride, srcSliceY, srcSliceH, dst, dstStride); }
+  virtual void sws_freeContext (struct SwsContext *swsContext) { ::sws_freeContext(swsContext); }
   };
 //}}}
@@ -0,0 +1,208 @@
+// cAlsaSink.cpp - alsa pcm sink, mmap interleaved period transfers
+//{{{  includes
+#include <string.h>
+#include <algorithm>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cAlsaSink.h"
+
+using namespace std;
+//}}}
+
+//{{{
+cAlsaSink::cAlsaSink (const string& pcmName, int periodFrames, int periods) :
+    mPcmName(pcmName), mPeriodFrames(periodFrames), mBufferFrames(periodFrames * periods) {}
+//}}}
+//{{{
+cAlsaSink::~cAlsaSink() {
+
+  if (mPcm) {
+    snd_pcm_drop (mPcm);
+    snd_pcm_close (mPcm);
+    }
+  }
+//}}}
+
+//{{{
+bool cAlsaSink::open (int sampleRate, int chans, uint64_t chanLayout) {
+// s16 interleaved mmap, ask for period and buffer frames, take what the device gives
+
+  int err = snd_pcm_open (&mPcm, mPcmName.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
+  if (err < 0) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " " + mPcmName + " " + snd_strerror (err));
+    mPcm = nullptr;
+    return false;
+    }
+    //}}}
+
+  snd_pcm_hw_params_t* hwParams;
+  snd_pcm_hw_params_alloca (&hwParams);
+  snd_pcm_hw_params_any (mPcm, hwParams);
+
+  unsigned int rate = sampleRate;
+  if (((err = snd_pcm_hw_params_set_access (mPcm, hwParams, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0) ||
+      ((err = snd_pcm_hw_params_set_format (mPcm, hwParams, SND_PCM_FORMAT_S16_LE)) < 0) ||
+      ((err = snd_pcm_hw_params_set_channels (mPcm, hwParams, chans)) < 0) ||
+      ((err = snd_pcm_hw_params_set_rate_near (mPcm, hwParams, &rate, nullptr)) < 0) ||
+      ((err = snd_pcm_hw_params_set_period_size_near (mPcm, hwParams, &mPeriodFrames, nullptr)) < 0) ||
+      ((err = snd_pcm_hw_params_set_buffer_size_near (mPcm, hwParams, &mBufferFrames)) < 0) ||
+      ((err = snd_pcm_hw_params (mPcm, hwParams)) < 0)) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " hwParams " + mPcmName + " " + snd_strerror (err));
+    return false;
+    }
+    //}}}
+  snd_pcm_hw_params_get_period_size (hwParams, &mPeriodFrames, nullptr);
+  snd_pcm_hw_params_get_buffer_size (hwParams, &mBufferFrames);
+
+  if (rate != (unsigned int)sampleRate) {
+    //{{{  error return, no resampling here, pick a plug pcm
+    cLog::log (LOGERROR, string(__func__) + " " + mPcmName + " rate " + dec(sampleRate) + " gave " + dec(rate));
+    return false;
+    }
+    //}}}
+
+  // start once all but a period is queued, wake when a period is free
+  snd_pcm_sw_params_t* swParams;
+  snd_pcm_sw_params_alloca (&swParams);
+  snd_pcm_sw_params_current (mPcm, swParams);
+  if (((err = snd_pcm_sw_params_set_start_threshold (mPcm, swParams, mBufferFrames - mPeriodFrames)) < 0) ||
+      ((err = snd_pcm_sw_params_set_avail_min (mPcm, swParams, mPeriodFrames)) < 0) ||
+      ((err = snd_pcm_sw_params (mPcm, swParams)) < 0)) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " swParams " + mPcmName + " " + snd_strerror (err));
+    return false;
+    }
+    //}}}
+
+  mSampleRate = sampleRate;
+  mChans = chans;
+
+  cLog::log (LOGINFO, string(__func__) + " " + mPcmName + " " + dec(chans) + "x16@" + dec(sampleRate) +
+                      " period:" + dec((int)mPeriodFrames) + " buffer:" + dec((int)mBufferFrames) +
+                      " latency:" + frac(1000.0 * mBufferFrames / sampleRate, 5,1,' ') + "ms");
+  return true;
+  }
+//}}}
+//{{{
+bool cAlsaSink::write (const int16_t* samples, int frames) {
+// copy into mmap areas, blocks while device buffer is full
+
+  if (!mPcm)
+    return false;
+
+  while (frames > 0) {
+    snd_pcm_sframes_t avail = snd_pcm_avail_update (mPcm);
+    if (avail < 0) {
+      if (!recover ((int)avail))
+        return false;
+      continue;
+      }
+
+    if (avail < (snd_pcm_sframes_t)min ((snd_pcm_uframes_t)frames, mPeriodFrames)) {
+      // not started yet with a full buffer, kick it, else wait for a period to drain
+      if (snd_pcm_state (mPcm) == SND_PCM_STATE_PREPARED) {
+        int err = snd_pcm_start (mPcm);
+        if ((err < 0) && !recover (err))
+          return false;
+        }
+      else {
+        int err = snd_pcm_wait (mPcm, 1000);
+        if ((err < 0) && !recover (err))
+          return false;
+        }
+      continue;
+      }
+
+    const snd_pcm_channel_area_t* areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t count = min ((snd_pcm_uframes_t)frames, (snd_pcm_uframes_t)avail);
+    int err = snd_pcm_mmap_begin (mPcm, &areas, &offset, &count);
+    if (err < 0) {
+      if (!recover (err))
+        return false;
+      continue;
+      }
+
+    // interleaved, one area describes all channels
+    uint8_t* dst = (uint8_t*)areas[0].addr + (areas[0].first / 8) + (offset * (areas[0].step / 8));
+    memcpy (dst, samples, count * mChans * sizeof(int16_t));
+
+    snd_pcm_sframes_t committed = snd_pcm_mmap_commit (mPcm, offset, count);
+    if ((committed < 0) || ((snd_pcm_uframes_t)committed != count)) {
+      if (!recover ((committed < 0) ? (int)committed : -EPIPE))
+        return false;
+      continue;
+      }
+
+    samples += count * mChans;
+    frames -= count;
+    }
+
+  return true;
+  }
+//}}}
+//{{{
+void cAlsaSink::flush() {
+// drop queued frames, ready to start again
+
+  if (mPcm) {
+    snd_pcm_drop (mPcm);
+    snd_pcm_prepare (mPcm);
+    }
+  }
+//}}}
+//{{{
+void cAlsaSink::drain() {
+// less than start threshold may be queued, start it, it stops by underrun when played out
+
+  if (mPcm && (snd_pcm_state (mPcm) == SND_PCM_STATE_PREPARED)) {
+    int err = snd_pcm_start (mPcm);
+    if (err < 0)
+      recover (err);
+    }
+  }
+//}}}
+
+//{{{
+double cAlsaSink::getDelay() {
+// frames queued ahead of the dac, 0 once stopped or played out
+
+  snd_pcm_sframes_t delay = 0;
+  if (!mPcm || !mSampleRate)
+    return 0.0;
+
+  auto state = snd_pcm_state (mPcm);
+  if (((state != SND_PCM_STATE_RUNNING) && (state != SND_PCM_STATE_PREPARED)) || (snd_pcm_delay (mPcm, &delay) < 0))
+    return 0.0;
+
+  return (delay > 0) ? (double)delay / mSampleRate : 0.0;
+  }
+//}}}
+//{{{
+string cAlsaSink::getDebugString() {
+  return "alsa " + frac(getDelay() * 1000.0, 4,0,' ') + "ms xrun:" + dec(mUnderruns);
+  }
+//}}}
+
+// private
+//{{{
+bool cAlsaSink::recover (int err) {
+
+  if (err == -EPIPE)
+    mUnderruns++;
+
+  err = snd_pcm_recover (mPcm, err, 1);
+  if (err < 0) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " " + mPcmName + " " + snd_strerror (err));
+    return false;
+    }
+    //}}}
+
+  return true;
+  }
+//}}}
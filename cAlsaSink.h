@@ -0,0 +1,36 @@
+// cAlsaSink.h - alsa pcm sink, mmap interleaved period transfers
+//{{{  includes
+#pragma once
+
+#include <alsa/asoundlib.h>
+
+#include "cAudioSink.h"
+//}}}
+
+class cAlsaSink : public cAudioSink {
+public:
+  cAlsaSink (const std::string& pcmName, int periodFrames, int periods);
+  virtual ~cAlsaSink();
+
+  bool open (int sampleRate, int chans, uint64_t chanLayout);
+  bool write (const int16_t* samples, int frames);
+  void flush();
+  void drain();
+
+  double getDelay();
+  std::string getDebugString();
+
+private:
+  bool recover (int err);
+
+  // vars
+  std::string mPcmName;
+  snd_pcm_t* mPcm = nullptr;
+
+  int mSampleRate = 0;
+  int mChans = 0;
+  snd_pcm_uframes_t mPeriodFrames = 0;
+  snd_pcm_uframes_t mBufferFrames = 0;
+
+  int mUnderruns = 0;
+  };
@@ -0,0 +1,66 @@
+// cAudioSink.cpp - pcm sink base, device string factory
+//{{{  includes
+#include <string.h>
+#include <stdlib.h>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cAudioSink.h"
+#include "cAlsaSink.h"
+#include "cNullSink.h"
+#include "cWavSink.h"
+
+using namespace std;
+//}}}
+
+//{{{
+bool cAudioSink::isSink (const string& device) {
+
+  return (device.compare (0, 5, "alsa:") == 0) ||
+         (device.compare (0, 5, "null:") == 0) ||
+         (device.compare (0, 4, "wav:") == 0);
+  }
+//}}}
+//{{{
+cAudioSink* cAudioSink::create (const string& device, int periodFrames, int periods) {
+// alsa:<pcm name>, alsa: alone is alsa default, null:, wav:<file name>
+
+  if (device.compare (0, 5, "alsa:") == 0) {
+    string pcmName = device.substr (5);
+    return new cAlsaSink (pcmName.empty() ? "default" : pcmName, periodFrames, periods);
+    }
+
+  if (device.compare (0, 5, "null:") == 0)
+    return new cNullSink();
+
+  if ((device.compare (0, 4, "wav:") == 0) && (device.size() > 4))
+    return new cWavSink (device.substr (4));
+
+  cLog::log (LOGERROR, string(__func__) + " unknown device " + device);
+  return nullptr;
+  }
+//}}}
+
+//{{{
+int16_t* cAudioSink::interleave (const uint8_t* data, bool planarFloat, int chans, int frames) {
+// decoder output is planar float or already interleaved s16
+
+  if (!planarFloat)
+    return (int16_t*)data;
+
+  if ((int)mInterleaved.size() < chans * frames)
+    mInterleaved.resize (chans * frames);
+
+  int16_t* dst = mInterleaved.data();
+  for (int chan = 0; chan < chans; chan++) {
+    const float* src = (const float*)data + (chan * frames);
+    for (int frame = 0; frame < frames; frame++) {
+      float sample = src[frame] * 32768.f;
+      dst[(frame * chans) + chan] = (sample >= 32767.f) ? 32767 : (sample <= -32768.f) ? -32768 : (int16_t)sample;
+      }
+    }
+
+  return dst;
+  }
+//}}}
@@ -0,0 +1,34 @@
+// cAudioSink.h - pcm sink base, renderer side of cOmxAudio when mDevice isn't omx:
+//{{{  includes
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+//}}}
+
+class cAudioSink {
+public:
+  virtual ~cAudioSink() {}
+
+  static bool isSink (const std::string& device);
+  static cAudioSink* create (const std::string& device, int periodFrames, int periods);
+
+  // realtime sinks are slaved to the clock, others take pcm as fast as it comes
+  virtual bool isRealtime() { return true; }
+
+  // interleaved s16 frames, chanLayout AV_CH_ mask in interleave order, 0 unknown
+  virtual bool open (int sampleRate, int chans, uint64_t chanLayout) = 0;
+  virtual bool write (const int16_t* samples, int frames) = 0;
+  virtual void flush() = 0;
+  virtual void drain() = 0; // eos, play out what is queued, doesn't block
+
+  // secs written but not yet heard
+  virtual double getDelay() = 0;
+  virtual std::string getDebugString() = 0;
+
+  int16_t* interleave (const uint8_t* data, bool planarFloat, int chans, int frames);
+
+protected:
+  std::vector<int16_t> mInterleaved;
+  };
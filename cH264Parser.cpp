@@ -0,0 +1,471 @@
+// cH264Parser.cpp - h264 annexb access unit reassembly, avcc classify, slice types for sync frame flags
+//{{{  includes
+#include <string.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cH264Parser.h"
+#include "cStartCode.h"
+
+using namespace std;
+//}}}
+//{{{
+const char* kFrameTypeNames[cH264Parser::eFrameTypeCount] = {
+  "unknown", "idr", "I", "P", "B" };
+//}}}
+
+// runaway access unit, no boundary found in a broken stream, cut it rather than grow forever
+const int kMaxAccessUnitSize = 4 * 1024 * 1024;
+
+// full dvb-t2 multiplex, the fastest thing we get fed
+const double kDvbT2MuxBitrate = 40.2e6;
+
+//{{{
+static double getSecs() {
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+  }
+//}}}
+//{{{
+class cBitReader {
+// just enough exp-golomb for the start of a slice header, emulation prevention stripped on the way in
+public:
+  //{{{
+  cBitReader (const uint8_t* ptr, int size) {
+
+    int zeros = 0;
+    for (int i = 0; (i < size) && (mSize < (int)sizeof(mBytes)); i++) {
+      if ((zeros >= 2) && (ptr[i] == 3)) {
+        zeros = 0;
+        continue;
+        }
+      zeros = ptr[i] ? 0 : zeros + 1;
+      mBytes[mSize++] = ptr[i];
+      }
+    }
+  //}}}
+
+  //{{{
+  int getBit() {
+
+    if (mBit >= mSize * 8) {
+      mOverrun = true;
+      return 0;
+      }
+
+    int bit = (mBytes[mBit / 8] >> (7 - (mBit % 8))) & 1;
+    mBit++;
+    return bit;
+    }
+  //}}}
+  //{{{
+  uint32_t getUe() {
+
+    int zeros = 0;
+    while (!getBit() && !mOverrun && (zeros < 31))
+      zeros++;
+
+    uint32_t value = 0;
+    for (int i = 0; i < zeros; i++)
+      value = (value << 1) | getBit();
+
+    return (1u << zeros) - 1 + value;
+    }
+  //}}}
+
+  bool mOverrun = false;
+
+private:
+  uint8_t mBytes[16];
+  int mSize = 0;
+  int mBit = 0;
+  };
+//}}}
+
+//{{{
+const char* cH264Parser::getFrameTypeName (eFrameType type) {
+  return (type < eFrameTypeCount) ? kFrameTypeNames[type] : "error";
+  }
+//}}}
+//{{{
+bool cH264Parser::isReference (const uint8_t* data, int size, int lengthSize) {
+// any slice with nal_ref_idc set, or no slice found, is a reference, only all zero ref_idc slices are droppable
+
+  bool hasVcl = false;
+  const uint8_t* ptr = data;
+  const uint8_t* end = data + size;
+
+  while (true) {
+    const uint8_t* nal;
+    if (lengthSize) {
+      //{{{  avcc, length prefixed
+      if (end - ptr <= lengthSize)
+        break;
+      uint32_t nalSize = 0;
+      for (int i = 0; i < lengthSize; i++)
+        nalSize = (nalSize << 8) | *ptr++;
+      if (!nalSize || (nalSize > (uint32_t)(end - ptr)))
+        break;
+      nal = ptr;
+      ptr += nalSize;
+      }
+      //}}}
+    else {
+      //{{{  annexb, start codes
+      auto startCode = cStartCode::find (ptr, end);
+      if (!startCode || (startCode + 3 >= end))
+        break;
+      nal = startCode + 3;
+      ptr = nal;
+      }
+      //}}}
+
+    int nalType = nal[0] & 0x1F;
+    if ((nalType == 1) || (nalType == 5)) {
+      if (nal[0] & 0x60)
+        return true;
+      hasVcl = true;
+      }
+    }
+
+  return !hasVcl;
+  }
+//}}}
+//{{{
+void cH264Parser::bench (float secs) {
+// synthetic annexb gop pushed in ts payload sized chunks, parse rate against a full t2 multiplex
+
+  //{{{  build gop, aud + I,B,B,P.. slices, slice payload has no zeros so no false start codes
+  vector<uint8_t> stream;
+  const char* gop = "IBBPBBPBBPBB";
+  int gopFrames = (int)strlen (gop);
+
+  for (int frame = 0; frame < gopFrames; frame++) {
+    const uint8_t aud[] = { 0, 0, 0, 1, 0x09, 0xF0 };
+    stream.insert (stream.end(), aud, aud + sizeof(aud));
+
+    // nal header, first_mb_in_slice 0, slice_type 7 I, 5 P, 6 B
+    uint8_t slice[] = { 0, 0, 1, 0x65, 0x88 };
+    int sliceSize = 60000;
+    if (gop[frame] == 'P') {
+      slice[3] = 0x41;
+      slice[4] = 0x98;
+      sliceSize = 15000;
+      }
+    else if (gop[frame] == 'B') {
+      slice[3] = 0x01;
+      slice[4] = 0x9C;
+      sliceSize = 6000;
+      }
+    stream.insert (stream.end(), slice, slice + sizeof(slice));
+
+    for (int i = 0; i < sliceSize; i++)
+      stream.push_back ((uint8_t)((rand() % 255) + 1));
+    }
+  //}}}
+
+  cH264Parser parser;
+  cAccessUnit accessUnit;
+
+  int64_t bytes = 0;
+  int passes = 0;
+  int accessUnits = 0;
+  double startSecs = getSecs();
+  while (getSecs() - startSecs < secs) {
+    for (size_t offset = 0; offset < stream.size(); offset += 7 * 188) {
+      int chunk = min ((int)(stream.size() - offset), 7 * 188);
+      parser.push (stream.data() + offset, chunk, 0.0, 0.0, false);
+      while (parser.next (accessUnit))
+        accessUnits++;
+      }
+    bytes += stream.size();
+    passes++;
+    }
+  while (parser.flush (accessUnit))
+    accessUnits++;
+
+  double rate = bytes * 8.0 / parser.mParseSecs;
+  cLog::log (LOGNOTICE, "h264 parser bench " + frac(rate / 1e6, 7,1,' ') + "mbit/s" +
+                        " x" + frac(rate / kDvbT2MuxBitrate, 5,1,' ') + " t2 mux" +
+                        " au:" + dec(accessUnits) + "/" + dec(passes * gopFrames) +
+                        " " + parser.getDebugString());
+  }
+//}}}
+
+//{{{
+string cH264Parser::getDebugString() {
+
+  string str = "au:" + dec(mAccessUnits) + " sync:" + dec(mSyncs);
+  for (int type = eFrameIdr; type < eFrameTypeCount; type++)
+    str += " " + string(kFrameTypeNames[type]) + ":" + dec(mTypes[type]);
+  if (mForced)
+    str += " forced:" + dec(mForced);
+  if (mParseSecs > 0.0)
+    str += " " + dec(int(mBytes / mParseSecs / (1024 * 1024))) + "mb/s";
+  return str;
+  }
+//}}}
+
+//{{{
+void cH264Parser::push (const uint8_t* data, int size, double pts, double dts, bool decodeOnly) {
+
+  double startSecs = getSecs();
+
+  discardConsumed();
+
+  mPacketStarts.push_back ({ (int)mBuffer.size(), pts, dts, decodeOnly });
+  mBuffer.insert (mBuffer.end(), data, data + size);
+  mBytes += size;
+
+  scan();
+
+  if ((int)mBuffer.size() - mAuStart > kMaxAccessUnitSize) {
+    //{{{  no boundary, cut it
+    cLog::log (LOGERROR, string(__func__) + " no access unit boundary in " + dec(kMaxAccessUnitSize / 1024) + "k");
+    if (mNalStart >= 0)
+      addNal (mBuffer.data() + mNalStart, (int)mBuffer.size() - mNalStart, mPending);
+    completeAccessUnit ((int)mBuffer.size());
+    mScanned = (int)mBuffer.size();
+    mNalStart = -1;
+    mForced++;
+    }
+    //}}}
+
+  mParseSecs += getSecs() - startSecs;
+  }
+//}}}
+//{{{
+bool cH264Parser::next (cAccessUnit& accessUnit) {
+
+  discardConsumed();
+  if (mComplete.empty())
+    return false;
+
+  auto& span = mComplete.front();
+  accessUnit = span.mAccessUnit;
+  accessUnit.mData = mBuffer.data() + span.mStart;
+  accessUnit.mSize = span.mEnd - span.mStart;
+
+  mConsumed = span.mEnd;
+  mComplete.pop_front();
+  return true;
+  }
+//}}}
+//{{{
+bool cH264Parser::flush (cAccessUnit& accessUnit) {
+// eos, the last access unit has no following start code to end it
+
+  if ((int)mBuffer.size() > mAuStart) {
+    if (mNalStart >= 0)
+      addNal (mBuffer.data() + mNalStart, (int)mBuffer.size() - mNalStart, mPending);
+    completeAccessUnit ((int)mBuffer.size());
+    mScanned = (int)mBuffer.size();
+    mNalStart = -1;
+    }
+
+  return next (accessUnit);
+  }
+//}}}
+//{{{
+void cH264Parser::reset() {
+// seek or flush, drop everything partial, keep the stats
+
+  mBuffer.clear();
+  mPacketStarts.clear();
+  mComplete.clear();
+
+  mConsumed = 0;
+  mScanned = 0;
+  mAuStart = 0;
+  mNalStart = -1;
+  mAuHasVcl = false;
+  mDecodeOnly = false;
+  mPending = cAccessUnit();
+  }
+//}}}
+
+//{{{
+void cH264Parser::classify (const uint8_t* data, int size, cAccessUnit& accessUnit) {
+
+  double startSecs = getSecs();
+
+  accessUnit = cAccessUnit();
+  accessUnit.mData = data;
+  accessUnit.mSize = size;
+
+  const uint8_t* ptr = data;
+  const uint8_t* end = data + size;
+  while (end - ptr > mLengthSize) {
+    uint32_t nalSize = 0;
+    for (int i = 0; i < mLengthSize; i++)
+      nalSize = (nalSize << 8) | *ptr++;
+    if (nalSize > (uint32_t)(end - ptr))
+      break;
+
+    addNal (ptr, nalSize, accessUnit);
+    ptr += nalSize;
+    }
+
+  finish (accessUnit);
+  mBytes += size;
+
+  mParseSecs += getSecs() - startSecs;
+  }
+//}}}
+
+// private
+//{{{
+void cH264Parser::discardConsumed() {
+// shift out the access unit last handed out, offsets follow
+
+  if (!mConsumed)
+    return;
+
+  mBuffer.erase (mBuffer.begin(), mBuffer.begin() + mConsumed);
+
+  for (auto& packetStart : mPacketStarts)
+    packetStart.mOffset -= mConsumed;
+  for (auto& span : mComplete) {
+    span.mStart -= mConsumed;
+    span.mEnd -= mConsumed;
+    }
+
+  mScanned -= mConsumed;
+  mAuStart -= mConsumed;
+  if (mNalStart >= 0)
+    mNalStart -= mConsumed;
+
+  mConsumed = 0;
+  }
+//}}}
+//{{{
+void cH264Parser::scan() {
+// start codes from where the last push left off, each new nal may end the access unit in progress
+
+  const uint8_t* base = mBuffer.data();
+  const uint8_t* end = base + mBuffer.size();
+  const uint8_t* ptr = base + mScanned;
+
+  while (true) {
+    auto startCode = cStartCode::find (ptr, end);
+    if (!startCode || (startCode + 5 > end)) {
+      // nothing more, or need the nal header and first slice header byte, start code found again next push
+      mScanned = startCode ? int(startCode - base) : max (mScanned, (int)mBuffer.size() - 2);
+      break;
+      }
+
+    int offset = int(startCode - base);
+    if (mNalStart >= 0)
+      addNal (base + mNalStart, offset - mNalStart, mPending);
+
+    // 7.4.1.2.3, aud sps pps sei or a first slice with first_mb_in_slice 0, after a picture's slices
+    int nalType = startCode[3] & 0x1F;
+    bool vcl = (nalType == 1) || (nalType == 5);
+    if (mAuHasVcl &&
+        ((nalType == 9) || ((nalType >= 6) && (nalType <= 8)) || ((nalType >= 14) && (nalType <= 18)) ||
+         (vcl && (startCode[4] & 0x80)))) {
+      // 4 byte start code, zero_byte belongs to the new access unit
+      completeAccessUnit (((offset > mAuStart) && !startCode[-1]) ? offset - 1 : offset);
+      }
+    if (vcl)
+      mAuHasVcl = true;
+
+    mNalStart = offset + 3;
+    ptr = startCode + 3;
+    }
+  }
+//}}}
+//{{{
+void cH264Parser::addNal (const uint8_t* nal, int size, cAccessUnit& accessUnit) {
+
+  if (size < 1)
+    return;
+
+  accessUnit.mNals++;
+
+  int nalType = nal[0] & 0x1F;
+  if ((nalType == 1) || (nalType == 5)) {
+    //{{{  slice, worst slice type is the picture's type
+    cBitReader bitReader (nal + 1, size - 1);
+    bitReader.getUe();
+    uint32_t sliceType = bitReader.getUe();
+    if (bitReader.mOverrun)
+      return;
+
+    eFrameType type;
+    switch (sliceType % 5) {
+      case 2:
+      case 4:  type = (nalType == 5) ? eFrameIdr : eFrameI; break;
+      case 1:  type = eFrameB; break;
+      default: type = eFrameP; break;
+      }
+
+    if (type > accessUnit.mType)
+      accessUnit.mType = type;
+    }
+    //}}}
+  else if (nalType == 6) {
+    //{{{  sei, look for a recovery point message
+    int pos = 1;
+    while ((pos < size) && (nal[pos] != 0x80)) {
+      int payloadType = 0;
+      while ((pos < size) && (nal[pos] == 0xFF))
+        payloadType += nal[pos++];
+      if (pos < size)
+        payloadType += nal[pos++];
+
+      int payloadSize = 0;
+      while ((pos < size) && (nal[pos] == 0xFF))
+        payloadSize += nal[pos++];
+      if (pos < size)
+        payloadSize += nal[pos++];
+
+      if (payloadType == 6)
+        accessUnit.mRecoveryPoint = true;
+      pos += payloadSize;
+      }
+    }
+    //}}}
+  }
+//}}}
+//{{{
+void cH264Parser::completeAccessUnit (int end) {
+// pes timestamps belong to the first access unit starting in that packet
+
+  cSpan span;
+  span.mStart = mAuStart;
+  span.mEnd = end;
+  span.mAccessUnit = mPending;
+
+  while (!mPacketStarts.empty() && (mPacketStarts.front().mOffset <= mAuStart + 1)) {
+    auto& packetStart = mPacketStarts.front();
+    span.mAccessUnit.mHasTime = true;
+    span.mAccessUnit.mPts = packetStart.mPts;
+    span.mAccessUnit.mDts = packetStart.mDts;
+    mDecodeOnly = packetStart.mDecodeOnly;
+    mPacketStarts.pop_front();
+    }
+  span.mAccessUnit.mDecodeOnly = mDecodeOnly;
+
+  finish (span.mAccessUnit);
+  if (end > mAuStart)
+    mComplete.push_back (span);
+
+  mAuStart = end;
+  mAuHasVcl = false;
+  mPending = cAccessUnit();
+  }
+//}}}
+//{{{
+void cH264Parser::finish (cAccessUnit& accessUnit) {
+
+  accessUnit.mSync = (accessUnit.mType == eFrameIdr) || (accessUnit.mType == eFrameI);
+
+  mAccessUnits++;
+  mTypes[accessUnit.mType]++;
+  if (accessUnit.mSync)
+    mSyncs++;
+  }
+//}}}
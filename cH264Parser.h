@@ -0,0 +1,101 @@
+// cH264Parser.h - h264 annexb access unit reassembly, avcc classify, slice types for sync frame flags
+//{{{  includes
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+//}}}
+
+class cH264Parser {
+public:
+  enum eFrameType { eFrameUnknown = 0, eFrameIdr, eFrameI, eFrameP, eFrameB, eFrameTypeCount };
+  //{{{
+  class cAccessUnit {
+  public:
+    const uint8_t* mData = nullptr;
+    int mSize = 0;
+
+    // from the packet the access unit starts in, none if it started mid packet
+    bool mHasTime = false;
+    double mPts = 0.0;
+    double mDts = 0.0;
+    bool mDecodeOnly = false;
+
+    eFrameType mType = eFrameUnknown;
+    bool mSync = false;  // idr, or all I slices, decoder can start here
+    bool mRecoveryPoint = false;
+    int mNals = 0;
+    };
+  //}}}
+
+  // lengthSize 0 for annexb start codes, else avcc nal length prefix bytes
+  cH264Parser (int lengthSize = 0) : mLengthSize(lengthSize) {}
+
+  static const char* getFrameTypeName (eFrameType type);
+
+  // packet has a slice other pictures predict from, false only when every slice has nal_ref_idc 0
+  static bool isReference (const uint8_t* data, int size, int lengthSize);
+  static void bench (float secs);
+
+  bool isAnnexB() { return mLengthSize == 0; }
+  std::string getDebugString();
+
+  // annexb, push demuxed packets, pull complete access units, valid until the next push or next
+  void push (const uint8_t* data, int size, double pts, double dts, bool decodeOnly);
+  bool next (cAccessUnit& accessUnit);
+  bool flush (cAccessUnit& accessUnit);
+  void reset();
+
+  // avcc, container packets are already whole access units
+  void classify (const uint8_t* data, int size, cAccessUnit& accessUnit);
+
+private:
+  //{{{
+  class cPacketStart {
+  public:
+    int mOffset;
+    double mPts;
+    double mDts;
+    bool mDecodeOnly;
+    };
+  //}}}
+  //{{{
+  class cSpan {
+  public:
+    int mStart;
+    int mEnd;
+    cAccessUnit mAccessUnit;
+    };
+  //}}}
+
+  void discardConsumed();
+  void scan();
+  void addNal (const uint8_t* nal, int size, cAccessUnit& accessUnit);
+  void completeAccessUnit (int end);
+  void finish (cAccessUnit& accessUnit);
+
+  // vars
+  const int mLengthSize;
+
+  std::vector<uint8_t> mBuffer;
+  std::deque<cPacketStart> mPacketStarts;
+  std::deque<cSpan> mComplete;
+
+  int mConsumed = 0;    // bytes handed out by next, dropped on the next push or next
+  int mScanned = 0;     // start codes before here already found
+  int mAuStart = 0;     // current access unit
+  int mNalStart = -1;   // current nal header, -1 before the first start code
+  bool mAuHasVcl = false;
+  bool mDecodeOnly = false;  // carried to access units starting mid packet
+  cAccessUnit mPending;
+
+  // stats
+  int64_t mBytes = 0;
+  int mAccessUnits = 0;
+  int mTypes[eFrameTypeCount] = { 0 };
+  int mSyncs = 0;
+  int mForced = 0;
+  double mParseSecs = 0.0;
+  };
@@ -0,0 +1,408 @@
+// cHls.cpp - hls playlist parser and parallel segment prefetcher, presents segments as one continuous stream
+//{{{  includes
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <sstream>
+#include <chrono>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cHls.h"
+
+using namespace std;
+//}}}
+const int kFetchTries = 3;
+const int kLiveStartSegments = 3;
+const int kKeepSegments = 100;
+
+//{{{
+static double getSecs() {
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+  }
+//}}}
+
+//{{{
+bool cHlsReader::isHls (const string& url) {
+// http url with m3u8 path, ignoring any query
+
+  if (url.compare (0, 7, "http://") != 0)
+    return false;
+
+  string path = url.substr (0, url.find ('?'));
+  return (path.size() > 5) && (path.compare (path.size() - 5, 5, ".m3u8") == 0);
+  }
+//}}}
+
+// gets
+//{{{
+double cHlsReader::getDuration() {
+// vod duration from playlist, 0 if live
+
+  lock_guard<mutex> lockGuard (mMutex);
+  return (mLive || mSegments.empty()) ? 0.0 : mSegments.back().mStartSecs + mSegments.back().mDuration;
+  }
+//}}}
+//{{{
+string cHlsReader::getDebugString() {
+
+  lock_guard<mutex> lockGuard (mMutex);
+  return "hls seq:" + to_string (mCurSeq) + " cached:" + dec(mCache.size()) +
+         " " + frac(mFetchSecs > 0.0 ? mFetchedBytes / mFetchSecs / 1000000.0 : 0.0, 5,2,' ') + "mB/s" +
+         " waits:" + dec(mWaits) + " " + frac(mWaitSecs, 5,2,' ') + "s" +
+         " failed:" + dec(mFailed);
+  }
+//}}}
+
+// actions
+//{{{
+bool cHlsReader::open (const string& url) {
+
+  close();
+
+  mExit = false;
+  mUrl = url;
+  mSegments.clear();
+
+  cHttp http;
+  if (!loadPlaylist (http) || mSegments.empty()) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " no segments " + url);
+    return false;
+    }
+    //}}}
+
+  // live starts a few segments back from the end, vod at the start
+  mCurSeq = mLive ? max (mSegments.front().mSeq, mSegments.back().mSeq - kLiveStartSegments + 1) :
+                    mSegments.front().mSeq;
+  mCurOffset = 0;
+
+  for (int i = 0; i < mConnections; i++)
+    mThreads.push_back (thread ([=]() { fetchThread (i); }));
+  if (mLive)
+    mThreads.push_back (thread ([=]() { playlistThread(); }));
+
+  cLog::log (LOGINFO, string(__func__) + " " + mUrl + (mLive ? " live" : " vod") +
+                      " segments:" + dec(mSegments.size()) +
+                      " target:" + frac(mTargetDuration, 4,1,' ') + "s");
+  return true;
+  }
+//}}}
+//{{{
+int cHlsReader::read (uint8_t* buf, int size) {
+// copy from current segment, move on to next at its end, return bytes, 0 at vod end, -1 on exit
+
+  unique_lock<mutex> lock (mMutex);
+
+  double waitStartSecs = 0.0;
+  while (!mExit) {
+    // fallen out of live window, catch up
+    if (!mSegments.empty() && (mCurSeq < mSegments.front().mSeq)) {
+      cLog::log (LOGERROR, string(__func__) + " behind live window " + to_string (mCurSeq));
+      mCurSeq = mSegments.front().mSeq;
+      mCurOffset = 0;
+      }
+
+    auto it = mCache.find (mCurSeq);
+    if (it != mCache.end()) {
+      if (mCurOffset < (int)it->second.size()) {
+        //{{{  copy from segment, return
+        if (waitStartSecs > 0.0)
+          mWaitSecs += getSecs() - waitStartSecs;
+
+        int bytes = min (size, (int)it->second.size() - mCurOffset);
+        memcpy (buf, it->second.data() + mCurOffset, bytes);
+        mCurOffset += bytes;
+        return bytes;
+        }
+        //}}}
+
+      // segment used up, or failed empty, on to next
+      mCache.erase (it);
+      mCurSeq++;
+      mCurOffset = 0;
+      trimCache();
+      mFetchCond.notify_all();
+      continue;
+      }
+
+    if (!mLive && (mSegments.empty() || (mCurSeq > mSegments.back().mSeq)))
+      return 0;
+
+    if (waitStartSecs == 0.0) {
+      mWaits++;
+      waitStartSecs = getSecs();
+      mFetchCond.notify_all();
+      }
+    mSegmentCond.wait (lock);
+    }
+
+  return -1;
+  }
+//}}}
+//{{{
+double cHlsReader::seekTime (double secs) {
+// move to segment containing secs, return its start secs, -1 if live or out of range
+
+  lock_guard<mutex> lockGuard (mMutex);
+
+  if (mLive)
+    return -1.0;
+
+  for (auto& segment : mSegments)
+    if (secs < segment.mStartSecs + segment.mDuration) {
+      mCurSeq = segment.mSeq;
+      mCurOffset = 0;
+      trimCache();
+      mFetchCond.notify_all();
+
+      cLog::log (LOGINFO1, string(__func__) + " " + frac(secs, 6,2,' ') +
+                           " seq:" + to_string (mCurSeq) + " at " + frac(segment.mStartSecs, 6,2,' '));
+      return segment.mStartSecs;
+      }
+
+  return -1.0;
+  }
+//}}}
+//{{{
+void cHlsReader::close() {
+
+  {
+  lock_guard<mutex> lockGuard (mMutex);
+  mExit = true;
+  }
+  mFetchCond.notify_all();
+  mSegmentCond.notify_all();
+
+  for (auto& thread : mThreads)
+    thread.join();
+  mThreads.clear();
+
+  if (mFetchedBytes)
+    cLog::log (LOGINFO, string(__func__) + " " + getDebugString());
+
+  mCache.clear();
+  mFetching.clear();
+  mFetchedBytes = 0;
+  mFetchSecs = 0.0;
+  mWaitSecs = 0.0;
+  mWaits = 0;
+  mFailed = 0;
+  }
+//}}}
+
+// private
+//{{{
+string cHlsReader::resolveUrl (const string& baseUrl, const string& uri) {
+
+  if (uri.compare (0, 7, "http://") == 0)
+    return uri;
+
+  string base = baseUrl.substr (0, baseUrl.find ('?'));
+  if (uri[0] == '/')
+    return base.substr (0, base.find ('/', 7)) + uri;
+
+  return base.substr (0, base.rfind ('/') + 1) + uri;
+  }
+//}}}
+//{{{
+bool cHlsReader::loadPlaylist (cHttp& http) {
+// get mUrl, follow master playlist to highest bandwidth variant, append new segments
+
+  vector<uint8_t> body;
+  int status = http.get (mUrl, body);
+  if (status != 200) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " status " + dec(status) + " " + mUrl);
+    return false;
+    }
+    //}}}
+
+  string text (body.begin(), body.end());
+  if (text.find ("#EXT-X-STREAM-INF") != string::npos) {
+    //{{{  master playlist, pick variant and load that instead
+    string variant;
+    int64_t bestBandwidth = -1;
+    int64_t bandwidth = 0;
+
+    istringstream lines (text);
+    string line;
+    while (getline (lines, line)) {
+      if (!line.empty() && (line.back() == '\r'))
+        line.pop_back();
+
+      if (line.compare (0, 18, "#EXT-X-STREAM-INF:") == 0) {
+        auto pos = line.find ("BANDWIDTH=");
+        bandwidth = (pos == string::npos) ? 0 : strtoll (line.c_str() + pos + 10, nullptr, 10);
+        }
+      else if (!line.empty() && (line[0] != '#') && (bandwidth > bestBandwidth)) {
+        bestBandwidth = bandwidth;
+        variant = resolveUrl (http.getUrl(), line);
+        }
+      }
+
+    if (variant.empty())
+      return false;
+
+    cLog::log (LOGINFO, string(__func__) + " variant " + to_string (bestBandwidth) + " " + variant);
+    mUrl = variant;
+    return loadPlaylist (http);
+    }
+    //}}}
+
+  //{{{  media playlist
+  vector<cSegment> segments;
+  int64_t seq = 0;
+  double duration = 0.0;
+  bool endList = false;
+
+  istringstream lines (text);
+  string line;
+  while (getline (lines, line)) {
+    if (!line.empty() && (line.back() == '\r'))
+      line.pop_back();
+
+    if (line.compare (0, 22, "#EXT-X-TARGETDURATION:") == 0)
+      mTargetDuration = atof (line.c_str() + 22);
+    else if (line.compare (0, 22, "#EXT-X-MEDIA-SEQUENCE:") == 0)
+      seq = strtoll (line.c_str() + 22, nullptr, 10);
+    else if (line.compare (0, 8, "#EXTINF:") == 0)
+      duration = atof (line.c_str() + 8);
+    else if (line.compare (0, 14, "#EXT-X-ENDLIST") == 0)
+      endList = true;
+    else if ((line.compare (0, 11, "#EXT-X-KEY:") == 0) && (line.find ("METHOD=NONE") == string::npos)) {
+      //{{{  error return
+      cLog::log (LOGERROR, string(__func__) + " encrypted segments not supported");
+      return false;
+      }
+      //}}}
+    else if (!line.empty() && (line[0] != '#')) {
+      cSegment segment = { seq++, 0.0, duration, resolveUrl (http.getUrl(), line) };
+      segments.push_back (segment);
+      duration = 0.0;
+      }
+    }
+  //}}}
+
+  lock_guard<mutex> lockGuard (mMutex);
+  mLive = !endList;
+
+  // append segments newer than what we have
+  int added = 0;
+  for (auto& segment : segments)
+    if (mSegments.empty() || (segment.mSeq > mSegments.back().mSeq)) {
+      segment.mStartSecs = mSegments.empty() ? 0.0 : mSegments.back().mStartSecs + mSegments.back().mDuration;
+      mSegments.push_back (segment);
+      added++;
+      }
+
+  // live list only grows, forget old segments
+  while ((int)mSegments.size() > kKeepSegments)
+    mSegments.pop_front();
+
+  if (added) {
+    cLog::log (LOGINFO2, string(__func__) + " added " + dec(added) + " to " + to_string (mSegments.back().mSeq));
+    mFetchCond.notify_all();
+    mSegmentCond.notify_all();
+    }
+
+  return true;
+  }
+//}}}
+
+//{{{
+bool cHlsReader::getNextSegment (int64_t& seq, string& url) {
+// nearest unfetched segment in window ahead of mCurSeq, locked by caller
+
+  for (auto& segment : mSegments)
+    if ((segment.mSeq >= mCurSeq) && (segment.mSeq < mCurSeq + mSegmentsAhead) &&
+        !mCache.count (segment.mSeq) && !mFetching.count (segment.mSeq)) {
+      seq = segment.mSeq;
+      url = segment.mUrl;
+      return true;
+      }
+
+  return false;
+  }
+//}}}
+//{{{
+void cHlsReader::trimCache() {
+// drop cached segments outside window, locked by caller
+
+  for (auto it = mCache.begin(); it != mCache.end(); )
+    if ((it->first < mCurSeq) || (it->first >= mCurSeq + mSegmentsAhead))
+      it = mCache.erase (it);
+    else
+      ++it;
+  }
+//}}}
+
+//{{{
+void cHlsReader::fetchThread (int id) {
+
+  cLog::setThreadName ("hls" + dec(id));
+
+  cHttp http;
+  unique_lock<mutex> lock (mMutex);
+  while (!mExit) {
+    int64_t seq;
+    string url;
+    if (!getNextSegment (seq, url)) {
+      mFetchCond.wait (lock);
+      continue;
+      }
+    mFetching.insert (seq);
+    lock.unlock();
+
+    vector<uint8_t> body;
+    int status = 0;
+    double startSecs = getSecs();
+    for (int tries = 0; (tries < kFetchTries) && (status != 200) && !mExit; tries++)
+      status = http.get (url, body);
+    double secs = getSecs() - startSecs;
+
+    lock.lock();
+    mFetching.erase (seq);
+    if (status == 200) {
+      mFetchedBytes += body.size();
+      mFetchSecs += secs;
+      cLog::log (LOGINFO2, "segment " + to_string (seq) + " " + dec(body.size() / 1024) + "k " +
+                           frac(secs, 5,3,' ') + "s");
+      }
+    else {
+      // leave it empty, reader skips a failed segment rather than stall the stream
+      cLog::log (LOGERROR, string(__func__) + " segment " + to_string (seq) + " status " + dec(status));
+      body.clear();
+      mFailed++;
+      }
+
+    // only keep it if reader hasn't moved away meanwhile
+    if ((seq >= mCurSeq) && (seq < mCurSeq + mSegmentsAhead) && !mExit)
+      mCache[seq] = move (body);
+    mSegmentCond.notify_all();
+    }
+
+  cLog::log (LOGINFO1, "exit");
+  }
+//}}}
+//{{{
+void cHlsReader::playlistThread() {
+// reload live playlist every half target duration
+
+  cLog::setThreadName ("hlsP");
+
+  cHttp http;
+  while (!mExit) {
+    {
+    auto reload = chrono::steady_clock::now() + chrono::milliseconds (int(mTargetDuration * 500.0));
+    unique_lock<mutex> lock (mMutex);
+    mFetchCond.wait_until (lock, reload, [&]() { return mExit.load(); });
+    }
+    if (!mExit)
+      loadPlaylist (http);
+    }
+
+  cLog::log (LOGINFO1, "exit");
+  }
+//}}}
@@ -0,0 +1,83 @@
+// cHls.h - hls playlist parser and parallel segment prefetcher, presents segments as one continuous stream
+//{{{  includes
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+#include "cHttp.h"
+//}}}
+
+class cHlsReader {
+public:
+  cHlsReader (int connections = 3, int segmentsAhead = 4) :
+    mConnections(connections), mSegmentsAhead(segmentsAhead) { mExit = false; }
+  ~cHlsReader() { close(); }
+
+  static bool isHls (const std::string& url);
+
+  bool isLive() { return mLive; }
+  double getDuration();
+  std::string getDebugString();
+
+  bool open (const std::string& url);
+  int read (uint8_t* buf, int size);
+  double seekTime (double secs);
+  void close();
+
+private:
+  //{{{
+  class cSegment {
+  public:
+    int64_t mSeq;
+    double mStartSecs;
+    double mDuration;
+    std::string mUrl;
+    };
+  //}}}
+
+  static std::string resolveUrl (const std::string& baseUrl, const std::string& uri);
+  bool loadPlaylist (cHttp& http);
+
+  bool getNextSegment (int64_t& seq, std::string& url);
+  void trimCache();
+
+  void fetchThread (int id);
+  void playlistThread();
+
+  // vars
+  const int mConnections;
+  const int mSegmentsAhead;
+
+  std::string mUrl;
+  bool mLive = false;
+  double mTargetDuration = 10.0;
+
+  std::mutex mMutex;
+  std::condition_variable mSegmentCond;
+  std::condition_variable mFetchCond;
+
+  std::deque <cSegment> mSegments;
+  std::map <int64_t, std::vector<uint8_t>> mCache;
+  std::set <int64_t> mFetching;
+  int64_t mCurSeq = 0;
+  int mCurOffset = 0;
+
+  std::vector <std::thread> mThreads;
+  std::atomic<bool> mExit;
+
+  // stats
+  int64_t mFetchedBytes = 0;
+  double mFetchSecs = 0.0;
+  double mWaitSecs = 0.0;
+  int mWaits = 0;
+  int mFailed = 0;
+  };
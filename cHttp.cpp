@@ -0,0 +1,544 @@
+// cHttp.cpp - http/1.1 client connection and parallel range prefetching reader
+//{{{  includes
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <chrono>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cHttp.h"
+
+using namespace std;
+//}}}
+const int kRxBufferSize = 0x10000;
+const int kSocketTimeoutSecs = 5;
+const int kMaxRedirects = 5;
+const int kFetchTries = 3;
+
+//{{{
+static double getSecs() {
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+  }
+//}}}
+
+// cHttp
+//{{{
+bool cHttp::parseUrl (const string& url, string& host, int& port, string& path) {
+// split http://host[:port][/path], only plain http
+
+  if (url.compare (0, 7, "http://") != 0)
+    return false;
+
+  auto hostStart = url.begin() + 7;
+  auto pathStart = find (hostStart, url.end(), '/');
+  string hostPort (hostStart, pathStart);
+  path = (pathStart == url.end()) ? "/" : string (pathStart, url.end());
+
+  auto colon = hostPort.find (':');
+  host = hostPort.substr (0, colon);
+  port = (colon == string::npos) ? 80 : atoi (hostPort.c_str() + colon + 1);
+
+  return !host.empty() && (port > 0);
+  }
+//}}}
+//{{{
+int cHttp::get (const string& url, vector<uint8_t>& body, int64_t from, int64_t to) {
+// get url, byte range from-to inclusive if from >= 0, return http status, 0 on connection error
+
+  string getUrl = url;
+  for (int redirect = 0; redirect < kMaxRedirects; redirect++) {
+    string host;
+    int port;
+    string path;
+    if (!parseUrl (getUrl, host, port, path)) {
+      //{{{  error return
+      cLog::log (LOGERROR, string(__func__) + " unsupported url " + getUrl);
+      return 0;
+      }
+      //}}}
+
+    // keepalive connection may have gone stale, retry once on a fresh one
+    int status = 0;
+    string location;
+    for (int tries = 0; (tries < 2) && !status; tries++) {
+      if ((mSocket < 0) || (host != mHost) || (port != mPort)) {
+        close();
+        if (!connect (host, port))
+          return 0;
+        }
+      status = request (path, body, from, to, location);
+      if (!status)
+        close();
+      }
+
+    if ((status >= 300) && (status < 400) && !location.empty()) {
+      getUrl = (location[0] == '/') ? "http://" + mHost + ":" + dec(mPort) + location : location;
+      continue;
+      }
+
+    mUrl = getUrl;
+    return status;
+    }
+
+  cLog::log (LOGERROR, string(__func__) + " too many redirects " + url);
+  return 0;
+  }
+//}}}
+//{{{
+void cHttp::close() {
+
+  if (mSocket >= 0)
+    ::close (mSocket);
+
+  mSocket = -1;
+  mRxHead = 0;
+  mRxTail = 0;
+  }
+//}}}
+
+// cHttp private
+//{{{
+bool cHttp::connect (const string& host, int port) {
+
+  struct addrinfo hints;
+  memset (&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo* addrs = nullptr;
+  if (getaddrinfo (host.c_str(), dec(port).c_str(), &hints, &addrs) || !addrs) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " unable to resolve " + host);
+    return false;
+    }
+    //}}}
+
+  for (auto addr = addrs; addr && (mSocket < 0); addr = addr->ai_next) {
+    mSocket = socket (addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (mSocket < 0)
+      continue;
+
+    struct timeval timeout = { kSocketTimeoutSecs, 0 };
+    setsockopt (mSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt (mSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int noDelay = 1;
+    setsockopt (mSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    if (::connect (mSocket, addr->ai_addr, addr->ai_addrlen) < 0) {
+      ::close (mSocket);
+      mSocket = -1;
+      }
+    }
+  freeaddrinfo (addrs);
+
+  if (mSocket < 0) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " unable to connect " + host + ":" + dec(port));
+    return false;
+    }
+    //}}}
+
+  mHost = host;
+  mPort = port;
+  mRxHead = 0;
+  mRxTail = 0;
+  return true;
+  }
+//}}}
+//{{{
+int cHttp::request (const string& path, vector<uint8_t>& body, int64_t from, int64_t to, string& location) {
+// send GET, read status, headers and body, return status, 0 on connection error
+
+  string req = "GET " + path + " HTTP/1.1\r\n" +
+               "Host: " + mHost + ((mPort != 80) ? ":" + dec(mPort) : "") + "\r\n" +
+               "User-Agent: omx\r\n" +
+               "Connection: keep-alive\r\n";
+  if (from >= 0)
+    req += "Range: bytes=" + to_string (from) + "-" + ((to >= 0) ? to_string (to) : "") + "\r\n";
+  req += "\r\n";
+
+  for (size_t sent = 0; sent < req.size(); ) {
+    auto bytes = send (mSocket, req.data() + sent, req.size() - sent, MSG_NOSIGNAL);
+    if (bytes <= 0)
+      return 0;
+    sent += bytes;
+    }
+
+  // status line
+  string line;
+  if (!readLine (line) || (line.compare (0, 5, "HTTP/") != 0))
+    return 0;
+  auto space = line.find (' ');
+  int status = (space == string::npos) ? 0 : atoi (line.c_str() + space + 1);
+
+  //{{{  headers
+  int64_t contentLength = -1;
+  int64_t contentRangeSize = -1;
+  bool chunked = false;
+  bool keepAlive = true;
+
+  while (true) {
+    if (!readLine (line))
+      return 0;
+    if (line.empty())
+      break;
+
+    auto colon = line.find (':');
+    if (colon == string::npos)
+      continue;
+
+    string name = line.substr (0, colon);
+    transform (name.begin(), name.end(), name.begin(), ::tolower);
+    auto valueStart = line.find_first_not_of (' ', colon + 1);
+    string value = (valueStart == string::npos) ? "" : line.substr (valueStart);
+
+    if (name == "content-length")
+      contentLength = strtoll (value.c_str(), nullptr, 10);
+    else if (name == "content-range") {
+      // bytes from-to/size
+      auto slash = value.find ('/');
+      if ((slash != string::npos) && (value[slash+1] != '*'))
+        contentRangeSize = strtoll (value.c_str() + slash + 1, nullptr, 10);
+      }
+    else if (name == "transfer-encoding")
+      chunked = value.find ("chunked") != string::npos;
+    else if (name == "connection")
+      keepAlive = value.find ("close") == string::npos;
+    else if (name == "location")
+      location = value;
+    }
+  //}}}
+  //{{{  body
+  body.clear();
+  if ((status == 204) || (status == 304)) {
+    }
+
+  else if (chunked) {
+    while (true) {
+      if (!readLine (line))
+        return 0;
+      int64_t size = strtoll (line.c_str(), nullptr, 16);
+      if (!size)
+        break;
+      auto offset = body.size();
+      body.resize (offset + size);
+      if (!readBytes (body.data() + offset, (int)size) || !readLine (line))
+        return 0;
+      }
+    // trailers
+    while (readLine (line) && !line.empty()) {}
+    }
+
+  else if (contentLength >= 0) {
+    body.resize (contentLength);
+    if (contentLength && !readBytes (body.data(), (int)contentLength))
+      return 0;
+    }
+
+  else {
+    // no length, body runs to connection close
+    keepAlive = false;
+    while (fillRx()) {
+      body.insert (body.end(), mRx.begin() + mRxHead, mRx.begin() + mRxTail);
+      mRxHead = mRxTail;
+      }
+    }
+  //}}}
+
+  if (contentRangeSize >= 0)
+    mContentSize = contentRangeSize;
+  else if ((status == 200) && (contentLength >= 0))
+    mContentSize = contentLength;
+
+  if (!keepAlive)
+    close();
+
+  return status;
+  }
+//}}}
+
+//{{{
+bool cHttp::readLine (string& line) {
+
+  line.clear();
+  while (true) {
+    if ((mRxHead == mRxTail) && !fillRx())
+      return false;
+
+    auto start = mRx.begin() + mRxHead;
+    auto end = mRx.begin() + mRxTail;
+    auto newline = find (start, end, '\n');
+    line.append (start, newline);
+    if (newline != end) {
+      mRxHead += int(newline - start) + 1;
+      if (!line.empty() && (line.back() == '\r'))
+        line.pop_back();
+      return true;
+      }
+    mRxHead = mRxTail;
+    }
+  }
+//}}}
+//{{{
+bool cHttp::readBytes (uint8_t* buf, int size) {
+
+  // use up what we have buffered
+  int bytes = min (size, mRxTail - mRxHead);
+  memcpy (buf, mRx.data() + mRxHead, bytes);
+  mRxHead += bytes;
+
+  // then straight into buf
+  while (bytes < size) {
+    auto received = recv (mSocket, buf + bytes, size - bytes, 0);
+    if (received <= 0)
+      return false;
+    bytes += received;
+    }
+
+  return true;
+  }
+//}}}
+//{{{
+bool cHttp::fillRx() {
+
+  if (mSocket < 0)
+    return false;
+
+  if (mRx.empty())
+    mRx.resize (kRxBufferSize);
+
+  if (mRxHead == mRxTail) {
+    mRxHead = 0;
+    mRxTail = 0;
+    }
+
+  auto received = recv (mSocket, mRx.data() + mRxTail, mRx.size() - mRxTail, 0);
+  if (received <= 0)
+    return false;
+
+  mRxTail += received;
+  return true;
+  }
+//}}}
+
+// cHttpReader
+//{{{
+string cHttpReader::getDebugString() {
+
+  lock_guard<mutex> lockGuard (mMutex);
+  return "http chunks:" + dec(mChunks.size()) +
+         " " + frac(mFetchSecs > 0.0 ? mFetchedBytes / mFetchSecs / 1000000.0 : 0.0, 5,2,' ') + "mB/s" +
+         " waits:" + dec(mWaits) + " " + frac(mWaitSecs, 5,2,' ') + "s";
+  }
+//}}}
+//{{{
+bool cHttpReader::open (const string& url) {
+
+  close();
+
+  mExit = false;
+  mPos = 0;
+
+  // first chunk tells us length and whether server does ranges
+  cHttp http;
+  vector<uint8_t> body;
+  double startSecs = getSecs();
+  int status = http.get (url, body, 0, mChunkSize - 1);
+  if ((status != 206) || (http.getContentSize() <= 0)) {
+    //{{{  no ranges, return
+    cLog::log (LOGINFO, string(__func__) + " no range support " + dec(status) + " " + url);
+    return false;
+    }
+    //}}}
+
+  mUrl = http.getUrl();
+  mLength = http.getContentSize();
+  mFetchedBytes = body.size();
+  mFetchSecs = getSecs() - startSecs;
+  mChunks[0] = move (body);
+
+  for (int i = 0; i < mConnections; i++)
+    mThreads.push_back (thread ([=]() { fetchThread (i); }));
+
+  cLog::log (LOGINFO, string(__func__) + " " + mUrl + " length:" + to_string (mLength) +
+                      " connections:" + dec(mConnections) + " chunk:" + dec(mChunkSize / 1024) + "k");
+  return true;
+  }
+//}}}
+//{{{
+int cHttpReader::read (uint8_t* buf, int size) {
+// copy from chunk holding mPos, wait for it if not yet fetched, return bytes, 0 at eof,
+// -1 if that chunk's fetch failed, the next read of it fetches it again
+
+  unique_lock<mutex> lock (mMutex);
+
+  if (mPos >= mLength)
+    return 0;
+
+  int64_t chunk = mPos / mChunkSize;
+  auto it = mChunks.find (chunk);
+  if (it == mChunks.end()) {
+    //{{{  wait for chunk
+    mWaits++;
+    double startSecs = getSecs();
+
+    mFetchCond.notify_all();
+    while (!mExit && !mFailed.count (chunk) && ((it = mChunks.find (chunk)) == mChunks.end()))
+      mChunkCond.wait (lock);
+
+    mWaitSecs += getSecs() - startSecs;
+    if (it == mChunks.end()) {
+      mFailed.erase (chunk);
+      return -1;
+      }
+    }
+    //}}}
+
+  int offset = int(mPos - (chunk * mChunkSize));
+  int bytes = min (size, (int)it->second.size() - offset);
+  memcpy (buf, it->second.data() + offset, bytes);
+  mPos += bytes;
+
+  if (mPos / mChunkSize != chunk) {
+    // window moved on
+    trimChunks();
+    mFetchCond.notify_all();
+    }
+
+  return bytes;
+  }
+//}}}
+//{{{
+int64_t cHttpReader::seek (int64_t pos, int whence) {
+
+  lock_guard<mutex> lockGuard (mMutex);
+
+  if (whence == SEEK_CUR)
+    pos += mPos;
+  else if (whence == SEEK_END)
+    pos += mLength;
+  else if (whence != SEEK_SET)
+    return -1;
+
+  if ((pos < 0) || (pos > mLength))
+    return -1;
+
+  mPos = pos;
+  mFailed.clear();
+  trimChunks();
+  mFetchCond.notify_all();
+
+  return mPos;
+  }
+//}}}
+//{{{
+void cHttpReader::close() {
+
+  {
+  lock_guard<mutex> lockGuard (mMutex);
+  mExit = true;
+  }
+  mFetchCond.notify_all();
+  mChunkCond.notify_all();
+
+  for (auto& thread : mThreads)
+    thread.join();
+  mThreads.clear();
+
+  if (mFetchedBytes)
+    cLog::log (LOGINFO, string(__func__) + " " + getDebugString());
+
+  mChunks.clear();
+  mFetching.clear();
+  mFailed.clear();
+  mFetchedBytes = 0;
+  mFetchSecs = 0.0;
+  mWaitSecs = 0.0;
+  mWaits = 0;
+  }
+//}}}
+
+// cHttpReader private
+//{{{
+bool cHttpReader::getNextChunk (int64_t& chunk) {
+// nearest unfetched chunk in window ahead of mPos, failed ones wait for a read to clear them, locked by caller
+
+  int64_t firstChunk = mPos / mChunkSize;
+  int64_t lastChunk = min (firstChunk + mChunksAhead, (mLength - 1) / mChunkSize);
+
+  for (chunk = firstChunk; chunk <= lastChunk; chunk++)
+    if (!mChunks.count (chunk) && !mFetching.count (chunk) && !mFailed.count (chunk))
+      return true;
+
+  return false;
+  }
+//}}}
+//{{{
+void cHttpReader::trimChunks() {
+// drop chunks outside window, keep one behind mPos for short backward seeks, locked by caller
+
+  int64_t firstChunk = mPos / mChunkSize;
+  for (auto it = mChunks.begin(); it != mChunks.end(); )
+    if ((it->first < firstChunk - 1) || (it->first > firstChunk + mChunksAhead))
+      it = mChunks.erase (it);
+    else
+      ++it;
+
+  // failures behind mPos won't be read, fetched again if seeked back to
+  mFailed.erase (mFailed.begin(), mFailed.lower_bound (firstChunk));
+  }
+//}}}
+//{{{
+void cHttpReader::fetchThread (int id) {
+
+  cLog::setThreadName ("htp" + dec(id));
+
+  cHttp http;
+  unique_lock<mutex> lock (mMutex);
+  while (!mExit) {
+    int64_t chunk;
+    if (!getNextChunk (chunk)) {
+      mFetchCond.wait (lock);
+      continue;
+      }
+    mFetching.insert (chunk);
+    lock.unlock();
+
+    int64_t from = chunk * mChunkSize;
+    int64_t to = min (from + mChunkSize, mLength) - 1;
+
+    vector<uint8_t> body;
+    int status = 0;
+    double startSecs = getSecs();
+    for (int tries = 0; (tries < kFetchTries) && (status != 206) && !mExit; tries++)
+      status = http.get (mUrl, body, from, to);
+    double secs = getSecs() - startSecs;
+
+    lock.lock();
+    mFetching.erase (chunk);
+    if ((status == 206) && ((int64_t)body.size() == to - from + 1)) {
+      mFetchedBytes += body.size();
+      mFetchSecs += secs;
+      mChunks[chunk] = move (body);
+      mFailed.erase (chunk);
+      cLog::log (LOGINFO2, "chunk " + to_string (chunk) + " " + frac(secs, 5,3,' ') + "s");
+      }
+    else if (!mExit) {
+      cLog::log (LOGERROR, string(__func__) + " chunk " + to_string (chunk) + " status " + dec(status));
+      mFailed.insert (chunk);
+      }
+
+    trimChunks();
+    mChunkCond.notify_all();
+    }
+
+  cLog::log (LOGINFO1, "exit");
+  }
+//}}}
@@ -0,0 +1,97 @@
+// cHttp.h - http/1.1 client connection and parallel range prefetching reader
+//{{{  includes
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+//}}}
+
+//{{{
+class cHttp {
+// single keepalive connection, reconnects as needed, follows redirects
+public:
+  ~cHttp() { close(); }
+
+  static bool parseUrl (const std::string& url, std::string& host, int& port, std::string& path);
+
+  int64_t getContentSize() { return mContentSize; }
+  std::string getUrl() { return mUrl; }
+
+  int get (const std::string& url, std::vector<uint8_t>& body, int64_t from = -1, int64_t to = -1);
+  void close();
+
+private:
+  bool connect (const std::string& host, int port);
+  int request (const std::string& path, std::vector<uint8_t>& body, int64_t from, int64_t to,
+               std::string& location);
+
+  bool readLine (std::string& line);
+  bool readBytes (uint8_t* buf, int size);
+  bool fillRx();
+
+  // vars
+  int mSocket = -1;
+  std::string mHost;
+  int mPort = 0;
+  std::string mUrl;
+  int64_t mContentSize = -1;
+
+  std::vector<uint8_t> mRx;
+  int mRxHead = 0;
+  int mRxTail = 0;
+  };
+//}}}
+//{{{
+class cHttpReader {
+// serves sequential reads from chunks fetched ahead of the read position over several connections
+public:
+  cHttpReader (int connections = 4, int chunkSize = 256 * 1024, int chunksAhead = 16) :
+    mConnections(connections), mChunkSize(chunkSize), mChunksAhead(chunksAhead) { mExit = false; }
+  ~cHttpReader() { close(); }
+
+  int64_t getLength() { return mLength; }
+  int64_t getPosition() { return mPos; }
+  std::string getDebugString();
+
+  bool open (const std::string& url);
+  int read (uint8_t* buf, int size);
+  int64_t seek (int64_t pos, int whence);
+  void close();
+
+private:
+  bool getNextChunk (int64_t& chunk);
+  void trimChunks();
+  void fetchThread (int id);
+
+  // vars
+  const int mConnections;
+  const int mChunkSize;
+  const int mChunksAhead;
+
+  std::string mUrl;
+  int64_t mLength = 0;
+  int64_t mPos = 0;
+
+  std::mutex mMutex;
+  std::condition_variable mChunkCond;
+  std::condition_variable mFetchCond;
+  std::map <int64_t, std::vector<uint8_t>> mChunks;
+  std::set <int64_t> mFetching;
+  std::set <int64_t> mFailed;  // gave up after kFetchTries, fails the read waiting on it, then refetched
+  std::vector <std::thread> mThreads;
+  std::atomic<bool> mExit;
+
+  // stats
+  int64_t mFetchedBytes = 0;
+  double mFetchSecs = 0.0;
+  double mWaitSecs = 0.0;
+  int mWaits = 0;
+  };
+//}}}
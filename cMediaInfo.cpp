@@ -0,0 +1,412 @@
+// cMediaInfo.cpp - background duration, streams and thumbnail for the file list, cached on disk by mtime
+//{{{  includes
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <algorithm>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cMediaInfo.h"
+
+using namespace std;
+//}}}
+const int kMaxThumbPackets = 200;
+const int kYieldMs = 50;
+
+//{{{
+static double getSecs() {
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+  }
+//}}}
+//{{{
+static int interruptCb (void* exit) {
+  return *(atomic<bool>*)exit;
+  }
+//}}}
+
+// cMediaInfo
+//{{{
+string cMediaInfo::getString() {
+
+  if (!mOk)
+    return "no info";
+
+  int secs = (int)mDuration;
+  string str = dec(secs / 3600) + ":" + dec((secs / 60) % 60, 2, '0') + ":" + dec(secs % 60, 2, '0');
+  for (auto& stream : mStreams)
+    str += " " + stream;
+  return str;
+  }
+//}}}
+
+// cMediaInfoPool
+//{{{
+cMediaInfoPool::cMediaInfoPool (const string& cacheDir, int threads, int thumbWidth) :
+    mCacheDir(cacheDir), mThumbWidth(thumbWidth) {
+
+  mExit = false;
+  mYield = false;
+
+  mkdir (mCacheDir.c_str(), 0755);
+
+  mAvFormat.av_register_all();
+  mAvCodec.avcodec_register_all();
+
+  for (int i = 0; i < threads; i++)
+    mThreads.push_back (thread ([=]() { workerThread (i); }));
+
+  cLog::log (LOGINFO, string(__func__) + " " + mCacheDir + " threads:" + dec(threads));
+  }
+//}}}
+//{{{
+cMediaInfoPool::~cMediaInfoPool() {
+
+  {
+  lock_guard<mutex> lockGuard (mMutex);
+  mExit = true;
+  }
+  mQueueCond.notify_all();
+
+  for (auto& thread : mThreads)
+    thread.join();
+
+  cLog::log (LOGINFO, string(__func__) + " " + getDebugString());
+  }
+//}}}
+
+//{{{
+bool cMediaInfoPool::getInfo (const string& fileName, cMediaInfo& info) {
+
+  lock_guard<mutex> lockGuard (mMutex);
+
+  auto it = mInfos.find (fileName);
+  if (it == mInfos.end())
+    return false;
+
+  info = it->second;
+  return true;
+  }
+//}}}
+//{{{
+string cMediaInfoPool::getString (const string& fileName) {
+
+  lock_guard<mutex> lockGuard (mMutex);
+
+  auto it = mInfos.find (fileName);
+  return (it == mInfos.end()) ? "" : it->second.getString();
+  }
+//}}}
+//{{{
+string cMediaInfoPool::getDebugString() {
+
+  lock_guard<mutex> lockGuard (mMutex);
+  return "info queued:" + dec(mQueue.size()) +
+         " cached:" + dec(mCacheHits) +
+         " extracted:" + dec(mExtracted) + " " + frac(mExtracted ? mExtractSecs / mExtracted : 0.0, 5,2,' ') + "s" +
+         " failed:" + dec(mFailed);
+  }
+//}}}
+
+//{{{
+void cMediaInfoPool::add (const vector<string>& fileNames) {
+// queue files we haven't seen, results stay keyed by name until the pool goes
+
+  {
+  lock_guard<mutex> lockGuard (mMutex);
+  for (auto& fileName : fileNames)
+    if (!mInfos.count (fileName) && (find (mQueue.begin(), mQueue.end(), fileName) == mQueue.end()))
+      mQueue.push_back (fileName);
+  }
+
+  mQueueCond.notify_all();
+  }
+//}}}
+
+// private
+//{{{
+string cMediaInfoPool::getCacheName (const string& fileName) {
+
+  char name[20];
+  snprintf (name, sizeof(name), "%016llx", (unsigned long long)hash<string>()(fileName));
+  return mCacheDir + "/" + name;
+  }
+//}}}
+//{{{
+bool cMediaInfoPool::loadCache (const string& fileName, int64_t mtime, cMediaInfo& info) {
+// text .info, rgb .ppm thumb alongside, stale if the file's mtime moved on
+
+  ifstream infoFile (getCacheName (fileName) + ".info");
+  if (!infoFile)
+    return false;
+
+  string line;
+  while (getline (infoFile, line)) {
+    auto colon = line.find (':');
+    if (colon == string::npos)
+      continue;
+    string key = line.substr (0, colon);
+    string value = line.substr (colon + 1);
+
+    if (key == "file") {
+      if (value != fileName)
+        return false;
+      }
+    else if (key == "mtime") {
+      info.mMtime = atoll (value.c_str());
+      if (info.mMtime != mtime)
+        return false;
+      }
+    else if (key == "duration")
+      info.mDuration = atof (value.c_str());
+    else if (key == "size")
+      sscanf (value.c_str(), "%dx%d", &info.mWidth, &info.mHeight);
+    else if (key == "stream")
+      info.mStreams.push_back (value);
+    }
+
+  ifstream thumbFile (getCacheName (fileName) + ".ppm", ios::binary);
+  if (thumbFile) {
+    string magic;
+    int maxValue = 0;
+    thumbFile >> magic >> info.mThumbWidth >> info.mThumbHeight >> maxValue;
+    thumbFile.get();
+    if ((magic == "P6") && (info.mThumbWidth > 0) && (info.mThumbHeight > 0)) {
+      info.mThumb.resize (info.mThumbWidth * info.mThumbHeight * 3);
+      thumbFile.read ((char*)info.mThumb.data(), info.mThumb.size());
+      }
+    if (!thumbFile) {
+      info.mThumb.clear();
+      info.mThumbWidth = 0;
+      info.mThumbHeight = 0;
+      }
+    }
+
+  info.mOk = info.mMtime == mtime;
+  return info.mOk;
+  }
+//}}}
+//{{{
+void cMediaInfoPool::saveCache (const string& fileName, const cMediaInfo& info) {
+
+  ofstream infoFile (getCacheName (fileName) + ".info");
+  infoFile << "file:" << fileName << "\n"
+           << "mtime:" << info.mMtime << "\n"
+           << "duration:" << info.mDuration << "\n"
+           << "size:" << info.mWidth << "x" << info.mHeight << "\n";
+  for (auto& stream : info.mStreams)
+    infoFile << "stream:" << stream << "\n";
+
+  if (!info.mThumb.empty()) {
+    ofstream thumbFile (getCacheName (fileName) + ".ppm", ios::binary);
+    thumbFile << "P6\n" << info.mThumbWidth << " " << info.mThumbHeight << "\n255\n";
+    thumbFile.write ((const char*)info.mThumb.data(), info.mThumb.size());
+    }
+  }
+//}}}
+
+//{{{
+bool cMediaInfoPool::extract (const string& fileName, cMediaInfo& info) {
+// open with plain ffmpeg file io, streams from probe, then one keyframe for the thumb
+
+  AVFormatContext* formatContext = mAvFormat.avformat_alloc_context();
+  const AVIOInterruptCB intCb = { interruptCb, &mExit };
+  formatContext->interrupt_callback = intCb;
+
+  if (mAvFormat.avformat_open_input (&formatContext, fileName.c_str(), NULL, NULL) < 0) {
+    //{{{  error return
+    cLog::log (LOGINFO1, string(__func__) + " unable to open " + fileName);
+    return false;
+    }
+    //}}}
+
+  if (mAvFormat.avformat_find_stream_info (formatContext, NULL) < 0) {
+    //{{{  error return
+    cLog::log (LOGINFO1, string(__func__) + " no streams " + fileName);
+    mAvFormat.avformat_close_input (&formatContext);
+    return false;
+    }
+    //}}}
+
+  if (formatContext->duration != (int64_t)AV_NOPTS_VALUE)
+    info.mDuration = (double)formatContext->duration / AV_TIME_BASE;
+
+  int videoIndex = -1;
+  for (unsigned int i = 0; i < formatContext->nb_streams; i++) {
+    auto codecContext = formatContext->streams[i]->codec;
+    auto codec = mAvCodec.avcodec_find_decoder (codecContext->codec_id);
+    string codecName = codec ? codec->name : "unknown";
+
+    if (codecContext->codec_type == AVMEDIA_TYPE_VIDEO) {
+      if ((videoIndex < 0) && codecContext->width && codecContext->height) {
+        videoIndex = i;
+        info.mWidth = codecContext->width;
+        info.mHeight = codecContext->height;
+        }
+      info.mStreams.push_back ("v:" + codecName + " " + dec(codecContext->width) + "x" + dec(codecContext->height));
+      }
+    else if (codecContext->codec_type == AVMEDIA_TYPE_AUDIO)
+      info.mStreams.push_back ("a:" + codecName + " " + dec(codecContext->channels) + "ch " +
+                               dec(codecContext->sample_rate));
+    else if (codecContext->codec_type == AVMEDIA_TYPE_SUBTITLE)
+      info.mStreams.push_back ("s:" + codecName);
+    }
+
+  if (videoIndex >= 0)
+    extractThumb (formatContext, videoIndex, info);
+
+  mAvFormat.avformat_close_input (&formatContext);
+  info.mOk = true;
+  return true;
+  }
+//}}}
+//{{{
+bool cMediaInfoPool::extractThumb (AVFormatContext* formatContext, int streamIndex, cMediaInfo& info) {
+// seek a tenth in to skip black leaders, decode the first keyframe we land on, scale to rgb
+
+  auto codecContext = formatContext->streams[streamIndex]->codec;
+  auto codec = mAvCodec.avcodec_find_decoder (codecContext->codec_id);
+  if (!codec)
+    return false;
+
+  // one decode thread, we are the background
+  codecContext->thread_count = 1;
+  if (mAvCodec.avcodec_open2 (codecContext, codec, NULL) < 0) {
+    //{{{  error return
+    cLog::log (LOGINFO1, string(__func__) + " unable to open decoder " + codec->name);
+    return false;
+    }
+    //}}}
+
+  if (info.mDuration > 10.0)
+    mAvFormat.av_seek_frame (formatContext, -1, (int64_t)(info.mDuration / 10.0 * AV_TIME_BASE), AVSEEK_FLAG_BACKWARD);
+
+  auto frame = mAvUtil.av_frame_alloc();
+  bool gotKeyframe = false;
+  int gotPicture = 0;
+
+  AVPacket avPacket;
+  for (int packets = 0; (packets < kMaxThumbPackets) && !gotPicture && !mExit; packets++) {
+    waitYield();
+
+    mAvCodec.av_init_packet (&avPacket);
+    avPacket.data = NULL;
+    avPacket.size = 0;
+    if (mAvFormat.av_read_frame (formatContext, &avPacket) < 0)
+      break;
+
+    if (avPacket.stream_index == streamIndex) {
+      gotKeyframe |= (avPacket.flags & AV_PKT_FLAG_KEY) != 0;
+      if (gotKeyframe)
+        mAvCodec.avcodec_decode_video2 (codecContext, frame, &gotPicture, &avPacket);
+      }
+
+    mAvCodec.av_free_packet (&avPacket);
+    }
+
+  if (gotPicture) {
+    //{{{  scale to thumb width, height keeps display aspect
+    double aspect = (double)frame->width / frame->height;
+    if (codecContext->sample_aspect_ratio.num && codecContext->sample_aspect_ratio.den)
+      aspect *= av_q2d (codecContext->sample_aspect_ratio);
+
+    info.mThumbWidth = mThumbWidth;
+    info.mThumbHeight = max (2, ((int)(mThumbWidth / aspect) + 1) & ~1);
+    info.mThumb.resize (info.mThumbWidth * info.mThumbHeight * 3);
+
+    auto swsContext = mSwScale.sws_getCachedContext (NULL,
+      frame->width, frame->height, (AVPixelFormat)frame->format,
+      info.mThumbWidth, info.mThumbHeight, AV_PIX_FMT_RGB24, SWS_BILINEAR, NULL, NULL, NULL);
+
+    if (swsContext) {
+      uint8_t* dst[4] = { info.mThumb.data(), NULL, NULL, NULL };
+      int dstStride[4] = { info.mThumbWidth * 3, 0, 0, 0 };
+      mSwScale.sws_scale (swsContext, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+      mSwScale.sws_freeContext (swsContext);
+      }
+    else {
+      info.mThumb.clear();
+      info.mThumbWidth = 0;
+      info.mThumbHeight = 0;
+      }
+    }
+    //}}}
+
+  mAvUtil.av_frame_free (&frame);
+  mAvCodec.avcodec_close (codecContext);
+  return !info.mThumb.empty();
+  }
+//}}}
+//{{{
+void cMediaInfoPool::waitYield() {
+// playback wants the cpu, SCHED_IDLE doesn't cover the disk or the decoders' memory bandwidth
+
+  while (mYield && !mExit)
+    this_thread::sleep_for (chrono::milliseconds (kYieldMs));
+  }
+//}}}
+
+//{{{
+void cMediaInfoPool::workerThread (int id) {
+
+  cLog::setThreadName ("inf" + dec(id));
+
+  // only runs when nothing else wants the cpu
+  sched_param schedParam;
+  memset (&schedParam, 0, sizeof(schedParam));
+  pthread_setschedparam (pthread_self(), SCHED_IDLE, &schedParam);
+
+  while (true) {
+    string fileName;
+    {
+    unique_lock<mutex> lock (mMutex);
+    while (!mExit && mQueue.empty())
+      mQueueCond.wait (lock);
+    if (mExit)
+      break;
+    fileName = mQueue.front();
+    mQueue.pop_front();
+    }
+
+    waitYield();
+
+    struct stat st;
+    if (stat (fileName.c_str(), &st) != 0)
+      continue;
+
+    cMediaInfo info;
+    bool cached = loadCache (fileName, st.st_mtime, info);
+    if (!cached) {
+      info = cMediaInfo();
+      info.mMtime = st.st_mtime;
+
+      double startSecs = getSecs();
+      if (extract (fileName, info))
+        saveCache (fileName, info);
+
+      lock_guard<mutex> lockGuard (mMutex);
+      if (info.mOk) {
+        mExtracted++;
+        mExtractSecs += getSecs() - startSecs;
+        }
+      else
+        mFailed++;
+      }
+
+    lock_guard<mutex> lockGuard (mMutex);
+    if (cached)
+      mCacheHits++;
+    mInfos[fileName] = info;
+    cLog::log (LOGINFO1, string(cached ? "cached " : "extracted ") + fileName + " " + info.getString());
+    }
+
+  cLog::log (LOGINFO1, "exit");
+  }
+//}}}
@@ -0,0 +1,85 @@
+// cMediaInfo.h - background duration, streams and thumbnail for the file list, cached on disk by mtime
+//{{{  includes
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+#include "avLibs.h"
+//}}}
+
+//{{{
+class cMediaInfo {
+public:
+  std::string getString();
+
+  bool mOk = false;
+  int64_t mMtime = 0;
+  double mDuration = 0.0;
+
+  // one line per stream, type codec and format
+  std::vector<std::string> mStreams;
+  int mWidth = 0;
+  int mHeight = 0;
+
+  // rgb24, from a keyframe about a tenth of the way in
+  int mThumbWidth = 0;
+  int mThumbHeight = 0;
+  std::vector<uint8_t> mThumb;
+  };
+//}}}
+
+class cMediaInfoPool {
+public:
+  cMediaInfoPool (const std::string& cacheDir, int threads = 1, int thumbWidth = 160);
+  ~cMediaInfoPool();
+
+  bool getInfo (const std::string& fileName, cMediaInfo& info);
+  std::string getString (const std::string& fileName);
+  std::string getDebugString();
+
+  // playback buffering or seeking, workers hold off between packets
+  void setYield (bool yield) { mYield = yield; }
+  void add (const std::vector<std::string>& fileNames);
+
+private:
+  std::string getCacheName (const std::string& fileName);
+  bool loadCache (const std::string& fileName, int64_t mtime, cMediaInfo& info);
+  void saveCache (const std::string& fileName, const cMediaInfo& info);
+
+  bool extract (const std::string& fileName, cMediaInfo& info);
+  bool extractThumb (AVFormatContext* formatContext, int streamIndex, cMediaInfo& info);
+  void waitYield();
+
+  void workerThread (int id);
+
+  // vars
+  const std::string mCacheDir;
+  const int mThumbWidth;
+
+  cAvUtil mAvUtil;
+  cAvCodec mAvCodec;
+  cAvFormat mAvFormat;
+  cSwScale mSwScale;
+
+  std::mutex mMutex;
+  std::condition_variable mQueueCond;
+  std::deque <std::string> mQueue;
+  std::map <std::string, cMediaInfo> mInfos;
+  std::vector <std::thread> mThreads;
+  std::atomic<bool> mExit;
+  std::atomic<bool> mYield;
+
+  // stats
+  int mCacheHits = 0;
+  int mExtracted = 0;
+  int mFailed = 0;
+  double mExtractSecs = 0.0;
+  };
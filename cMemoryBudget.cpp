@@ -0,0 +1,159 @@
+// cMemoryBudget.cpp - one arm memory budget, per consumer quotas, live accounting, pressure to shrink before oom
+//{{{  includes
+#include <stdio.h>
+#include <string.h>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cMemoryBudget.h"
+
+using namespace std;
+//}}}
+//{{{
+const char* kConsumerNames[cMemoryBudget::eConsumerCount] = {
+  "packets", "omxFifo", "audioOut", "power", "reader", "rec" };
+//}}}
+
+// budget used fraction that raises pressure
+const double kSoftUsed = 0.85;
+const double kHardUsed = 0.95;
+
+//{{{
+cMemoryBudget& cMemoryBudget::get() {
+  static cMemoryBudget memoryBudget;
+  return memoryBudget;
+  }
+//}}}
+
+//{{{
+int64_t cMemoryBudget::getUsed() {
+
+  int64_t used = 0;
+  for (int i = 0; i < eConsumerCount; i++)
+    used += mUsed[i];
+  return used;
+  }
+//}}}
+//{{{
+int64_t cMemoryBudget::getLimit (eConsumer consumer) {
+// shrinkable consumers get half their quota under soft pressure, a quarter under hard
+
+  int64_t quota = mQuota[consumer];
+  if ((consumer == ePackets) || (consumer == ePowerHistory))
+    switch (getPressure()) {
+      case eSoft: return quota / 2;
+      case eHard: return quota / 4;
+      default: break;
+      }
+
+  return quota;
+  }
+//}}}
+//{{{
+string cMemoryBudget::getDebugString() {
+
+  string str = "mem " + dec(getUsed() / 1024) + "k/" + dec(mTotal / 1024) + "k";
+  for (int i = 0; i < eConsumerCount; i++)
+    if (mUsed[i])
+      str += " " + string(kConsumerNames[i]) + ":" + dec(mUsed[i] / 1024) + "k";
+
+  switch (getPressure()) {
+    case eSoft: str += " soft"; break;
+    case eHard: str += " hard"; break;
+    default: break;
+    }
+  return str;
+  }
+//}}}
+
+//{{{
+void cMemoryBudget::setMinAvailable (int64_t softBytes, int64_t hardBytes) {
+  mSoftAvailable = softBytes;
+  mHardAvailable = hardBytes;
+  }
+//}}}
+
+//{{{
+bool cMemoryBudget::tryAlloc (eConsumer consumer, int64_t bytes) {
+// check and add under one lock, so tryAllocs on different threads can't both pass and overrun
+
+  lock_guard<mutex> lockGuard (mTryAllocMutex);
+  if ((mUsed[consumer] + bytes > getLimit (consumer)) || (getUsed() + bytes > mTotal))
+    return false;
+
+  mUsed[consumer] += bytes;
+  return true;
+  }
+//}}}
+//{{{
+void cMemoryBudget::update() {
+// worst of our own accounting and the kernel's view, logs transitions
+
+  int64_t used = getUsed();
+  mMemAvailable = getMemAvailable();
+
+  ePressure pressure = eNone;
+  if ((used > mTotal * kHardUsed) || ((mMemAvailable >= 0) && (mMemAvailable < mHardAvailable)))
+    pressure = eHard;
+  else if ((used > mTotal * kSoftUsed) || ((mMemAvailable >= 0) && (mMemAvailable < mSoftAvailable)))
+    pressure = eSoft;
+
+  int lastPressure = mPressure.exchange (pressure);
+  if (pressure != lastPressure) {
+    if (pressure == eSoft)
+      mSoftEvents++;
+    else if (pressure == eHard)
+      mHardEvents++;
+
+    cLog::log ((pressure > lastPressure) ? LOGERROR : LOGINFO,
+               "memory pressure " + dec(lastPressure) + " to " + dec(pressure) +
+               " available:" + dec(mMemAvailable / 1024) + "k" +
+               " soft:" + dec(mSoftEvents) + " hard:" + dec(mHardEvents) +
+               " " + getDebugString());
+    }
+  }
+//}}}
+
+// private
+//{{{
+cMemoryBudget::cMemoryBudget() {
+
+  mTotal = 64 * 1024 * 1024;
+  for (int i = 0; i < eConsumerCount; i++) {
+    mQuota[i] = 0;
+    mUsed[i] = 0;
+    }
+
+  mQuota[ePackets] = 32 * 1024 * 1024;
+  mQuota[eOmxFifo] = 4 * 1024 * 1024;
+  mQuota[eAudioOutput] = 2 * 1024 * 1024;
+  mQuota[ePowerHistory] = 8 * 1024 * 1024;
+  mQuota[eReader] = 1024 * 1024;
+  mQuota[eRecorder] = 16 * 1024 * 1024;
+
+  mPressure = eNone;
+  }
+//}}}
+//{{{
+int64_t cMemoryBudget::getMemAvailable() {
+// kernel's estimate of what can be had without swapping, -1 if unknown
+
+  FILE* file = fopen ("/proc/meminfo", "r");
+  if (!file)
+    return -1;
+
+  int64_t available = -1;
+  char line[128];
+  while (fgets (line, sizeof(line), file)) {
+    long long kb;
+    if (sscanf (line, "MemAvailable: %lld kB", &kb) == 1) {
+      available = kb * 1024;
+      break;
+      }
+    }
+
+  fclose (file);
+  return available;
+  }
+//}}}
@@ -0,0 +1,63 @@
+// cMemoryBudget.h - one arm memory budget, per consumer quotas, live accounting, pressure to shrink before oom
+//{{{  includes
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <mutex>
+//}}}
+
+class cMemoryBudget {
+public:
+  //{{{
+  enum eConsumer {
+    ePackets = 0,  // video and audio packet caches, shrinkable
+    eOmxFifo,      // video decoder input buffers, sized at open
+    eAudioOutput,  // decoded and mixed pcm buffers
+    ePowerHistory, // audio power map, shrinkable
+    eReader,       // avio buffers
+    eRecorder,     // recorder blocks
+    eConsumerCount
+    };
+  //}}}
+  enum ePressure { eNone = 0, eSoft, eHard };
+
+  static cMemoryBudget& get();
+
+  ePressure getPressure() { return (ePressure)mPressure.load(); }
+  int64_t getUsed (eConsumer consumer) { return mUsed[consumer]; }
+  int64_t getUsed();
+  int64_t getQuota (eConsumer consumer) { return mQuota[consumer]; }
+  int64_t getLimit (eConsumer consumer);
+  std::string getDebugString();
+
+  void setTotal (int64_t bytes) { mTotal = bytes; }
+  void setQuota (eConsumer consumer, int64_t bytes) { mQuota[consumer] = bytes; }
+  void setMinAvailable (int64_t softBytes, int64_t hardBytes);
+
+  // tryAlloc refuses past the consumer's limit or the total, alloc always accounts
+  bool tryAlloc (eConsumer consumer, int64_t bytes);
+  void alloc (eConsumer consumer, int64_t bytes) { mUsed[consumer] += bytes; }
+  void free (eConsumer consumer, int64_t bytes) { mUsed[consumer] -= bytes; }
+
+  // poll budget and kernel MemAvailable, about once a sec
+  void update();
+
+private:
+  cMemoryBudget();
+  int64_t getMemAvailable();
+
+  // vars
+  std::atomic<int64_t> mTotal;
+  std::atomic<int64_t> mQuota[eConsumerCount];
+  std::atomic<int64_t> mUsed[eConsumerCount];
+  std::mutex mTryAllocMutex; // tryAllocs check and add as one, alloc and free stay lock free
+
+  std::atomic<int> mPressure;
+  int64_t mSoftAvailable = 48 * 1024 * 1024;
+  int64_t mHardAvailable = 24 * 1024 * 1024;
+  int64_t mMemAvailable = -1;
+  int mSoftEvents = 0;
+  int mHardEvents = 0;
+  };
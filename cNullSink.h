@@ -0,0 +1,76 @@
+// cNullSink.h - discarding pcm sink, times how fast the audio path produces pcm
+//{{{  includes
+#pragma once
+
+#include <time.h>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cAudioSink.h"
+//}}}
+
+class cNullSink : public cAudioSink {
+public:
+  //{{{
+  virtual ~cNullSink() {
+    cLog::log (LOGNOTICE, "cNullSink " + getDebugString() +
+                          " writes:" + dec(mWrites) + " frames:" + dec((int)mFrames));
+    }
+  //}}}
+
+  bool isRealtime() { return false; }
+
+  //{{{
+  bool open (int sampleRate, int chans, uint64_t chanLayout) {
+
+    mSampleRate = sampleRate;
+    mChans = chans;
+    return true;
+    }
+  //}}}
+  //{{{
+  bool write (const int16_t* samples, int frames) {
+
+    if (!mWrites)
+      mFirstWrite = getSecs();
+    mLastWrite = getSecs();
+
+    mWrites++;
+    mFrames += frames;
+    return true;
+    }
+  //}}}
+  void flush() {}
+  void drain() {}
+
+  double getDelay() { return 0.0; }
+  //{{{
+  std::string getDebugString() {
+  // media secs consumed against wall secs between first and last write
+
+    double mediaSecs = mSampleRate ? (double)mFrames / mSampleRate : 0.0;
+    double wallSecs = mLastWrite - mFirstWrite;
+    return "null " + frac(mediaSecs, 6,1,' ') + "s in " + frac(wallSecs, 6,2,' ') + "s" +
+           (wallSecs > 0.0 ? " x" + frac(mediaSecs / wallSecs, 5,1,' ') : "");
+    }
+  //}}}
+
+private:
+  //{{{
+  static double getSecs() {
+
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return now.tv_sec + (now.tv_nsec / 1000000000.0);
+    }
+  //}}}
+
+  int mSampleRate = 0;
+  int mChans = 0;
+
+  int mWrites = 0;
+  int64_t mFrames = 0;
+  double mFirstWrite = 0.0;
+  double mLastWrite = 0.0;
+  };
@@ -1,15 +1,24 @@
 // cOmxAudio.cpp
 //{{{  includes
+#include <math.h>
 #include <algorithm>
+#include <time.h>
+
+#ifdef __ARM_NEON__
+  #include <arm_neon.h>
+#endif
 
 #include "../shared/utils/utils.h"
 #include "../shared/utils/cLog.h"
+#include "bcm_host.h"
 #include "cOmxAv.h"
 
 using namespace std;
 //}}}
 #define AUDIO_BUFFER_SECONDS 3
+const double kSinkSyncSecs = 0.03; // sink output early or late by more than this is waited for or dropped
 array<float,6> kSilent = { 0.f};
+const int kPowerEntryBytes = 64; // power map node, key and array, roughly
 const char kRoundedUpChansShift[] = {0,0,1,2,2,3,3,3,3};
 //{{{
 int getCountBits (uint64_t value) {
@@ -20,10 +29,65 @@ int getCountBits (uint64_t value) {
   return bits;
   }
 //}}}
+//{{{
+void mixPlanar (const float* const* in, int inChans, float* const* out, int outChans,
+                const float* matrix, int samples, float gain, float gainStep) {
+// out[o] = gain ramp * sum of matrix[8*o + i] * in[i], matrix and volume in one pass
+
+  for (int o = 0; o < outChans; o++) {
+    // gather the inputs that contribute to this output
+    const float* row = matrix + 8*o;
+    const float* src[8];
+    float coeff[8];
+    int numSrc = 0;
+    for (int i = 0; i < min (inChans, 8); i++)
+      if (row[i] != 0.f) {
+        src[numSrc] = in[i];
+        coeff[numSrc++] = row[i];
+        }
+
+    float* dst = out[o];
+    int sample = 0;
+  #ifdef __ARM_NEON__
+    float gains[4] = { gain, gain + gainStep, gain + 2.f*gainStep, gain + 3.f*gainStep };
+    float32x4_t gain4 = vld1q_f32 (gains);
+    float32x4_t gainStep4 = vdupq_n_f32 (4.f * gainStep);
+    for (; sample + 4 <= samples; sample += 4) {
+      float32x4_t acc = vdupq_n_f32 (0.f);
+      for (int i = 0; i < numSrc; i++)
+        acc = vmlaq_n_f32 (acc, vld1q_f32 (src[i] + sample), coeff[i]);
+      vst1q_f32 (dst + sample, vmulq_f32 (acc, gain4));
+      gain4 = vaddq_f32 (gain4, gainStep4);
+      }
+  #endif
+    for (; sample < samples; sample++) {
+      float acc = 0.f;
+      for (int i = 0; i < numSrc; i++)
+        acc += src[i][sample] * coeff[i];
+      dst[sample] = acc * (gain + sample * gainStep);
+      }
+    }
+  }
+//}}}
+//{{{
+double getThreadCpuSecs() {
+
+  struct timespec ts;
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + (ts.tv_nsec / 1000000000.0);
+  }
+//}}}
 
 //{{{
 cOmxAudio::~cOmxAudio() {
 
+  if (mMediaSecs > 0.0)
+    cLog::log (LOGINFO, string(__func__) + (mPassthrough ? " passthrough" : " decode") +
+                        " cpu:" + frac(getCpuPerHour(), 6,1,' ') + "s per hour" +
+                        " over " + frac(mMediaSecs, 6,1,' ') + "s");
+
+  delete mSink;
+
   // deallocate OMX wiring
   if (mTunnelClockAnalog.isInit() )
     mTunnelClockAnalog.deEstablish();
@@ -62,6 +126,13 @@ cOmxAudio::~cOmxAudio() {
 
   // deallocate ffmpeg resources
   mAvUtil.av_free (mOutput);
+  mAvUtil.av_free (mMixOutput);
+  cMemoryBudget::get().free (cMemoryBudget::eAudioOutput, mOutputAllocated + mMixOutputAllocated);
+  {
+  lock_guard<mutex> lockGuard (mPowerMapMutex);
+  cMemoryBudget::get().free (cMemoryBudget::ePowerHistory, mPowerMap.size() * kPowerEntryBytes);
+  mPowerMap.clear();
+  }
   if (mFrame)
     mAvUtil.av_free (mFrame);
   if (mConvert)
@@ -82,7 +153,11 @@ bool cOmxAudio::isEOS() {
 
   lock_guard<recursive_mutex> lockGuard (mMutex);
 
-  if (!mFailedEos &&
+  if (mSink) {
+    if (!mSubmittedEos || (mSink->getDelay() > 0.0))
+      return false;
+    }
+  else if (!mFailedEos &&
       !(mDecoder.isEOS() && (getAudioRenderingLatency() == 0)))
     return false;
 
@@ -99,6 +174,9 @@ double cOmxAudio::getDelay() {
 
   lock_guard<recursive_mutex> lockGuard (mMutex);
 
+  if (mSink)
+    return mSink->getDelay();
+
   double stamp = kNoPts;
   if ((mLastPts != kNoPts) && mClock)
     stamp = mClock->getMediaTime();
@@ -121,6 +199,13 @@ float cOmxAudio::getCacheTotal() {
   }
 //}}}
 //{{{
+unsigned int cOmxAudio::getInputBufferSpace() {
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+  return mSink ? 0 : mDecoder.getInputBufferSpace();
+  }
+//}}}
+//{{{
 int cOmxAudio::getChunkLen (int chans) {
 // we want audio_decode output buffer size to be no more than AUDIO_DECODE_OUTPUT_BUFFER.
 // it will be 16-bit and rounded up to next power of 2 chans
@@ -183,16 +268,70 @@ uint64_t cOmxAudio::getChanLayout (enum PCMLayout layout) {
 
 //{{{
 string cOmxAudio::getDebugString() {
-  return dec(mCodecContext->channels) + "@" + dec(mCodecContext->sample_rate);
+  return dec(mCodecContext->channels) + "@" + dec(mCodecContext->sample_rate) +
+         (mPassthrough ? " pt" : "") + " cpu:" + frac(getCpuPerHour(), 4,0,' ') + "s/h" +
+         (mSink ? " " + mSink->getDebugString() + " drop:" + dec(mSinkDropped) : "") +
+         (mConfig.mDriftTarget ? " drift:" + frac(mDriftPpm, 5,0,' ') + "ppm" : "");
   }
 //}}}
 //{{{
-array<float,6>& cOmxAudio::getPower (double pts) {
+array<float,6> cOmxAudio::getPower (double pts) {
 
+  lock_guard<mutex> lockGuard (mPowerMapMutex);
   auto powerIt = mPowerMap.find (uint64_t(40.0 * pts/kPtsScale));
   return (powerIt == mPowerMap.end()) ? kSilent : powerIt->second;
   }
 //}}}
+//{{{
+void cOmxAudio::getPowerMap (double pts, double secs, map<uint64_t,array<float,6>>& powerMap) {
+// copy of the entries within secs of pts, the map itself is trimmed under the audio thread
+
+  uint64_t first = uint64_t(40.0 * max (0.0, pts/kPtsScale - secs));
+  uint64_t last = uint64_t(40.0 * (pts/kPtsScale + secs));
+
+  powerMap.clear();
+  lock_guard<mutex> lockGuard (mPowerMapMutex);
+  for (auto it = mPowerMap.lower_bound (first); (it != mPowerMap.end()) && (it->first <= last); ++it)
+    powerMap.insert (powerMap.end(), *it);
+  }
+//}}}
+//{{{
+double cOmxAudio::getCpuPerHour() {
+// decode cpu seconds per hour of audio output
+
+  return (mMediaSecs > 0.0) ? mCpuSecs * 3600.0 / mMediaSecs : 0.0;
+  }
+//}}}
+//{{{
+bool cOmxAudio::canPassthrough (const cOmxAudioConfig& config) {
+// passthrough compressed frames if asked for, hdmi only, codec has a core the sink can take
+
+  if (!config.mPassthrough || (config.mDevice != "omx:hdmi"))
+    return false;
+
+  EDID_AudioFormat format;
+  switch (config.mHints.codec) {
+    case AV_CODEC_ID_AC3:  format = EDID_AudioFormat_eAC3; break;
+    case AV_CODEC_ID_EAC3: format = EDID_AudioFormat_eEAC3; break;
+    case AV_CODEC_ID_DTS:
+      // dts express has no core to pass, hd profiles pass their core only
+      if (config.mHints.profile == FF_PROFILE_DTS_EXPRESS)
+        return false;
+      format = EDID_AudioFormat_eDTS;
+      break;
+    default:
+      return false;
+    }
+
+  // ask the hdmi sink edid
+  if (vc_tv_hdmi_audio_supported (format, 2, EDID_AudioSampleRate_e48KHz, EDID_AudioSampleSize_16bit)) {
+    cLog::log (LOGINFO, string(__func__) + " - hdmi sink does not support codec " + dec(config.mHints.codec));
+    return false;
+    }
+
+  return true;
+  }
+//}}}
 
 // sets
 //{{{
@@ -216,6 +355,7 @@ bool cOmxAudio::open (cOmxClock* clock, const cOmxAudioConfig& config) {
 
   mClock = clock;
   mConfig = config;
+  mOpenTime = mClock->getAbsoluteClock();
 
   mAvCodec.avcodec_register_all();
   //{{{  codecContext
@@ -263,13 +403,31 @@ bool cOmxAudio::open (cOmxClock* clock, const cOmxAudioConfig& config) {
 
   mFrame = mAvCodec.av_frame_alloc();
   mSampleFormat = AV_SAMPLE_FMT_NONE;
-  mOutFormat = (mCodecContext->sample_fmt == AV_SAMPLE_FMT_S16) ? AV_SAMPLE_FMT_S16 : AV_SAMPLE_FMT_FLTP;
+  mSampleRate = mConfig.mHints.samplerate;
+
+  mPassthrough = canPassthrough (mConfig) && mSpdifPacker.setCodec (mConfig.mHints.codec);
 
-  uint64_t chanMap = getChanMap();
+  // sinks have no omx mixer, downmix and volume always in software
+  bool sink = cAudioSink::isSink (mConfig.mDevice);
+  mSoftMix = (mConfig.mSoftMix || sink) && !mPassthrough;
+  mSoftMixGain = mMute ? 0.f : mCurVolume;
+  mOutFormat = (!mSoftMix && (mCodecContext->sample_fmt == AV_SAMPLE_FMT_S16)) ?
+                 AV_SAMPLE_FMT_S16 : AV_SAMPLE_FMT_FLTP;
+  uint64_t chanMap = mPassthrough ? (AV_CH_FRONT_LEFT | AV_CH_FRONT_RIGHT) : getChanMap();
   mNumInputChans = getCountBits (chanMap);
   memset (mInputChans, 0, sizeof(mInputChans));
   memset (mOutputChans, 0, sizeof(mOutputChans));
-  if (chanMap) {
+  if (mPassthrough) {
+    //{{{  iec61937 bursts look like 2ch 16bit pcm, eac3 at 4x rate
+    mSampleRate = mSpdifPacker.getOutputRate (mConfig.mHints.samplerate);
+    mNumOutputChans = 2;
+    buildChanMapOMX (mInputChans, chanMap);
+    buildChanMapOMX (mOutputChans, chanMap);
+    cLog::log (LOGINFO, string(__func__) + " - passthrough " + dec(mConfig.mHints.codec) +
+                        " profile:" + dec(mConfig.mHints.profile) + " @" + dec(mSampleRate));
+    }
+    //}}}
+  else if (chanMap) {
     //{{{  set input format, get channelLayout
     enum PCMChannels inLayout[OMX_AUDIO_MAXCHANNELS];
     enum PCMChannels outLayout[OMX_AUDIO_MAXCHANNELS];
@@ -280,22 +438,46 @@ bool cOmxAudio::open (cOmxClock* clock, const cOmxAudioConfig& config) {
     buildChanMap (inLayout, chanMap);
     mNumOutputChans = buildChanMapCEA (outLayout, getChanLayout(mConfig.mLayout));
 
-    cPcmMap pcmMap;
-    pcmMap.reset();
-    pcmMap.setInputFormat (mNumInputChans, inLayout, getBitsPerSample() / 8,
-                           mConfig.mHints.samplerate, mConfig.mLayout, mConfig.mBoostOnDownmix);
-    pcmMap.setOutputFormat (mNumOutputChans, outLayout, false);
-    pcmMap.getDownmixMatrix (mDownmixMatrix);
+    cPcmMap::getCachedDownmixMatrix (mNumInputChans, inLayout, mNumOutputChans, outLayout,
+                                     mConfig.mLayout, mConfig.mBoostOnDownmix, mDownmixMatrix);
 
     buildChanMapOMX (mInputChans, chanMap);
     buildChanMapOMX (mOutputChans, getChanLayout (mConfig.mLayout));
+
+    if (mSoftMix) {
+      //{{{  mix in software, decoder input is already the output layout
+      buildSoftMixMatrix (outLayout);
+      chanMap = getChanLayout (mConfig.mLayout);
+      mNumInputChans = getCountBits (chanMap);
+      buildChanMapOMX (mInputChans, chanMap);
+      cLog::log (LOGINFO, string(__func__) + " - softMix " + dec(mCodecContext->channels) +
+                          " to " + dec(mNumInputChans));
+      }
+      //}}}
     }
     //}}}
+  else
+    mSoftMix = false;
 
-  mBitsPerSample = getBitsPerSample();
-  mBytesPerSec = mConfig.mHints.samplerate * (2 << kRoundedUpChansShift[mNumInputChans]);
+  mBitsPerSample = mPassthrough ? 16 : mSoftMix ? 32 : getBitsPerSample();
+  mBytesPerSec = mSampleRate * (2 << kRoundedUpChansShift[mNumInputChans]);
   mBufferLen = AUDIO_BUFFER_SECONDS * mBytesPerSec;
-  mInputBytesPerSec = mConfig.mHints.samplerate * mBitsPerSample * mNumInputChans >> 3;
+  mInputBytesPerSec = mSampleRate * mBitsPerSample * mNumInputChans >> 3;
+
+  if (sink) {
+    //{{{  pcm to sink, no omx decoder or render
+    mSink = cAudioSink::create (mConfig.mDevice, mConfig.mSinkPeriodFrames, mConfig.mSinkPeriods);
+    if (!mSink || !mSink->open (mSampleRate, mSoftMix ? mNumInputChans : mCodecContext->channels, chanMap)) {
+      // error return
+      cLog::log (LOGERROR, string(__func__) + " sink " + mConfig.mDevice);
+      return false;
+      }
+
+    mLastPts = kNoPts;
+    cLog::log (LOGINFO, string(__func__) + " " + mConfig.mDevice + " took " + getSinceOpen());
+    return true;
+    }
+    //}}}
 
   if (!mDecoder.init ("OMX.broadcom.audio_decode", OMX_IndexParamAudioInit))
     return false;
@@ -377,7 +559,7 @@ bool cOmxAudio::open (cOmxClock* clock, const cOmxAudioConfig& config) {
   waveHeader.Samples.wSamplesPerBlock = 0;
   waveHeader.Format.nChannels = mNumInputChans;
   waveHeader.Format.nBlockAlign = mNumInputChans * (mBitsPerSample >> 3);
-  waveHeader.Format.nSamplesPerSec = mConfig.mHints.samplerate;
+  waveHeader.Format.nSamplesPerSec = mSampleRate;
   waveHeader.Format.nAvgBytesPerSec = mBytesPerSec;
   waveHeader.Format.wBitsPerSample = mBitsPerSample;
   waveHeader.Samples.wValidBitsPerSample = mBitsPerSample;
@@ -412,6 +594,7 @@ bool cOmxAudio::open (cOmxClock* clock, const cOmxAudioConfig& config) {
   mSetStartTime  = true;
   mLastPts = kNoPts;
 
+  cLog::log (LOGINFO, string(__func__) + " took " + getSinceOpen());
   return true;
   }
 //}}}
@@ -420,113 +603,15 @@ bool cOmxAudio::decode (uint8_t* data, int size, double dts, double pts, atomic<
 
   cLog::log (LOGINFO1, "decode " + frac(pts/1000000.0,6,2,' ') + " " + dec(size));
 
-  while (size > 0) {
-    if (!mOutputSize)
-      mPts = pts;
-
-    if (!mGotFrame) {
-      //{{{  decode frame from packet
-      AVPacket avPacket;
-      mAvCodec.av_init_packet (&avPacket);
-      avPacket.data = data;
-      avPacket.size = size;
-
-      int gotFrame;
-      int bytesUsed = mAvCodec.avcodec_decode_audio4 (mCodecContext, mFrame, &gotFrame, &avPacket);
-      if ((bytesUsed < 0) || (bytesUsed > size)) {
-        reset();
-        break;
-        }
-
-      else if (gotFrame) {
-        mGotFrame = true;
-        data += bytesUsed;
-        size -= bytesUsed;
-        }
-      }
-      //}}}
-    if (mGotFrame) {
-      //{{{  convert frame, addBuffer
-      if (!mGotFirstFrame) {
-        cLog::log (LOGINFO, "cOmxAudio::decode - chan:%d format:%d:%d pktSize:%d samples:%d lineSize:%d",
-                            mCodecContext->channels, mCodecContext->sample_fmt, mOutFormat,
-                            size, mFrame->nb_samples, mFrame->linesize[0]);
-        mGotFirstFrame = true;
-        }
-
-      int outLineSize;
-      mOutputSize = mAvUtil.av_samples_get_buffer_size (
-        &outLineSize, mCodecContext->channels, mFrame->nb_samples, mOutFormat, 1);
-      // allocate enough outputBuffer
-      if (mOutputAllocated < mOutputSize) {
-        mOutput = (uint8_t*)mAvUtil.av_realloc (mOutput, mOutputSize + FF_INPUT_BUFFER_PADDING_SIZE);
-        mOutputAllocated = mOutputSize;
-        }
-
-      // mFrame samples to outputBuffer
-      if (mCodecContext->sample_fmt == mOutFormat) {
-        //{{{  simple copy to mOutput
-        uint8_t* out_planes[mCodecContext->channels];
-        if ((mAvUtil.av_samples_fill_arrays (out_planes, NULL, mOutput,
-                                             mCodecContext->channels, mFrame->nb_samples, mOutFormat,1) < 0) ||
-             mAvUtil.av_samples_copy (out_planes, mFrame->data, 0, 0,
-                                      mFrame->nb_samples, mCodecContext->channels, mOutFormat) < 0)
-          mOutputSize = 0;
-        }
-        //}}}
-      else {
-        //{{{  convert format to mOutput
-        if (mConvert &&
-            ((mChans != mCodecContext->channels) ||
-             (mCodecContext->sample_fmt != mSampleFormat))) {
-          mSwResample.swr_free (&mConvert);
-          mChans = mCodecContext->channels;
-          }
-
-        if (!mConvert) {
-          mSampleFormat = mCodecContext->sample_fmt;
-          mConvert = mSwResample.swr_alloc_set_opts (NULL,
-                       mAvUtil.av_get_default_channel_layout(mCodecContext->channels),
-                       mOutFormat, mCodecContext->sample_rate,
-                       mAvUtil.av_get_default_channel_layout(mCodecContext->channels),
-                       mCodecContext->sample_fmt, mCodecContext->sample_rate, 0, NULL);
-          if (!mConvert || mSwResample.swr_init (mConvert) < 0)
-            cLog::log (LOGERROR, "cOmxAudio::getData unable to initialise convert format:%d to %d",
-                                 mCodecContext->sample_fmt, mOutFormat);
-          }
+  double cpuSecs = getThreadCpuSecs();
+  bool ok = mPassthrough ? decodePassthrough (data, size, pts, flushRequested) :
+                           decodePcm (data, size, pts, flushRequested);
+  mCpuSecs += getThreadCpuSecs() - cpuSecs;
 
-        // use unaligned flag to keep output packed
-        uint8_t* out_planes[mCodecContext->channels];
-        if ((mAvUtil.av_samples_fill_arrays (out_planes, NULL, mOutput,
-                                             mCodecContext->channels, mFrame->nb_samples, mOutFormat, 1) < 0) ||
-             mSwResample.swr_convert (mConvert, out_planes, mFrame->nb_samples,
-                                      (const uint8_t**)mFrame->data, mFrame->nb_samples) < 0) {
-          cLog::log (LOGERROR, "cOmxAudio::getData decode unable to convert format %d to %d",
-                               (int)mCodecContext->sample_fmt, mOutFormat);
-          mOutputSize = 0;
-          }
-        }
-        //}}}
+  // stats publisher reads this rather than wait on mMutex
+  mLastInputBufferSpace = mSink ? 0 : mDecoder.getInputBufferSpace();
 
-      // done, wait for buffer and add to output
-      if (mOutputSize > 0) {
-        while (mOutputSize > (int)mDecoder.getInputBufferSpace()) {
-          mClock->msSleep (10);
-          if (flushRequested)
-            return true;
-           }
-        addBuffer (mOutput, mOutputSize, mOutFormat == AV_SAMPLE_FMT_FLTP,
-                   mCodecContext->channels, mFrame->nb_samples, mPts);
-        mOutputSize = 0;
-        }
-
-      mGotFrame = false;
-      }
-      //}}}
-    }
-
-  applyVolume();
-  return true;
+  return ok;
   }
 //}}}
 //{{{
@@ -539,6 +624,11 @@ void cOmxAudio::submitEOS() {
   mSubmittedEos = true;
   mFailedEos = false;
 
+  if (mSink) {
+    mSink->drain();
+    return;
+    }
+
   auto* buffer = mDecoder.getInputBuffer(1000);
   if (!buffer) {
     // error return
@@ -565,6 +655,7 @@ void cOmxAudio::reset() {
   cLog::log (LOGINFO1, __func__);
 
   mAvCodec.avcodec_flush_buffers (mCodecContext);
+  mSpdifPacker.reset();
 
   mGotFrame = false;
   mOutputSize = 0;
@@ -577,6 +668,9 @@ void cOmxAudio::flush() {
 
   lock_guard<recursive_mutex> lockGuard (mMutex);
 
+  if (mSink)
+    mSink->flush();
+
   mDecoder.flushAll();
   if (mMixer.isInit() )
     mMixer.flushAll();
@@ -595,6 +689,7 @@ void cOmxAudio::flush() {
 
   mSetStartTime  = true;
   mLastPts = kNoPts;
+  mDriftDelay = 0.0;
   }
 //}}}
 
@@ -703,12 +798,258 @@ void cOmxAudio::buildChanMapOMX (enum OMX_AUDIO_CHANNELTYPE* chanMap, uint64_t l
   }
 //}}}
 
+//{{{
+bool cOmxAudio::decodePcm (uint8_t* data, int size, double pts, atomic<bool>& flushRequested) {
+
+  while (size > 0) {
+    if (!mOutputSize)
+      mPts = pts;
+
+    if (!mGotFrame) {
+      //{{{  decode frame from packet
+      AVPacket avPacket;
+      mAvCodec.av_init_packet (&avPacket);
+      avPacket.data = data;
+      avPacket.size = size;
+
+      int gotFrame;
+      int bytesUsed = mAvCodec.avcodec_decode_audio4 (mCodecContext, mFrame, &gotFrame, &avPacket);
+      if ((bytesUsed < 0) || (bytesUsed > size)) {
+        reset();
+        break;
+        }
+
+      else if (gotFrame) {
+        mGotFrame = true;
+        data += bytesUsed;
+        size -= bytesUsed;
+        }
+      }
+      //}}}
+    if (mGotFrame) {
+      //{{{  convert frame, addBuffer
+      if (!mGotFirstFrame) {
+        cLog::log (LOGINFO, "cOmxAudio::decode - chan:%d format:%d:%d pktSize:%d samples:%d lineSize:%d",
+                            mCodecContext->channels, mCodecContext->sample_fmt, mOutFormat,
+                            size, mFrame->nb_samples, mFrame->linesize[0]);
+        mGotFirstFrame = true;
+        }
+
+      // drift compensation resamples, leave room for a few extra samples
+      int samples = mFrame->nb_samples;
+      int outCount = mConfig.mDriftTarget ? samples + 32 : samples;
+
+      int outLineSize;
+      mOutputSize = mAvUtil.av_samples_get_buffer_size (
+        &outLineSize, mCodecContext->channels, outCount, mOutFormat, 1);
+      // allocate enough outputBuffer
+      if (mOutputAllocated < mOutputSize) {
+        mOutput = (uint8_t*)mAvUtil.av_realloc (mOutput, mOutputSize + FF_INPUT_BUFFER_PADDING_SIZE);
+        cMemoryBudget::get().alloc (cMemoryBudget::eAudioOutput, mOutputSize - mOutputAllocated);
+        mOutputAllocated = mOutputSize;
+        }
+
+      // mFrame samples to outputBuffer
+      if ((mCodecContext->sample_fmt == mOutFormat) && !mConfig.mDriftTarget) {
+        //{{{  simple copy to mOutput
+        uint8_t* out_planes[mCodecContext->channels];
+        if ((mAvUtil.av_samples_fill_arrays (out_planes, NULL, mOutput,
+                                             mCodecContext->channels, mFrame->nb_samples, mOutFormat,1) < 0) ||
+             mAvUtil.av_samples_copy (out_planes, mFrame->data, 0, 0,
+                                      mFrame->nb_samples, mCodecContext->channels, mOutFormat) < 0)
+          mOutputSize = 0;
+        }
+        //}}}
+      else {
+        //{{{  convert format to mOutput
+        if (mConvert &&
+            ((mChans != mCodecContext->channels) ||
+             (mCodecContext->sample_fmt != mSampleFormat))) {
+          mSwResample.swr_free (&mConvert);
+          mChans = mCodecContext->channels;
+          }
+
+        if (!mConvert) {
+          mSampleFormat = mCodecContext->sample_fmt;
+          mConvert = mSwResample.swr_alloc_set_opts (NULL,
+                       mAvUtil.av_get_default_channel_layout(mCodecContext->channels),
+                       mOutFormat, mCodecContext->sample_rate,
+                       mAvUtil.av_get_default_channel_layout(mCodecContext->channels),
+                       mCodecContext->sample_fmt, mCodecContext->sample_rate, 0, NULL);
+          if (!mConvert || mSwResample.swr_init (mConvert) < 0)
+            cLog::log (LOGERROR, "cOmxAudio::getData unable to initialise convert format:%d to %d",
+                                 mCodecContext->sample_fmt, mOutFormat);
+          }
+
+        // use unaligned flag to keep output packed
+        uint8_t* out_planes[mCodecContext->channels];
+        if ((mAvUtil.av_samples_fill_arrays (out_planes, NULL, mOutput,
+                                             mCodecContext->channels, outCount, mOutFormat, 1) < 0) ||
+            ((samples = mSwResample.swr_convert (mConvert, out_planes, outCount,
+                                                 (const uint8_t**)mFrame->data, mFrame->nb_samples)) < 0)) {
+          cLog::log (LOGERROR, "cOmxAudio::getData decode unable to convert format %d to %d",
+                               (int)mCodecContext->sample_fmt, mOutFormat);
+          mOutputSize = 0;
+          }
+
+        else if (samples != outCount) {
+          // compensated sample count, close up the planes
+          int planeSize = samples * mAvUtil.av_get_bytes_per_sample (mOutFormat);
+          if (mAvUtil.av_sample_fmt_is_planar (mOutFormat))
+            for (int chan = 1; chan < mCodecContext->channels; chan++)
+              memmove (mOutput + chan * planeSize, out_planes[chan], planeSize);
+          mOutputSize = mAvUtil.av_samples_get_buffer_size (
+            &outLineSize, mCodecContext->channels, samples, mOutFormat, 1);
+          }
+        }
+        //}}}
+
+      // done, wait for buffer and add to output
+      if (mOutputSize > 0) {
+        uint8_t* output = mOutput;
+        int chans = mCodecContext->channels;
+        if (mSoftMix) {
+          //{{{  downmix and volume to output layout
+          output = softMix (samples);
+          chans = mNumInputChans;
+          mOutputSize = chans * samples * sizeof(float);
+          }
+          //}}}
+
+        if (mSink)
+          writeSink (output, mOutFormat == AV_SAMPLE_FMT_FLTP, chans, samples, mPts, flushRequested);
+        else {
+          while (mOutputSize > (int)mDecoder.getInputBufferSpace()) {
+            cTraceSpan span ("inputFull");
+            mClock->msSleep (10);
+            if (flushRequested)
+              return true;
+            }
+          addBuffer (output, mOutputSize, mOutFormat == AV_SAMPLE_FMT_FLTP,
+                     chans, samples, mPts);
+          }
+        mOutputSize = 0;
+
+        if (mConfig.mDriftTarget)
+          updateDrift();
+        }
+
+      mGotFrame = false;
+      }
+      //}}}
+    }
+
+  applyVolume();
+  return true;
+  }
+//}}}
+//{{{
+bool cOmxAudio::decodePassthrough (uint8_t* data, int size, double pts, atomic<bool>& flushRequested) {
+// pack compressed frames into iec61937 bursts, no decode, no volume
+
+  mSpdifPacker.addData (data, size);
+
+  int burstSize;
+  uint8_t* burst;
+  while ((burst = mSpdifPacker.getBurst (burstSize))) {
+    while (burstSize > (int)mDecoder.getInputBufferSpace()) {
+      cTraceSpan span ("inputFull");
+      mClock->msSleep (10);
+      if (flushRequested)
+        return true;
+      }
+
+    // only first burst of packet has the packet pts
+    addBuffer (burst, burstSize, false, 2, burstSize / 4, pts);
+    pts = kNoPts;
+    }
+
+  return true;
+  }
+//}}}
+
+//{{{
+void cOmxAudio::buildSoftMixMatrix (enum PCMChannels* outLayout) {
+// downmix matrix rows are in CEA order, decoder input planes are in wave channel mask order
+
+  memset (mSoftMixMatrix, 0, sizeof(mSoftMixMatrix));
+
+  for (int row = 0; (row < 8) && (outLayout[row] != PCM_INVALID); row++) {
+    int plane = 0;
+    for (int i = 0; (i < 8) && (outLayout[i] != PCM_INVALID); i++)
+      if (outLayout[i] < outLayout[row])
+        plane++;
+    memcpy (mSoftMixMatrix + 8*plane, mDownmixMatrix + 8*row, 8 * sizeof(float));
+    }
+  }
+//}}}
+//{{{
+uint8_t* cOmxAudio::softMix (int samples) {
+// mix planar float mOutput into mMixOutput, ramp volume across the frame
+
+  int size = mNumInputChans * samples * sizeof(float);
+  if (mMixOutputAllocated < size) {
+    mMixOutput = (uint8_t*)mAvUtil.av_realloc (mMixOutput, size + FF_INPUT_BUFFER_PADDING_SIZE);
+    cMemoryBudget::get().alloc (cMemoryBudget::eAudioOutput, size - mMixOutputAllocated);
+    mMixOutputAllocated = size;
+    }
+
+  const float* in[8];
+  int inChans = min (mCodecContext->channels, 8);
+  for (int i = 0; i < inChans; i++)
+    in[i] = (float*)mOutput + (i * samples);
+
+  float* out[8];
+  for (unsigned int i = 0; i < mNumInputChans; i++)
+    out[i] = (float*)mMixOutput + (i * samples);
+
+  float gain = mMute ? 0.f : mCurVolume;
+  mixPlanar (in, inChans, out, mNumInputChans, mSoftMixMatrix, samples,
+             mSoftMixGain, (gain - mSoftMixGain) / samples);
+  mSoftMixGain = gain;
+
+  return mMixOutput;
+  }
+//}}}
+//{{{
+void cOmxAudio::updateDrift() {
+// once a second of output, steer filtered delay towards target with a tiny resample rate correction
+
+  if (!mConvert || (mMediaSecs < mDriftNextSecs))
+    return;
+  mDriftNextSecs = mMediaSecs + 1.0;
+
+  // ~10s time constant, long term fill level not packet jitter
+  double delay = getDelay();
+  mDriftDelay = (mDriftDelay == 0.0) ? delay : mDriftDelay + (delay - mDriftDelay) * 0.1;
+
+  // pi, 100ms error -> 100ppm, integral holds the clock offset once error is gone
+  // - clamped well below audible pitch change, no integral windup while clamped
+  const double kMaxPpm = 500.0;
+  double error = mDriftDelay - mConfig.mDriftTarget;
+  double ppm = -(1000.0 * error + 20.0 * (mDriftIntegral + error));
+  if (fabs (ppm) < kMaxPpm)
+    mDriftIntegral += error;
+  mDriftPpm = max (-kMaxPpm, min (kMaxPpm, ppm));
+
+  // spread over 10s of samples for ~2ppm resolution, replaced by next update in 1s
+  int distance = 10 * mCodecContext->sample_rate;
+  int sampleDelta = (int)lround (mDriftPpm * distance / 1e6);
+  if (mSwResample.swr_set_compensation (mConvert, sampleDelta, distance) < 0)
+    cLog::log (LOGERROR, string(__func__) + " swr_set_compensation failed");
+
+  cLog::log (LOGINFO1, string(__func__) + " delay:" + frac(delay, 6,3,' ') +
+                       " filtered:" + frac(mDriftDelay, 6,3,' ') +
+                       " ppm:" + frac(mDriftPpm, 5,0,' '));
+  }
+//}}}
+
 //{{{
 bool cOmxAudio::srcChanged() {
 
   lock_guard<recursive_mutex> lockGuard (mMutex);
 
-  if (mMixer.isInit()) {
+  if (mSrcChanged) {
     //{{{  disable, enable, no change, return
     cLog::log (LOGINFO, string(__func__) + " - disable, enable");
     mDecoder.disablePort (mDecoder.getOutputPort(), true);
@@ -716,8 +1057,21 @@ bool cOmxAudio::srcChanged() {
     return true;
     }
     //}}}
-  if (!mMixer.init ("OMX.broadcom.audio_mixer", OMX_IndexParamAudioInit))
-    return false;
+
+  double phaseTime = mClock->getAbsoluteClock();
+  string phases;
+  //{{{
+  auto phase = [&](const char* name) {
+    double now = mClock->getAbsoluteClock();
+    phases += string(" ") + name + ":" + dec(int((now - phaseTime) / 1000.0)) + "ms";
+    phaseTime = now;
+    };
+  //}}}
+
+  // passthrough bypasses the mixer, it would scale the bursts, softMix has already mixed
+  if (!mPassthrough && !mSoftMix)
+    if (!mMixer.init ("OMX.broadcom.audio_mixer", OMX_IndexParamAudioInit))
+      return false;
   if (mConfig.mDevice == "omx:both")
     if (!mSplitter.init ("OMX.broadcom.audio_splitter", OMX_IndexParamAudioInit))
       return false;
@@ -741,11 +1095,13 @@ bool cOmxAudio::srcChanged() {
   memcpy (pcmMode.eChannelMapping, mOutputChans, sizeof(mOutputChans));
   pcmMode.nChannels = mNumOutputChans > 4 ? 8 : mNumOutputChans > 2 ? 4 : mNumOutputChans;
   pcmMode.nSamplingRate = min (max ((int)pcmMode.nSamplingRate, 8000), 192000);
-  pcmMode.nPortIndex = mMixer.getOutputPort();
-  if (mMixer.setParam (OMX_IndexParamAudioPcm, &pcmMode)) {
-    // error return
-    cLog::log (LOGERROR,  string(__func__) + " setParam pcmMode");
-    return false;
+  if (mMixer.isInit()) {
+    pcmMode.nPortIndex = mMixer.getOutputPort();
+    if (mMixer.setParam (OMX_IndexParamAudioPcm, &pcmMode)) {
+      // error return
+      cLog::log (LOGERROR,  string(__func__) + " setParam pcmMode");
+      return false;
+      }
     }
   //}}}
   cLog::log (LOGINFO, string(__func__) +
@@ -802,12 +1158,6 @@ bool cOmxAudio::srcChanged() {
     //{{{  setup analRender
     mTunnelClockAnalog.init (mClock->getOmxCore(), mClock->getOmxCore()->getInputPort(),
                              &mRenderAnal, mRenderAnal.getInputPort() + 1);
-
-    if (mTunnelClockAnalog.establish()) {
-      // error return
-      cLog::log (LOGERROR, string(__func__) + " mTunnel_clock_Analog.Establish");
-      return false;
-      }
     mRenderAnal.resetEos();
     }
     //}}}
@@ -816,12 +1166,6 @@ bool cOmxAudio::srcChanged() {
     mTunnelClockHdmi.init (
       mClock->getOmxCore(), mClock->getOmxCore()->getInputPort() + (mRenderAnal.isInit() ? 2 : 0),
       &mRenderHdmi, mRenderHdmi.getInputPort() + 1);
-
-    if (mTunnelClockHdmi.establish()) {
-      // error return
-      cLog::log(LOGERROR, string(__func__) + " mTunnel_clock_hdmi.establish");
-      return false;
-      }
     mRenderHdmi.resetEos();
     }
     //}}}
@@ -876,75 +1220,72 @@ bool cOmxAudio::srcChanged() {
     //{{{  wire up splitter
     mTunnelSplitterAnalog.init (&mSplitter, mSplitter.getOutputPort(), &mRenderAnal,
                                 mRenderAnal.getInputPort());
-    if (mTunnelSplitterAnalog.establish()) {
-      // error return
-      cLog::log (LOGERROR, string(__func__) + " mTunnelSplitterAnalog.establish");
-      return false;
-      }
-
     mTunnelSplitterHdmi.init (&mSplitter, mSplitter.getOutputPort() + 1, &mRenderHdmi,
                               mRenderHdmi.getInputPort());
-    if (mTunnelSplitterHdmi.establish()) {
-      // error return
-      cLog::log (LOGERROR, string(__func__) + " mTunnelSplitterhdmi.establish");
-      return false;
+    }
+    //}}}
+  if (mMixer.isInit()) {
+    //{{{  wire up mixer
+    mTunnelDecoder.init (&mDecoder, mDecoder.getOutputPort(), &mMixer, mMixer.getInputPort());
+
+    if (mSplitter.isInit())
+      mTunnelMixer.init (&mMixer, mMixer.getOutputPort(), &mSplitter, mSplitter.getInputPort());
+    else {
+      if (mRenderAnal.isInit())
+        mTunnelMixer.init (&mMixer, mMixer.getOutputPort(), &mRenderAnal, mRenderAnal.getInputPort());
+      if (mRenderHdmi.isInit())
+        mTunnelMixer.init (&mMixer, mMixer.getOutputPort(), &mRenderHdmi, mRenderHdmi.getInputPort());
       }
     }
     //}}}
-  //{{{  wire up mixer
-  mTunnelDecoder.init (&mDecoder, mDecoder.getOutputPort(), &mMixer, mMixer.getInputPort());
+  else if (mSplitter.isInit())
+    mTunnelDecoder.init (&mDecoder, mDecoder.getOutputPort(), &mSplitter, mSplitter.getInputPort());
+  else if (mRenderAnal.isInit())
+    mTunnelDecoder.init (&mDecoder, mDecoder.getOutputPort(), &mRenderAnal, mRenderAnal.getInputPort());
+  else
+    mTunnelDecoder.init (&mDecoder, mDecoder.getOutputPort(), &mRenderHdmi, mRenderHdmi.getInputPort());
 
-  if (mSplitter.isInit())
-    mTunnelMixer.init (&mMixer, mMixer.getOutputPort(), &mSplitter, mSplitter.getInputPort());
-  else {
-    if (mRenderAnal.isInit())
-      mTunnelMixer.init (&mMixer, mMixer.getOutputPort(), &mRenderAnal, mRenderAnal.getInputPort());
-    if (mRenderHdmi.isInit())
-      mTunnelMixer.init (&mMixer, mMixer.getOutputPort(), &mRenderHdmi, mRenderHdmi.getInputPort());
-    }
-  //}}}
+  phase ("init");
 
-  if (mTunnelDecoder.establish()) {
+  // independent components change state together, all tunnel ports enabled before waiting
+  if (cOmxCore::setStates ({ &mMixer, &mSplitter, &mRenderAnal, &mRenderHdmi }, OMX_StateIdle)) {
     //{{{  error return
-    cLog::log (LOGERROR, string(__func__) + " mTunnel_decoder.establish");
+    cLog::log (LOGERROR, string(__func__) + " setStates idle");
     return false;
     }
     //}}}
-  if (mMixer.setState (OMX_StateExecuting)) {
+  phase ("idle");
+
+  vector<cOmxTunnel*> tunnels = { &mTunnelDecoder };
+  if (mMixer.isInit())
+    tunnels.push_back (&mTunnelMixer);
+  if (mSplitter.isInit()) {
+    tunnels.push_back (&mTunnelSplitterAnalog);
+    tunnels.push_back (&mTunnelSplitterHdmi);
+    }
+  if (mRenderAnal.isInit())
+    tunnels.push_back (&mTunnelClockAnalog);
+  if (mRenderHdmi.isInit())
+    tunnels.push_back (&mTunnelClockHdmi);
+  if (cOmxTunnel::establishAll (tunnels)) {
     //{{{  error return
-    cLog::log (LOGERROR, string(__func__) + " mMixer setState");
+    cLog::log (LOGERROR, string(__func__) + " establishAll");
     return false;
     }
     //}}}
-  if (mTunnelMixer.establish()) {
+  phase ("tunnel");
+
+  if (cOmxCore::setStates ({ &mMixer, &mSplitter, &mRenderAnal, &mRenderHdmi }, OMX_StateExecuting)) {
     //{{{  error return
-    cLog::log (LOGERROR, string(__func__) + " mTunnel_decoder.establish");
+    cLog::log (LOGERROR, string(__func__) + " setStates executing");
     return false;
     }
     //}}}
+  phase ("execute");
 
-  if (mSplitter.isInit())
-    if (mSplitter.setState (OMX_StateExecuting)) {
-      //{{{  error return
-      cLog::log (LOGERROR, string(__func__) + " mSplitter setState");
-      return false;
-      }
-      //}}}
-  if (mRenderAnal.isInit())
-    if (mRenderAnal.setState (OMX_StateExecuting)) {
-      //{{{  error return
-      cLog::log (LOGERROR, string(__func__) + " mRenderAnal setState");
-      return false;
-      }
-      //}}}
-  if (mRenderHdmi.isInit())
-    if (mRenderHdmi.setState (OMX_StateExecuting)) {
-      //{{{  error return
-      cLog::log (LOGERROR, string(__func__) + " mRenderhdmi setState");
-      return false;
-      }
-      //}}}
+  cLog::log (LOGINFO, string(__func__) + phases + " at " + getSinceOpen());
 
+  mSrcChanged = true;
   return true;
   }
 //}}}
@@ -976,20 +1317,49 @@ void cOmxAudio::applyVolume() {
   }
 //}}}
 //{{{
-void cOmxAudio::addBuffer (uint8_t* data, int size, bool format32, int chans, int samples, double pts) {
-
-  //  calc power from max, should abs and rms
-  auto ptr = (float*)data;
-  for (auto chan = 0; chan < chans; chan++) {
-    mPower[chan] = 0.f;
-    for (auto sample = 0; sample < samples; sample++) {
-      if (*ptr > mPower[chan])
-        mPower[chan] = *ptr;
-      ptr++;
+void cOmxAudio::meter (uint8_t* data, int chans, int samples, double pts) {
+
+  if (!mPassthrough) {
+    //  calc power from max, should abs and rms
+    auto ptr = (float*)data;
+    for (auto chan = 0; chan < chans; chan++) {
+      mPower[chan] = 0.f;
+      for (auto sample = 0; sample < samples; sample++) {
+        if (*ptr > mPower[chan])
+          mPower[chan] = *ptr;
+        ptr++;
+        }
       }
+    uint64_t uint64Pts = uint64_t(40.0 * pts / kPtsScale);
+    lock_guard<mutex> lockGuard (mPowerMapMutex);
+    if (mPowerMap.insert (std::map<uint64_t,std::array<float,6>>::value_type (uint64Pts, mPower)).second)
+      trimPowerMap (uint64Pts);
     }
-  uint64_t uint64Pts = uint64_t(40.0 * pts / kPtsScale);
-  mPowerMap.insert (std::map<uint64_t,std::array<float,6>>::value_type (uint64Pts, mPower));
+  if (mSampleRate)
+    mMediaSecs += (double)samples / mSampleRate;
+  }
+//}}}
+//{{{
+void cOmxAudio::trimPowerMap (uint64_t pts) {
+// account new entry, over the power history limit drop whichever end is furthest from pts, mPowerMapMutex held
+
+  auto& memoryBudget = cMemoryBudget::get();
+  memoryBudget.alloc (cMemoryBudget::ePowerHistory, kPowerEntryBytes);
+
+  int64_t limit = memoryBudget.getLimit (cMemoryBudget::ePowerHistory);
+  while ((mPowerMap.size() > 1) && ((int64_t)(mPowerMap.size() * kPowerEntryBytes) > limit)) {
+    if ((pts - mPowerMap.begin()->first) > (mPowerMap.rbegin()->first - pts))
+      mPowerMap.erase (mPowerMap.begin());
+    else
+      mPowerMap.erase (std::prev (mPowerMap.end()));
+    memoryBudget.free (cMemoryBudget::ePowerHistory, kPowerEntryBytes);
+    }
+  }
+//}}}
+//{{{
+void cOmxAudio::addBuffer (uint8_t* data, int size, bool format32, int chans, int samples, double pts) {
+
+  meter (data, chans, samples, pts);
 
   //cLog::log (LOGINFO, "addBuffer " + frac(pts/1000000.0,6,2,' ') +
   //                    " " + dec(size) +
@@ -1046,3 +1416,46 @@ void cOmxAudio::addBuffer (uint8_t* data, int size, bool format32, int chans, in
       cLog::log (LOGERROR, string(__func__) + "  srcChanged");
   }
 //}}}
+//{{{
+void cOmxAudio::writeSink (uint8_t* data, bool format32, int chans, int samples, double pts,
+                           atomic<bool>& flushRequested) {
+// hold while clock paused, once clock runs wait while early, drop while late, else free run on sink
+// - offline sinks take everything as soon as it is decoded
+
+  meter (data, chans, samples, pts);
+
+  while (mSink->isRealtime() && mClock->isPaused()) {
+    cTraceSpan span ("sinkPaused");
+    mClock->msSleep (10);
+    if (flushRequested)
+      return;
+    }
+
+  if (mSink->isRealtime() && (pts != kNoPts) && mClock->isRunning()) {
+    while (true) {
+      // secs until this chunk is due less secs until sink would play it
+      double lead = ((pts - mClock->getMediaTime()) / kPtsScale) - mSink->getDelay();
+      if (lead < -kSinkSyncSecs) {
+        mSinkDropped++;
+        return;
+        }
+      if ((lead < kSinkSyncSecs) || flushRequested)
+        break;
+
+      cTraceSpan span ("sinkEarly");
+      mClock->msSleep (min (10, int(1000.0 * (lead - kSinkSyncSecs)) + 1));
+      }
+    }
+
+  if (flushRequested)
+    return;
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+
+  if (pts != kNoPts)
+    mLastPts = pts;
+
+  if (!mSink->write (mSink->interleave (data, format32, chans, samples), samples))
+    cLog::log (LOGERROR, string(__func__) + " write");
+  }
+//}}}
@@ -4,6 +4,7 @@
 
 #include <sys/types.h>
 #include <atomic>
+#include <algorithm>
 #include <mutex>
 #include <string>
 #include <deque>
@@ -22,6 +23,12 @@
 #include "cOmxReader.h"
 #include "cOmxStreamInfo.h"
 #include "cPcmMap.h"
+#include "cSpdifPacker.h"
+#include "cAudioSink.h"
+#include "cMemoryBudget.h"
+#include "cH264Parser.h"
+#include "cStartCode.h"
+#include "cTracer.h"
 
 //{{{  WAVE_FORMAT defines
 #define WAVE_FORMAT_UNKNOWN           0x0000
@@ -282,7 +289,8 @@ public:
   //}}}
 
   cOmxStreamInfo mHints;
-  int mPacketMaxCacheSize = 2 * 1024 * 1024; // 2m
+  int mPacketMaxCacheSize = 2 * 1024 * 1024; // 2m, until bitrate known or secs 0
+  float mPacketMaxCacheSecs = 3.f;
   int mFifoSize = 2 * 1024 * 1024; // 2m
 
   cRect mDstRect = {0, 0, 0, 0};
@@ -294,38 +302,88 @@ public:
   bool mHdmiClockSync = false;
 
   eDeInterlaceMode mDeInterlaceMode = eDeInterlaceAuto;
+
+  // h264 through our parser, annexb reassembled to whole access units, sync frames flagged
+  bool mH264Parse = true;
+
+  // behind the clock, drop non reference frames past mDropLateSecs, skip to the next keyframe past mSkipGopSecs
+  bool mDropLate = true;
+  float mDropLateSecs = 0.1f;
+  float mSkipGopSecs = 0.5f;
   };
 //}}}
 //{{{
 class cOmxAudioConfig {
 public:
   cOmxStreamInfo mHints;
-  int mPacketMaxCacheSize = 512 * 1024; // 0.5m
+  int mPacketMaxCacheSize = 512 * 1024; // 0.5m, until bitrate known or secs 0
+  float mPacketMaxCacheSecs = 3.f;
 
   std::string mDevice = "omx:local";
   enum PCMLayout mLayout = PCM_LAYOUT_2_0;
   bool mBoostOnDownmix = true;
+  bool mPassthrough = false; // ac3,eac3,dts iec61937 bursts to hdmi if sink supports them
+  bool mSoftMix = false;     // downmix and volume on arm, no omx mixer
+  float mDriftTarget = 0.f;  // live drift compensation buffer depth in secs, 0 off
+
+  int mSinkPeriodFrames = 1024; // alsa: sink period, buffer is mSinkPeriods of them
+  int mSinkPeriods = 4;
   };
 //}}}
 
 //{{{
-class cOmxVideo {
+class cVideoDecoder {
+// omx hw decoder or libavcodec sw decoder, both present through a video_render
 public:
-  ~cOmxVideo();
+  virtual ~cVideoDecoder() {}
 
-  std::string getDecoderName() { return mVideoCodecName; };
+  virtual std::string getDecoderName() = 0;
+  virtual std::string getDebugString() { return ""; }
+  virtual bool isSoftware() { return false; }
 
-  bool isEOS();
-  int getInputBufferSize();
-  unsigned int getInputBufferSpace();
+  virtual bool isEOS() = 0;
+  virtual unsigned int getInputBufferSpace() = 0;
+  virtual int getRenderedFrames() = 0;
 
   void setAlpha (int alpha);
   void setVideoRect();
   void setVideoRect (int aspectMode);
   void setVideoRect (const cRect& srcRect, const cRect& dstRect);
 
+  virtual bool open (cOmxClock* clock, const cOmxVideoConfig& config) = 0;
+  virtual bool decode (uint8_t* data, int size, double dts, double pts, bool decodeOnly,
+                       std::atomic<bool>& flushRequested) = 0;
+  virtual void submitEOS() = 0;
+  virtual void reset() = 0;
+  virtual void close() = 0;
+
+protected:
+  std::recursive_mutex mMutex;
+
+  cOmxVideoConfig mConfig;
+  cOmxClock* mClock = nullptr;
+  cOmxCore mRender;
+
+  float mPixelAspect = 1.f;
+  };
+//}}}
+//{{{
+class cOmxVideo : public cVideoDecoder {
+public:
+  virtual ~cOmxVideo();
+
+  static bool isMpeg2Licensed();
+
+  std::string getDecoderName() { return mVideoCodecName; };
+  std::string getDebugString() { return mH264Parser ? mH264Parser->getDebugString() : ""; }
+
+  bool isEOS();
+  int getInputBufferSize();
+  unsigned int getInputBufferSpace();
+  int getRenderedFrames();
+
   bool open (cOmxClock* clock, const cOmxVideoConfig& config);
-  bool decode (uint8_t* data, int size, double dts, double pts, std::atomic<bool>& flushRequested);
+  bool decode (uint8_t* data, int size, double dts, double pts, bool decodeOnly, std::atomic<bool>& flushRequested);
   void submitEOS();
   void reset();
   void close();
@@ -336,21 +394,20 @@ private:
 
   bool setNaluFormat (enum AVCodecID codec, uint8_t* in_extradata, int in_extrasize);
   bool sendDecoderExtraConfig();
+  bool submit (const uint8_t* data, int size, double dts, double pts, bool decodeOnly, bool syncFrame,
+               std::atomic<bool>& flushRequested);
 
   bool srcChanged();
   void logSrcChanged (OMX_PARAM_PORTDEFINITIONTYPE port, enum OMX_INTERLACETYPE interlaceMode);
+  void checkFirstFrame();
+  std::string getSinceOpen() { return dec(int((mClock->getAbsoluteClock() - mOpenTime) / 1000.0)) + "ms"; }
 
   //{{{  vars
-  std::recursive_mutex mMutex;
-
-  cOmxVideoConfig mConfig;
   OMX_VIDEO_CODINGTYPE mCodingType;
 
-  cOmxClock* mClock = nullptr;
   cOmxCore mDecoder;
   cOmxCore mScheduler;
   cOmxCore mImageFx;
-  cOmxCore mRender;
 
   cOmxTunnel mTunnelClock;
   cOmxTunnel mTunnelDecoder;
@@ -368,12 +425,80 @@ private:
   bool mDeInterlace = false;
   bool mDeInterlaceAdv = false;
 
-  float mPixelAspect = 1.f;
+  cH264Parser* mH264Parser = nullptr;
+
+  // input buffers held against the memory budget
+  int64_t mFifoBytes = 0;
+
+  // bringup timing, open to first rendered frame
+  double mOpenTime = 0.0;
+  bool mFirstFrame = false;
+
   OMX_DISPLAYTRANSFORMTYPE mTransform = OMX_DISPLAY_ROT0;
   //}}}
   };
 //}}}
 //{{{
+class cOmxSwVideo : public cVideoDecoder {
+// libavcodec on the arm cores, frame threaded, yuv420 frames paced against the clock into video_render
+public:
+  virtual ~cOmxSwVideo();
+
+  std::string getDecoderName() { return mCodecName; }
+  std::string getDebugString();
+  bool isSoftware() { return true; }
+
+  bool isEOS();
+  unsigned int getInputBufferSpace();
+  int getRenderedFrames() { return mPresentedFrames; }
+
+  // decode fps over stream fps, above 1 keeps up
+  double getHeadroom();
+
+  bool open (cOmxClock* clock, const cOmxVideoConfig& config);
+  bool decode (uint8_t* data, int size, double dts, double pts, bool decodeOnly, std::atomic<bool>& flushRequested);
+  void submitEOS();
+  void reset();
+  void close();
+
+private:
+  bool decodePacket (AVPacket* avPacket, bool decodeOnly, std::atomic<bool>& flushRequested);
+  bool present (AVFrame* frame, double pts, std::atomic<bool>& flushRequested);
+  bool setupRender (int width, int height);
+  void closeRender();
+
+  //{{{  vars
+  cAvUtil mAvUtil;
+  cAvCodec mAvCodec;
+  cSwScale mSwScale;
+
+  AVCodecContext* mCodecContext = nullptr;
+  AVFrame* mFrame = nullptr;
+  SwsContext* mSwsContext = nullptr;
+  std::string mCodecName;
+  double mFps = 25.0;
+
+  // render input, planar yuv420, stride and slice height aligned for the render
+  bool mRenderSetup = false;
+  int mWidth = 0;
+  int mHeight = 0;
+  int mStride = 0;
+  int mSliceHeight = 0;
+  int64_t mRenderBytes = 0;
+
+  bool mClockStarted = false;
+  bool mSubmittedEos = false;
+  bool mFailedEos = false;
+
+  // headroom, wall time in the decoder per decoded frame
+  double mDecodeSecs = 0.0;
+  int mDecodedFrames = 0;
+  int mPresentedFrames = 0;
+  int mLateFrames = 0;
+  //}}}
+  };
+//}}}
+//{{{
 class cOmxAudio {
 public:
   ~cOmxAudio();
@@ -381,6 +506,8 @@ public:
   bool isEOS();
   double getDelay();
   float getCacheTotal();
+  unsigned int getInputBufferSpace();
+  unsigned int getLastInputBufferSpace() { return mLastInputBufferSpace; } // as of last decode, no lock
   unsigned int getAudioRenderingLatency();
   int getChunkLen (int chans);
 
@@ -389,9 +516,14 @@ public:
   int getBitRate() { return mCodecContext->bit_rate; }
   uint64_t getChanLayout (enum PCMLayout layout);
 
+  bool isPassthrough() { return mPassthrough; }
+  bool isSink() { return mSink != nullptr; }
+  static bool canPassthrough (const cOmxAudioConfig& config);
+  double getCpuPerHour();
+
   std::string getDebugString();
-  std::array<float,6>& getPower (double pts);
-  std::map <uint64_t,std::array<float,6>>* getPowerMap() { return &mPowerMap; }
+  std::array<float,6> getPower (double pts);
+  void getPowerMap (double pts, double secs, std::map <uint64_t,std::array<float,6>>& powerMap);
 
   float getMute() { return mMute; }
   float getVolume() { return mMute ? 0.f : mCurVolume; }
@@ -413,9 +545,21 @@ private:
   int buildChanMapCEA (enum PCMChannels* chanMap, uint64_t layout);
   void buildChanMapOMX (enum OMX_AUDIO_CHANNELTYPE* chanMap, uint64_t layout);
 
+  bool decodePcm (uint8_t* data, int size, double pts, std::atomic<bool>& flushRequested);
+  bool decodePassthrough (uint8_t* data, int size, double pts, std::atomic<bool>& flushRequested);
+
+  void buildSoftMixMatrix (enum PCMChannels* outLayout);
+  uint8_t* softMix (int samples);
+  void updateDrift();
+
   bool srcChanged();
+  std::string getSinceOpen() { return dec(int((mClock->getAbsoluteClock() - mOpenTime) / 1000.0)) + "ms"; }
   void applyVolume();
+  void meter (uint8_t* data, int chans, int samples, double pts);
+  void trimPowerMap (uint64_t pts);
   void addBuffer (uint8_t* data, int size, bool format32, int chans, int samples, double pts);
+  void writeSink (uint8_t* data, bool format32, int chans, int samples, double pts,
+                  std::atomic<bool>& flushRequested);
 
   //{{{  vars
   std::recursive_mutex mMutex;
@@ -453,6 +597,7 @@ private:
   unsigned int mNumInputChans = 0;
   unsigned int mNumOutputChans = 0;
   unsigned int mBitsPerSample = 0;
+  unsigned int mSampleRate = 0;
 
   unsigned int mBytesPerSec = 0;
   unsigned int mInputBytesPerSec = 0;
@@ -471,6 +616,7 @@ private:
   float mLastVolume = 0.f;
   float mDownmixMatrix[OMX_AUDIO_MAXCHANNELS*OMX_AUDIO_MAXCHANNELS];
   std::array <float,6> mPower;
+  std::mutex mPowerMapMutex; // audio thread inserts and trims, ui copies
   std::map <uint64_t,std::array<float,6>> mPowerMap;
 
   int mChans = 0;
@@ -480,6 +626,33 @@ private:
   uint8_t* mOutput = nullptr;
   int mOutputAllocated = 0;
   int mOutputSize = 0;
+
+  bool mSrcChanged = false;
+  double mOpenTime = 0.0;
+  bool mPassthrough = false;
+  cSpdifPacker mSpdifPacker;
+
+  bool mSoftMix = false;
+  float mSoftMixMatrix[8*8];
+  float mSoftMixGain = 1.f;
+  uint8_t* mMixOutput = nullptr;
+  int mMixOutputAllocated = 0;
+
+  // non omx renderer, softMix upstream, slaved to clock while it runs
+  cAudioSink* mSink = nullptr;
+  int mSinkDropped = 0;
+
+  std::atomic<unsigned int> mLastInputBufferSpace { 0 };
+
+  // cpu seconds spent decoding against media seconds output
+  double mCpuSecs = 0.0;
+  double mMediaSecs = 0.0;
+
+  // live drift compensation, filtered delay and current correction
+  double mDriftDelay = 0.0;
+  double mDriftIntegral = 0.0;
+  double mDriftPpm = 0.0;
+  double mDriftNextSecs = 0.0;
   //}}}
   };
 //}}}
@@ -505,15 +678,57 @@ public:
 
   int getNumPackets() { return mPackets.size(); };
   int getPacketCacheSize() { return mPacketCacheSize; };
+  //{{{
+  int getPacketMaxCacheSize() {
+  // own limit, or the shared packet budget if that's lower, it shrinks under memory pressure
+    return (int)std::min ((int64_t)mPacketMaxCacheSize, cMemoryBudget::get().getLimit (cMemoryBudget::ePackets));
+    }
+  //}}}
   double getCurPTS() { return mCurPts; };
   double getDelay() { return mDelay; }
+  int getDecodeOnlyPackets() { return mDecodeOnlyPackets; }
+  int getDecodeOnlyUs() { return mDecodeOnlyUs; }
+  //{{{
+  double getCacheDuration() {
+  // media secs queued, first to last timestamped packet
+
+    double firstPts = kNoPts;
+    double lastPts = kNoPts;
+
+    lock();
+    for (auto it = mPackets.begin(); (it != mPackets.end()) && (firstPts == kNoPts); ++it)
+      firstPts = ((*it)->mPts != kNoPts) ? (*it)->mPts : (*it)->mDts;
+    for (auto it = mPackets.rbegin(); (it != mPackets.rend()) && (lastPts == kNoPts); ++it)
+      lastPts = ((*it)->mPts != kNoPts) ? (*it)->mPts : (*it)->mDts;
+    unLock();
+
+    return ((firstPts != kNoPts) && (lastPts > firstPts)) ? (lastPts - firstPts) / kPtsScale : 0.0;
+    }
+  //}}}
 
   void setDelay (double delay) { mDelay = delay; }
+  //{{{
+  void setBitrate (double bytesPerSec) {
+  // size cache in media secs from stream bitrate, keep byte limit until bitrate known
+
+    if ((mPacketMaxCacheSecs > 0.f) && (bytesPerSec > 0.0))
+      mPacketMaxCacheSize = (int)std::min (mPacketMaxCacheSecs * bytesPerSec,
+                                           (double)cMemoryBudget::get().getQuota (cMemoryBudget::ePackets));
+    }
+  //}}}
 
   //{{{
   bool addPacket (cOmxPacket* packet) {
+  // always take a packet when empty, high bitrate packet bigger than limit mustn't stall us
 
-    if (mAbort || ((mPacketCacheSize + packet->mSize) > mPacketMaxCacheSize))
+    if (mAbort)
+      return false;
+
+    auto& memoryBudget = cMemoryBudget::get();
+    if (!mPacketCacheSize)
+      memoryBudget.alloc (cMemoryBudget::ePackets, packet->mSize);
+    else if (((mPacketCacheSize + packet->mSize) > mPacketMaxCacheSize) ||
+             !memoryBudget.tryAlloc (cMemoryBudget::ePackets, packet->mSize))
       return false;
 
     lock();
@@ -529,6 +744,7 @@ public:
   void run (const std::string& name) {
 
     cLog::setThreadName (name);
+    cTracer::setThreadName (name);
 
     cOmxPacket* packet = nullptr;
     while (true) {
@@ -548,10 +764,12 @@ public:
       else if (!packet && !mPackets.empty()) {
         packet = mPackets.front();
         mPacketCacheSize -= packet->mSize;
+        cMemoryBudget::get().free (cMemoryBudget::ePackets, packet->mSize);
         mPackets.pop_front();
         }
       unLock();
 
+      cTraceSpan span ("decode");
       lockDecoder();
       if (packet && (mFlush || decode (packet))) {
         delete (packet);
@@ -575,10 +793,23 @@ public:
     double pts = packet->mPts;
     if (pts != kNoPts) {
       pts += mDelay;
-      mCurPts = pts;
+      if (!packet->mDecodeOnly)
+        mCurPts = pts;
       }
 
-    return decodeDecoder (packet->mData, packet->mSize, dts, pts);
+    // dropped packet is consumed, same as decoded
+    if (!packet->mDecodeOnly && dropPacket (packet, (pts != kNoPts) ? pts : dts))
+      return true;
+
+    if (!packet->mDecodeOnly)
+      return decodeDecoder (packet->mData, packet->mSize, dts, pts, false);
+
+    // accurate seek cost, time to hand decode only packets to the decoder
+    int64_t startUs = cTracer::getUs();
+    bool ok = decodeDecoder (packet->mData, packet->mSize, dts, pts, true);
+    mDecodeOnlyUs += (int)(cTracer::getUs() - startUs);
+    mDecodeOnlyPackets++;
+    return ok;
     }
   //}}}
   virtual void submitEOS() = 0;
@@ -594,7 +825,10 @@ public:
     mFlushRequested = false;
 
     mFlush = true;
+    for (auto packet : mPackets)
+      delete (packet);
     mPackets.clear();
+    cMemoryBudget::get().free (cMemoryBudget::ePackets, mPacketCacheSize);
     mPacketCacheSize = 0;
     mCurPts = kNoPts;
 
@@ -605,6 +839,17 @@ public:
     }
   //}}}
   //{{{
+  void abort() {
+  // stop run so its thread can be joined, wake it from packet wait and any blocking decode, close tears down
+
+    lock();
+    mAbort = true;
+    mFlushRequested = true;
+    pthread_cond_broadcast (&mPacketCond);
+    unLock();
+    }
+  //}}}
+  //{{{
   bool close() {
 
     mAbort  = true;
@@ -631,9 +876,10 @@ protected:
   void unLockDecoder() { pthread_mutex_unlock (&mLockDecoder); }
 
   // should be a decoder base class here
-  virtual bool decodeDecoder (uint8_t* data, int size, double dts, double pts) = 0;
+  virtual bool decodeDecoder (uint8_t* data, int size, double dts, double pts, bool decodeOnly) = 0;
   virtual void flushDecoder() = 0;
   virtual void deleteDecoder() = 0;
+  virtual bool dropPacket (cOmxPacket* packet, double pts) { return false; }
 
   // vars
   pthread_mutex_t mLock;
@@ -655,8 +901,11 @@ protected:
   bool mAbort = false;
   bool mFlush = false;
   std::atomic<bool> mFlushRequested;
+  std::atomic<int> mDecodeOnlyPackets { 0 };
+  std::atomic<int> mDecodeOnlyUs { 0 };
   int mPacketCacheSize = 0;
   int mPacketMaxCacheSize = 0;
+  float mPacketMaxCacheSecs = 0.f;
 
 private:
   std::deque<cOmxPacket*> mPackets;
@@ -675,10 +924,17 @@ public:
   bool getMute() { return mOmxAudio->getMute(); }
   float getVolume() { return mOmxAudio->getVolume(); }
   int getChans() { return mOmxAudio->getChans(); }
+  unsigned int getInputBufferSpace() { return mOmxAudio->getInputBufferSpace(); }
+  unsigned int getLastInputBufferSpace() { return mOmxAudio->getLastInputBufferSpace(); }
+  bool isSink() { return mOmxAudio->isSink(); }
 
   std::string getDebugString() { return mOmxAudio->getDebugString(); }
-  std::array<float,6>& getPower (double pts) { return mOmxAudio->getPower (pts); }
-  std::map <uint64_t,std::array<float,6>>* getPowerMap() { return mOmxAudio->getPowerMap(); }
+  std::array<float,6> getPower (double pts) { return mOmxAudio->getPower (pts); }
+  //{{{
+  void getPowerMap (double pts, double secs, std::map <uint64_t,std::array<float,6>>& powerMap) {
+    mOmxAudio->getPowerMap (pts, secs, powerMap);
+    }
+  //}}}
 
   void setMute (bool mute) { mOmxAudio->setMute (mute); }
   void setVolume (float volume) { mOmxAudio->setVolume (volume); }
@@ -689,6 +945,7 @@ public:
     mClock = clock;
     mConfig = config;
     mPacketMaxCacheSize = mConfig.mPacketMaxCacheSize;
+    mPacketMaxCacheSecs = mConfig.mPacketMaxCacheSecs;
 
     mAbort = false;
     mFlush = false;
@@ -719,7 +976,7 @@ private:
   bool openOmxAudio();
 
   //{{{
-  bool decodeDecoder (uint8_t* data, int size, double dts, double pts) {
+  bool decodeDecoder (uint8_t* data, int size, double dts, double pts, bool decodeOnly) {
     return mOmxAudio->decode (data, size, dts, pts, mFlushRequested);
     }
   //}}}
@@ -741,23 +998,34 @@ private:
   cOmxAudio* mOmxAudio = nullptr;
   };
 //}}}
+
+// further behind than a timestamp jump, longest wait for a keyframe when skipping to one
+const double kMaxLateSecs = 10.0;
+const double kMaxSkipSecs = 10.0;
+
 //{{{
 class cOmxVideoPlayer : public cOmxPlayer {
 public:
   cOmxVideoPlayer() : cOmxPlayer() {}
   virtual ~cOmxVideoPlayer() { close(); }
 
-  bool isEOS() { return !getNumPackets() && mOmxVideo->isEOS(); }
+  bool isEOS() { return !getNumPackets() && mVideoDecoder->isEOS(); }
+  bool isSoftware() { return mVideoDecoder && mVideoDecoder->isSoftware(); }
   double getFPS() { return mFps; };
+  unsigned int getInputBufferSpace() { return mVideoDecoder->getInputBufferSpace(); }
+  int getRenderedFrames() { return mVideoDecoder->getRenderedFrames(); }
   //{{{
   std::string getDebugString() {
-    return dec(mConfig.mHints.width) + "x" + dec(mConfig.mHints.height) + "@" + frac (mFps, 4,2,' ');
+    return dec(mConfig.mHints.width) + "x" + dec(mConfig.mHints.height) + "@" + frac (mFps, 4,2,' ') +
+           (mVideoDecoder ? " " + mVideoDecoder->getDebugString() : "") +
+           ((mDroppedNonRef || mDroppedGop) ?
+             " drop:" + dec(mDroppedNonRef) + "/" + dec(mDroppedGop) + "/" + dec(mGopSkips) : "");
     }
   //}}}
 
-  void setAlpha (int alpha) { mOmxVideo->setAlpha (alpha); }
-  void setVideoRect (int aspectMode) { mOmxVideo->setVideoRect (aspectMode); }
-  void setVideoRect (const cRect& SrcRect, const cRect& DestRect) { mOmxVideo->setVideoRect (SrcRect, DestRect); }
+  void setAlpha (int alpha) { mVideoDecoder->setAlpha (alpha); }
+  void setVideoRect (int aspectMode) { mVideoDecoder->setVideoRect (aspectMode); }
+  void setVideoRect (const cRect& SrcRect, const cRect& DestRect) { mVideoDecoder->setVideoRect (SrcRect, DestRect); }
 
   //{{{
   bool open (cOmxClock* clock, const cOmxVideoConfig& config) {
@@ -765,6 +1033,7 @@ public:
     mClock = clock;
     mConfig = config;
     mPacketMaxCacheSize = mConfig.mPacketMaxCacheSize;
+    mPacketMaxCacheSecs = mConfig.mPacketMaxCacheSecs;
 
     mAbort = false;
     mFlush = false;
@@ -776,28 +1045,45 @@ public:
 
     mFps = normalisedFps (mConfig.mHints.fpsscale, mConfig.mHints.fpsrate);
 
-    if (mConfig.mHints.codec == AV_CODEC_ID_MPEG2VIDEO) {
-      cLog::log (LOGNOTICE, "cOmxPlayerVideo::open - no hw mpeg2 decoder - implement swDecoder");
-      return false;
-      }
-    else {
-      // open hw decoder
-      mOmxVideo = new cOmxVideo();
-      if (mOmxVideo->open (mClock, mConfig)) {
-        cLog::log (LOGINFO, "cOmxPlayerVideo::open - " + mOmxVideo->getDecoderName() +
+    // avcC extradata gives the nal length prefix size, anything else is annexb
+    auto extraData = (uint8_t*)mConfig.mHints.extradata;
+    bool avcc = extraData && (mConfig.mHints.extrasize >= 7) && (extraData[0] == 1);
+    mNalLengthSize = avcc ? (extraData[4] & 3) + 1 : 0;
+    mSkipToKey = false;
+    mDroppedNonRef = 0;
+    mDroppedGop = 0;
+    mGopSkips = 0;
+
+    // unlicensed mpeg2 hw open would succeed and decode nothing, ask the firmware
+    bool software = mConfig.mHints.software ||
+                    ((mConfig.mHints.codec == AV_CODEC_ID_MPEG2VIDEO) && !cOmxVideo::isMpeg2Licensed());
+    if (!software) {
+      mVideoDecoder = new cOmxVideo();
+      if (mVideoDecoder->open (mClock, mConfig)) {
+        cLog::log (LOGINFO, "cOmxPlayerVideo::open - " + mVideoDecoder->getDecoderName() +
                    ":" + dec(mConfig.mHints.profile) +
                    " " + dec(mConfig.mHints.width) + "x" + dec(mConfig.mHints.height) +
                    "@" + frac(mFps,4,2,' '));
         return true;
         }
-      else {
-        cLog::log (LOGERROR, "cOmxPlayerVideo::open - no decoder");
-        if (mConfig.mHints.codec == AV_CODEC_ID_MPEG2VIDEO)
-          cLog::log (LOGNOTICE, "mpeg2 decoder needed");
-        close();
-        return false;
-        }
+
+      cLog::log (LOGNOTICE, "cOmxPlayerVideo::open - no hw decoder for codec " + dec(mConfig.mHints.codec) +
+                            ", trying sw");
+      delete mVideoDecoder;
+      }
+
+    // sw fallback
+    mVideoDecoder = new cOmxSwVideo();
+    if (mVideoDecoder->open (mClock, mConfig)) {
+      cLog::log (LOGNOTICE, "cOmxPlayerVideo::open - sw " + mVideoDecoder->getDecoderName() +
+                 " " + dec(mConfig.mHints.width) + "x" + dec(mConfig.mHints.height) +
+                 "@" + frac(mFps,4,2,' '));
+      return true;
       }
+
+    cLog::log (LOGERROR, "cOmxPlayerVideo::open - no decoder");
+    close();
+    return false;
     }
   //}}}
   //{{{
@@ -816,7 +1102,7 @@ public:
     mPacketCacheSize = 0;
     }
   //}}}
-  void submitEOS() { mOmxVideo->submitEOS(); }
+  void submitEOS() { mVideoDecoder->submitEOS(); }
 
 private:
   //{{{
@@ -849,17 +1135,101 @@ private:
   //}}}
 
   //{{{
-  bool decodeDecoder (uint8_t* data, int size, double dts, double pts) {
-    return mOmxVideo->decode (data, size, dts, pts, mFlushRequested);
+  bool decodeDecoder (uint8_t* data, int size, double dts, double pts, bool decodeOnly) {
+    return mVideoDecoder->decode (data, size, dts, pts, decodeOnly, mFlushRequested);
+    }
+  //}}}
+  //{{{
+  void flushDecoder() {
+    mVideoDecoder->reset();
+    mSkipToKey = false;
+    }
+  //}}}
+  //{{{
+  void deleteDecoder() {
+
+    if (mDroppedNonRef || mDroppedGop)
+      cLog::log (LOGNOTICE, "cOmxPlayerVideo late drop nonRef:" + dec(mDroppedNonRef) +
+                            " gop:" + dec(mDroppedGop) + " packets in " + dec(mGopSkips) + " skips");
+
+    delete mVideoDecoder;
+    mVideoDecoder = nullptr;
+    }
+  //}}}
+
+  //{{{
+  bool isDisposable (cOmxPacket* packet) {
+  // nothing else predicts from it, dropping it costs one frame
+
+    if (packet->mKeyFrame)
+      return false;
+
+    switch (mConfig.mHints.codec) {
+      case AV_CODEC_ID_H264:
+        return !cH264Parser::isReference (packet->mData, packet->mSize, mNalLengthSize);
+      case AV_CODEC_ID_MPEG2VIDEO:
+        return cStartCode::getMpeg2PictureType (packet->mData, packet->mSize) == 3;
+      default:
+        return false;
+      }
+    }
+  //}}}
+  //{{{
+  bool dropPacket (cOmxPacket* packet, double pts) {
+  // behind the clock, or queue backed up to its limit and behind at all, non reference frames go first,
+  // further behind drops everything up to the next keyframe
+
+    if (!mConfig.mDropLate || (pts == kNoPts) || mClock->isPaused())
+      return false;
+
+    double lateSecs = (mClock->getMediaTime() - pts) / kPtsScale;
+    if (lateSecs > kMaxLateSecs) {
+      // timestamp jump, not overload, next flush sorts it
+      mSkipToKey = false;
+      return false;
+      }
+
+    if (mSkipToKey) {
+      if (!packet->mKeyFrame && (pts - mSkipStartPts < kMaxSkipSecs * kPtsScale)) {
+        mDroppedGop++;
+        return true;
+        }
+      // keyframe, or none turned up, decode from here
+      mSkipToKey = false;
+      return false;
+      }
+
+    if ((lateSecs > mConfig.mSkipGopSecs) && !packet->mKeyFrame) {
+      cLog::log (LOGINFO, "cOmxPlayerVideo late " + frac(lateSecs, 5,3,' ') + " skip to keyframe");
+      mSkipToKey = true;
+      mSkipStartPts = pts;
+      mGopSkips++;
+      mDroppedGop++;
+      return true;
+      }
+
+    bool backlog = mPacketCacheSize > (int64_t)getPacketMaxCacheSize() * 9 / 10;
+    if (((lateSecs > mConfig.mDropLateSecs) || (backlog && (lateSecs > 0.0))) && isDisposable (packet)) {
+      mDroppedNonRef++;
+      return true;
+      }
+
+    return false;
     }
   //}}}
-  void flushDecoder() { mOmxVideo->reset(); }
-  void deleteDecoder() { delete mOmxVideo; mOmxVideo = nullptr; }
 
   // vars
   cOmxVideoConfig mConfig;
-  cOmxVideo* mOmxVideo = nullptr;
+  cVideoDecoder* mVideoDecoder = nullptr;
 
   double mFps = 25.0;
+
+  // late drop, decode thread only, counts read by getDebugString
+  int mNalLengthSize = 0;
+  bool mSkipToKey = false;
+  double mSkipStartPts = 0.0;
+  int mDroppedNonRef = 0;
+  int mDroppedGop = 0;
+  int mGopSkips = 0;
   };
 //}}}
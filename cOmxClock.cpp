@@ -64,6 +64,20 @@ double cOmxClock::getMediaTime() {
   }
 //}}}
 //{{{
+bool cOmxClock::isRunning() {
+// started, has had its start time, paused still counts as running
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+
+  OMX_TIME_CONFIG_CLOCKSTATETYPE clock;
+  OMX_INIT_STRUCTURE(clock);
+  if (mOmxCore.getConfig (OMX_IndexConfigTimeClockState, &clock))
+    return false;
+
+  return clock.eState == OMX_TIME_ClockStateRunning;
+  }
+//}}}
+//{{{
 double cOmxClock::getClockAdjustment() {
 
   lock_guard<recursive_mutex> lockGuard (mMutex);
@@ -219,6 +233,29 @@ bool cOmxClock::hdmiClockSync() {
   }
 //}}}
 
+//{{{
+bool cOmxClock::start (double pts) {
+// run from pts now, when no omx render is tunnelled to give the clock its start time
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+
+  OMX_TIME_CONFIG_CLOCKSTATETYPE clock;
+  OMX_INIT_STRUCTURE(clock);
+
+  clock.eState = OMX_TIME_ClockStateRunning;
+  clock.nStartTime = toOmxTime ((int64_t)pts);
+  if (mOmxCore.setConfig (OMX_IndexConfigTimeClockState, &clock)) {
+    // error, return
+    cLog::log (LOGERROR, __func__);
+    return false;
+    }
+
+  cLog::log (LOGINFO1, "cOmxClock::start " + frac(pts / kPtsScale, 6,2,' '));
+  mState = clock.eState;
+  mLastMediaTime = 0.0;
+  return true;
+  }
+//}}}
 //{{{
 bool cOmxClock::stop() {
 
@@ -277,6 +314,9 @@ bool cOmxClock::reset (bool hasVideo, bool hasAudio) {
     return false;
 
   if (mState == OMX_TIME_ClockStateStopped) {
+    // no omx render to send a start time, someone has to call start
+    mStartWaiters = hasVideo || hasAudio;
+
     OMX_TIME_CONFIG_CLOCKSTATETYPE clock;
     OMX_INIT_STRUCTURE(clock);
 
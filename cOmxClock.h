@@ -38,6 +38,8 @@ public:
   double getClockAdjustment();
   double getPlaySpeed() { return mSpeed; };
   bool isPaused() { return mPause; };
+  bool isRunning();
+  bool hasStartWaiters() { return mStartWaiters; }
 
   bool setReferenceClock (bool hasAudio);
   bool setMediaTime (double pts);
@@ -47,6 +49,7 @@ public:
   bool stateExecute();
   bool hdmiClockSync();
 
+  bool start (double pts);
   bool stop();
   bool step (int steps);
   bool reset (bool has_video, bool hasAudio);
@@ -65,6 +68,7 @@ private:
   double mSpeed = 1.0;
 
   OMX_U32 mWaitMask = 0;
+  bool mStartWaiters = false;
   OMX_TIME_CLOCKSTATE mState = OMX_TIME_ClockStateStopped;
   OMX_TIME_REFCLOCKTYPE mClock = OMX_TIME_RefClockNone;
 
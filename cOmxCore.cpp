@@ -8,6 +8,7 @@
 
 #include "../shared/utils/cLog.h"
 #include "cOmxClock.h"
+#include "cTracer.h"
 
 using namespace std;
 //}}}
@@ -48,11 +49,47 @@ void addTimeSpec (struct timespec &time, long mSecs) {
   }
 //}}}
 
+// cOmxCommand
+//{{{
+OMX_ERRORTYPE cOmxCommand::wait (long timeout) {
+// wait for completion once, later waits return the same result
+
+  if (!mDone) {
+    mError = mCore->waitCommand (mCommand, mParam, timeout);
+    mDone = true;
+    }
+
+  return mError;
+  }
+//}}}
+//{{{
+OMX_ERRORTYPE cOmxCommand::waitAll (vector<cOmxCommand>& commands, long timeout) {
+// wait for every command against one shared deadline, every command is reaped, return first error
+
+  struct timespec endTime;
+  clock_gettime (CLOCK_MONOTONIC, &endTime);
+  addTimeSpec (endTime, timeout);
+
+  OMX_ERRORTYPE result = OMX_ErrorNone;
+  for (auto& command : commands) {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    long remaining = ((endTime.tv_sec - now.tv_sec) * 1000) + ((endTime.tv_nsec - now.tv_nsec) / 1000000);
+
+    auto omxErr = command.wait (max (remaining, 0L));
+    if (omxErr && !result)
+      result = omxErr;
+    }
+
+  return result;
+  }
+//}}}
+
 // cOmxCore
 //{{{
 cOmxCore::cOmxCore() {
 
-  mEvents.clear();
+  mEventPending = 0;
 
   pthread_mutex_init (&mInputMutex, nullptr);
   pthread_mutex_init (&mOutputMutex, nullptr);
@@ -60,7 +97,8 @@ cOmxCore::cOmxCore() {
   pthread_mutex_init (&mEosMutex, nullptr);
   pthread_cond_init (&mInputBufferCond, nullptr);
   pthread_cond_init (&mOutputBufferCond, nullptr);
-  pthread_cond_init (&mEventCond, nullptr);
+  for (auto& eventCond : mEventConds)
+    pthread_cond_init (&eventCond, nullptr);
   }
 //}}}
 //{{{
@@ -74,7 +112,8 @@ cOmxCore::~cOmxCore() {
   pthread_mutex_destroy (&mEosMutex);
   pthread_cond_destroy (&mInputBufferCond);
   pthread_cond_destroy (&mOutputBufferCond);
-  pthread_cond_destroy (&mEventCond);
+  for (auto& eventCond : mEventConds)
+    pthread_cond_destroy (&eventCond);
   }
 //}}}
 
@@ -100,7 +139,13 @@ bool cOmxCore::init (const string& name, OMX_INDEXTYPE index, OMX_CALLBACKTYPE*
   mInputUseBuffers = false;
   mOutputUseBuffers = false;
 
-  mEvents.clear();
+  pthread_mutex_lock (&mEventMutex);
+  mCommandEvents.clear();
+  mVendorEvents.clear();
+  for (auto& eventCount : mEventCounts)
+    eventCount = 0;
+  mEventPending = 0;
+  pthread_mutex_unlock (&mEventMutex);
   mIgnoreError = OMX_ErrorNone;
 
   mCallbacks.EventHandler = &cOmxCore::decoderEventHandlerCallback;
@@ -179,7 +224,8 @@ bool cOmxCore::deInit() {
 //}}}
 
 //{{{
-OMX_ERRORTYPE cOmxCore::enablePort (unsigned int port,  bool wait) {
+cOmxCommand cOmxCore::enablePortAsync (unsigned int port) {
+// send port enable if disabled, already enabled returns a completed handle
 
   OMX_PARAM_PORTDEFINITIONTYPE portFormat;
   OMX_INIT_STRUCTURE(portFormat);
@@ -193,17 +239,17 @@ OMX_ERRORTYPE cOmxCore::enablePort (unsigned int port,  bool wait) {
     omxErr = OMX_SendCommand (mHandle, OMX_CommandPortEnable, port, nullptr);
     if (omxErr) {
       cLog::log (LOGERROR, "%s enable port %d %s 0x%08x", __func__, port, mName.c_str(), (int)omxErr);
-      return omxErr;
+      return cOmxCommand (omxErr);
       }
-    else if (wait)
-      omxErr = waitCommand (OMX_CommandPortEnable, port);
+    return cOmxCommand (this, OMX_CommandPortEnable, port);
     }
 
-  return omxErr;
+  return cOmxCommand (omxErr);
   }
 //}}}
 //{{{
-OMX_ERRORTYPE cOmxCore::disablePort (unsigned int port, bool wait) {
+cOmxCommand cOmxCore::disablePortAsync (unsigned int port) {
+// send port disable if enabled, already disabled returns a completed handle
 
   OMX_PARAM_PORTDEFINITIONTYPE portParam;
   OMX_INIT_STRUCTURE(portParam);
@@ -219,13 +265,26 @@ OMX_ERRORTYPE cOmxCore::disablePort (unsigned int port, bool wait) {
     if (omxErr) {
       cLog::log (LOGERROR, string(__func__) + " " + mName +
                            " - sendCommand port:" + dec(port) + " " + hex(omxErr));
-      return omxErr;
+      return cOmxCommand (omxErr);
       }
-    else if (wait)
-      omxErr = waitCommand (OMX_CommandPortDisable, port);
+    return cOmxCommand (this, OMX_CommandPortDisable, port);
     }
 
-  return omxErr;
+  return cOmxCommand (omxErr);
+  }
+//}}}
+//{{{
+OMX_ERRORTYPE cOmxCore::enablePort (unsigned int port,  bool wait) {
+
+  auto command = enablePortAsync (port);
+  return wait ? command.wait() : command.getError();
+  }
+//}}}
+//{{{
+OMX_ERRORTYPE cOmxCore::disablePort (unsigned int port, bool wait) {
+
+  auto command = disablePortAsync (port);
+  return wait ? command.wait() : command.getError();
   }
 //}}}
 //{{{
@@ -409,6 +468,7 @@ OMX_ERRORTYPE cOmxCore::allocOutputBuffers (bool useBuffers /* = false */) {
 OMX_BUFFERHEADERTYPE* cOmxCore::getInputBuffer (long timeout /*=200*/) {
 // timeout in milliseconds
 
+  cTraceSpan span ("getInputBuffer");
   pthread_mutex_lock (&mInputMutex);
 
   struct timespec endtime;
@@ -471,6 +531,7 @@ OMX_BUFFERHEADERTYPE* cOmxCore::getOutputBuffer (long timeout /*=200*/) {
 //{{{
 OMX_ERRORTYPE cOmxCore::emptyThisBuffer (OMX_BUFFERHEADERTYPE* omxBuffer) {
 
+  cTraceSpan span ("emptyThisBuffer");
   auto omxErr = OMX_EmptyThisBuffer (mHandle, omxBuffer);
   if (omxErr)
     cLog::log (LOGERROR, string(__func__) + " " + mName);
@@ -671,6 +732,8 @@ void cOmxCore::flushAll() {
 
 //{{{
 OMX_ERRORTYPE cOmxCore::addEvent (OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2) {
+// route event to its slot, count or queue it, wake only that slot's waiters,
+// an error goes to every blocking wait in progress, dropped if nobody is waiting
 
   omxEvent event;
   event.eEvent = eEvent;
@@ -678,11 +741,35 @@ OMX_ERRORTYPE cOmxCore::addEvent (OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32
   event.nData2 = nData2;
 
   pthread_mutex_lock (&mEventMutex);
-  removeEvent (eEvent, nData1, nData2);
-  mEvents.push_back (event);
 
-  // this allows (all) blocked tasks to be awoken
-  pthread_cond_broadcast (&mEventCond);
+  if (eEvent == OMX_EventError) {
+    if (mWaiters.empty())
+      cLog::log (LOGINFO1, "%s %s dropped error 0x%x port %d, nobody waiting",
+                           __func__, mName.c_str(), nData1, (int)nData2);
+    else {
+      for (auto waiter : mWaiters)
+        if (!waiter->mHasError) {
+          waiter->mHasError = true;
+          waiter->mError = event;
+          }
+      for (auto& eventCond : mEventConds)
+        pthread_cond_broadcast (&eventCond);
+      }
+    }
+  else {
+    int slot = getEventSlot (eEvent);
+    if (slot == eSlotCommand) {
+      removeEvent (eEvent, nData1, nData2);
+      mCommandEvents.push_back (event);
+      }
+    else if (slot == eSlotVendor)
+      mVendorEvents.push_back (event);
+    else
+      mEventCounts[slot]++;
+    mEventPending.fetch_or (1 << slot, memory_order_release);
+    pthread_cond_broadcast (&mEventConds[slot]);
+    }
+
   pthread_mutex_unlock (&mEventMutex);
 
   return OMX_ErrorNone;
@@ -690,56 +777,66 @@ OMX_ERRORTYPE cOmxCore::addEvent (OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32
 //}}}
 //{{{
 void cOmxCore::removeEvent (OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2) {
-
-  for (auto it = mEvents.begin(); it != mEvents.end(); ) {
-    auto event = *it;
-    if (event.eEvent == eEvent && event.nData1 == nData1 && event.nData2 == nData2)
-      it = mEvents.erase (it);
-    else
-      ++it;
+// remove identical queued command event, called with mEventMutex held
+
+  if (eEvent == OMX_EventCmdComplete) {
+    for (auto it = mCommandEvents.begin(); it != mCommandEvents.end(); ) {
+      if ((it->nData1 == nData1) && (it->nData2 == nData2))
+        it = mCommandEvents.erase (it);
+      else
+        ++it;
+      }
+    if (mCommandEvents.empty())
+      mEventPending.fetch_and (~(1 << eSlotCommand), memory_order_relaxed);
     }
   }
 //}}}
 //{{{
+bool cOmxCore::isEventPending (OMX_EVENTTYPE eventType) const {
+// lock free, true if eventType is waiting to be consumed
+
+  return mEventPending.load (memory_order_acquire) & (1 << getEventSlot (eventType));
+  }
+//}}}
+//{{{
 OMX_ERRORTYPE cOmxCore::waitEvent (OMX_EVENTTYPE eventType, long timeout) {
-// timeout in milliseconds
+// timeout in milliseconds, a zero timeout poll with nothing pending never takes the lock,
+// polls only take their own events, only blocking waits see errors arriving while they wait
+
+  int slot = getEventSlot (eventType);
+  if (!timeout && !(mEventPending.load (memory_order_acquire) & (1 << slot)))
+    return OMX_ErrorTimeout;
 
   pthread_mutex_lock (&mEventMutex);
 
+  cWaiter waiter;
+  if (timeout)
+    mWaiters.push_back (&waiter);
+
   struct timespec endtime;
   clock_gettime (CLOCK_REALTIME, &endtime);
   addTimeSpec (endtime, timeout);
 
+  auto omxErr = OMX_ErrorNone;
+  bool timedOut = false;
   while (true) {
-    for (auto it = mEvents.begin(); it != mEvents.end(); it++) {
-      auto event = *it;
-      if (event.eEvent == OMX_EventError && event.nData1 == (OMX_U32)OMX_ErrorSameState && event.nData2 == 1) {
-        mEvents.erase (it);
-        pthread_mutex_unlock (&mEventMutex);
-        return OMX_ErrorNone;
-        }
-      else if (event.eEvent == OMX_EventError) {
-        mEvents.erase (it);
-        pthread_mutex_unlock (&mEventMutex);
-        return (OMX_ERRORTYPE)event.nData1;
-      }
-      else if (event.eEvent == eventType) {
-        mEvents.erase (it);
-        pthread_mutex_unlock (&mEventMutex);
-        return OMX_ErrorNone;
-        }
+    if (waiter.mHasError) {
+      omxErr = getErrorResult (waiter.mError);
+      break;
       }
-
-    if (mResourceError)
+    if (takeSlotEvent (slot, eventType) || mResourceError)
+      break;
+    if (timedOut) {
+      omxErr = OMX_ErrorTimeout;
       break;
-    if (pthread_cond_timedwait (&mEventCond, &mEventMutex, &endtime) != 0) {
-      pthread_mutex_unlock (&mEventMutex);
-      return OMX_ErrorTimeout;
       }
+    timedOut = pthread_cond_timedwait (&mEventConds[slot], &mEventMutex, &endtime) != 0;
     }
 
+  if (timeout)
+    removeWaiter (&waiter);
   pthread_mutex_unlock (&mEventMutex);
-  return OMX_ErrorNone;
+  return omxErr;
   }
 //}}}
 
@@ -755,54 +852,50 @@ OMX_ERRORTYPE cOmxCore::sendCommand (OMX_COMMANDTYPE cmd, OMX_U32 cmdParam, OMX_
 //}}}
 //{{{
 OMX_ERRORTYPE cOmxCore::waitCommand (OMX_U32 command, OMX_U32 nData2, long timeout) {
-// timeout in milliseconds
+// timeout in milliseconds, only scans the few outstanding command completions
 
   pthread_mutex_lock (&mEventMutex);
 
+  cWaiter waiter;
+  mWaiters.push_back (&waiter);
+
   struct timespec endtime;
   clock_gettime (CLOCK_REALTIME, &endtime);
   addTimeSpec (endtime, timeout);
 
+  auto omxErr = OMX_ErrorNone;
+  bool timedOut = false;
   while (true) {
-    for (auto it = mEvents.begin(); it != mEvents.end(); it++) {
-      auto event = *it;
-      if (event.eEvent == OMX_EventError &&
-          event.nData1 == (OMX_U32)OMX_ErrorSameState &&
-          event.nData2 == 1) {
-        mEvents.erase (it);
-        pthread_mutex_unlock (&mEventMutex);
-        return OMX_ErrorNone;
-        }
-
-      else if (event.eEvent == OMX_EventError) {
-        mEvents.erase(it);
-        pthread_mutex_unlock (&mEventMutex);
-        return (OMX_ERRORTYPE)event.nData1;
-        }
+    if (waiter.mHasError) {
+      omxErr = getErrorResult (waiter.mError);
+      break;
+      }
 
-      else if (event.eEvent == OMX_EventCmdComplete &&
-               event.nData1 == command && event.nData2 == nData2) {
-        mEvents.erase (it);
-        pthread_mutex_unlock (&mEventMutex);
-        return OMX_ErrorNone;
-        }
+    auto it = find_if (mCommandEvents.begin(), mCommandEvents.end(),
+                       [=](const omxEvent& event) { return (event.nData1 == command) && (event.nData2 == nData2); });
+    if (it != mCommandEvents.end()) {
+      mCommandEvents.erase (it);
+      if (mCommandEvents.empty())
+        mEventPending.fetch_and (~(1 << eSlotCommand), memory_order_relaxed);
+      break;
       }
 
     if (mResourceError)
       break;
 
-    if (pthread_cond_timedwait (&mEventCond, &mEventMutex, &endtime) != 0) {
+    if (timedOut) {
       cLog::log (LOGERROR, "%s %s wait timeout event.eEvent 0x%08x event.command 0x%08x event.nData2 %d",
                            __func__, mName.c_str(),
                            (int)OMX_EventCmdComplete, (int)command, (int)nData2);
-
-      pthread_mutex_unlock (&mEventMutex);
-      return OMX_ErrorTimeout;
+      omxErr = OMX_ErrorTimeout;
+      break;
       }
+    timedOut = pthread_cond_timedwait (&mEventConds[eSlotCommand], &mEventMutex, &endtime) != 0;
     }
 
+  removeWaiter (&waiter);
   pthread_mutex_unlock (&mEventMutex);
-  return OMX_ErrorNone;
+  return omxErr;
   }
 //}}}
 
@@ -817,27 +910,45 @@ OMX_STATETYPE cOmxCore::getState() const {
   }
 //}}}
 //{{{
-OMX_ERRORTYPE cOmxCore::setState (OMX_STATETYPE state) {
+cOmxCommand cOmxCore::setStateAsync (OMX_STATETYPE state) {
 
-  OMX_STATETYPE state_actual = OMX_StateMax;
-  if (state == state_actual)
-    return OMX_ErrorNone;
-
-  auto omxErr = OMX_SendCommand(mHandle, OMX_CommandStateSet, state, 0);
-  if (omxErr) {
-    if (omxErr == OMX_ErrorSameState) {
-      cLog::log (LOGERROR, string( __func__) + " sameState " + mName);
-      omxErr = OMX_ErrorNone;
-      }
-    else
-      cLog::log (LOGERROR, string( __func__) + " setState" + mName);
+  auto omxErr = OMX_SendCommand (mHandle, OMX_CommandStateSet, state, 0);
+  if (omxErr == OMX_ErrorSameState) {
+    cLog::log (LOGERROR, string( __func__) + " sameState " + mName);
+    return cOmxCommand();
     }
-  else {
-    omxErr = waitCommand (OMX_CommandStateSet, state);
-    if (omxErr)
-      cLog::log (LOGERROR, string( __func__) + " wait setState " + mName);
+  else if (omxErr) {
+    cLog::log (LOGERROR, string( __func__) + " setState " + mName);
+    return cOmxCommand (omxErr);
     }
 
+  return cOmxCommand (this, OMX_CommandStateSet, state);
+  }
+//}}}
+//{{{
+OMX_ERRORTYPE cOmxCore::setState (OMX_STATETYPE state) {
+
+  auto omxErr = setStateAsync (state).wait();
+  if (omxErr)
+    cLog::log (LOGERROR, string( __func__) + " wait setState " + mName);
+
+  return omxErr;
+  }
+//}}}
+//{{{
+OMX_ERRORTYPE cOmxCore::setStates (const vector<cOmxCore*>& cores, OMX_STATETYPE state) {
+// send state to every initialised component not already there, then wait for them all
+// - transitions run concurrently, total wait is the slowest component, not the sum
+
+  vector<cOmxCommand> commands;
+  for (auto core : cores)
+    if (core->isInit() && (core->getState() != state))
+      commands.push_back (core->setStateAsync (state));
+
+  auto omxErr = cOmxCommand::waitAll (commands);
+  if (omxErr)
+    cLog::log (LOGERROR, string(__func__) + " wait setState " + hex(omxErr));
+
   return omxErr;
   }
 //}}}
@@ -927,6 +1038,7 @@ OMX_ERRORTYPE cOmxCore::decoderEmptyBufferDone (OMX_HANDLETYPE component,
   if (mExit)
     return OMX_ErrorNone;
 
+  cTracer::addInstant ("emptyBufferDone");
   pthread_mutex_lock (&mInputMutex);
   mInputAvaliable.push (buffer);
 
@@ -944,6 +1056,7 @@ OMX_ERRORTYPE cOmxCore::decoderFillBufferDone (OMX_HANDLETYPE component,
   if (mExit)
     return OMX_ErrorNone;
 
+  cTracer::addInstant ("fillBufferDone");
   pthread_mutex_lock (&mOutputMutex);
   mOutputAvailable.push (buffer);
 
@@ -966,6 +1079,7 @@ OMX_ERRORTYPE cOmxCore::decoderEventHandler (OMX_HANDLETYPE component,
     return OMX_ErrorNone;
     }
 
+  cTracer::addInstant ("event");
   addEvent (eEvent, nData1, nData2);
 
   switch (eEvent) {
@@ -1032,8 +1146,11 @@ OMX_ERRORTYPE cOmxCore::decoderEventHandler (OMX_HANDLETYPE component,
       if (mResourceError) {
         pthread_cond_broadcast (&mOutputBufferCond);
         pthread_cond_broadcast (&mInputBufferCond);
-        pthread_cond_broadcast (&mEventCond);
-       }
+        pthread_mutex_lock (&mEventMutex);
+        for (auto& eventCond : mEventConds)
+          pthread_cond_broadcast (&eventCond);
+        pthread_mutex_unlock (&mEventMutex);
+        }
     break;
     //}}}
 
@@ -1076,6 +1193,72 @@ void cOmxCore::resetEos() {
 
 // private
 //{{{
+int cOmxCore::getEventSlot (OMX_EVENTTYPE eEvent) {
+
+  switch (eEvent) {
+    case OMX_EventCmdComplete:               return eSlotCommand;
+    case OMX_EventMark:                      return eSlotMark;
+    case OMX_EventPortSettingsChanged:       return eSlotPortSettings;
+    case OMX_EventBufferFlag:                return eSlotBufferFlag;
+    case OMX_EventResourcesAcquired:         return eSlotResourcesAcquired;
+    case OMX_EventComponentResumed:          return eSlotComponentResumed;
+    case OMX_EventDynamicResourcesAvailable: return eSlotDynamicResources;
+    case OMX_EventPortFormatDetected:        return eSlotPortFormat;
+    case OMX_EventParamOrConfigChanged:      return eSlotParamChanged;
+    default:                                 return eSlotVendor;
+    }
+  }
+//}}}
+//{{{
+OMX_ERRORTYPE cOmxCore::getErrorResult (const omxEvent& event) {
+// sameState on a state change is not an error
+
+  if ((event.nData1 == (OMX_U32)OMX_ErrorSameState) && (event.nData2 == 1))
+    return OMX_ErrorNone;
+
+  return (OMX_ERRORTYPE)event.nData1;
+  }
+//}}}
+//{{{
+bool cOmxCore::takeSlotEvent (int slot, OMX_EVENTTYPE eEvent) {
+// consume one eEvent from its slot, clear pending bit when slot empties, called with mEventMutex held
+
+  bool empty;
+  if (slot == eSlotCommand) {
+    if (mCommandEvents.empty())
+      return false;
+    mCommandEvents.erase (mCommandEvents.begin());
+    empty = mCommandEvents.empty();
+    }
+
+  else if (slot == eSlotVendor) {
+    auto it = find_if (mVendorEvents.begin(), mVendorEvents.end(),
+                       [=](const omxEvent& event) { return event.eEvent == eEvent; });
+    if (it == mVendorEvents.end())
+      return false;
+    mVendorEvents.erase (it);
+    empty = mVendorEvents.empty();
+    }
+
+  else {
+    if (!mEventCounts[slot])
+      return false;
+    empty = --mEventCounts[slot] == 0;
+    }
+
+  if (empty)
+    mEventPending.fetch_and (~(1 << slot), memory_order_relaxed);
+  return true;
+  }
+//}}}
+//{{{
+void cOmxCore::removeWaiter (cWaiter* waiter) {
+// called with mEventMutex held
+
+  mWaiters.erase (find (mWaiters.begin(), mWaiters.end(), waiter));
+  }
+//}}}
+//{{{
 void cOmxCore::transitionToStateLoaded() {
 
   if (getState() != OMX_StateLoaded && getState() != OMX_StateIdle)
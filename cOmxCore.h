@@ -5,7 +5,10 @@
 #include <semaphore.h>
 #include <cstring>
 #include <string>
+#include <vector>
 #include <queue>
+#include <atomic>
+#include <algorithm>
 
 #include "../shared/utils/utils.h"
 #include "../shared/utils/cLog.h"
@@ -31,6 +34,32 @@ typedef struct omxEvent {
   } omxEvent;
 //}}}
 
+class cOmxCore;
+//{{{
+class cOmxCommand {
+// completion handle for an omx command sent without waiting
+// - issue commands to many components, overlap other work, then wait or waitAll
+public:
+  cOmxCommand() {}
+  explicit cOmxCommand (OMX_ERRORTYPE error) : mError(error) {}
+  cOmxCommand (cOmxCore* core, OMX_COMMANDTYPE command, OMX_U32 param)
+    : mCore(core), mCommand(command), mParam(param), mDone(false) {}
+
+  bool isPending() const { return !mDone; }
+  OMX_ERRORTYPE getError() const { return mError; }
+
+  OMX_ERRORTYPE wait (long timeout = 2000);
+  static OMX_ERRORTYPE waitAll (std::vector<cOmxCommand>& commands, long timeout = 2000);
+
+private:
+  cOmxCore* mCore = nullptr;
+  OMX_COMMANDTYPE mCommand = OMX_CommandStateSet;
+  OMX_U32 mParam = 0;
+
+  bool mDone = true;
+  OMX_ERRORTYPE mError = OMX_ErrorNone;
+  };
+//}}}
 //{{{
 class cOmxCore {
 public:
@@ -47,6 +76,8 @@ public:
 
   unsigned int getInputPort() const { return mInputPort; }
   unsigned int getOutputPort() const { return mOutputPort; }
+  cOmxCommand enablePortAsync (unsigned int port);
+  cOmxCommand disablePortAsync (unsigned int port);
   OMX_ERRORTYPE enablePort (unsigned int port, bool wait = true);
   OMX_ERRORTYPE disablePort (unsigned int port, bool wait = true);
   OMX_ERRORTYPE disableAllPorts();
@@ -76,14 +107,17 @@ public:
   void flushAll();
 
   OMX_ERRORTYPE addEvent (OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2);
-  void removeEvent(OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2);
+  void removeEvent (OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2);
   OMX_ERRORTYPE waitEvent (OMX_EVENTTYPE event, long timeout = 300);
+  bool isEventPending (OMX_EVENTTYPE event) const;
 
   OMX_ERRORTYPE sendCommand(OMX_COMMANDTYPE cmd, OMX_U32 cmdParam, OMX_PTR cmdParamData);
   OMX_ERRORTYPE waitCommand (OMX_U32 command, OMX_U32 nData2, long timeout = 2000);
 
   OMX_STATETYPE getState() const;
+  cOmxCommand setStateAsync (OMX_STATETYPE state);
   OMX_ERRORTYPE setState (OMX_STATETYPE state);
+  static OMX_ERRORTYPE setStates (const std::vector<cOmxCore*>& cores, OMX_STATETYPE state);
 
   OMX_ERRORTYPE getParam (OMX_INDEXTYPE paramIndex, OMX_PTR paramStruct) const;
   OMX_ERRORTYPE setParam (OMX_INDEXTYPE paramIndex, OMX_PTR paramStruct);
@@ -113,6 +147,36 @@ public:
   void ignoreNextError (OMX_S32 error) { mIgnoreError = error; }
 
 private:
+  //{{{
+  enum eEventSlot {
+  // events are routed by type at callback time, each type has its own slot, pending bit and cond,
+  // counted so repeats aren't merged, command and vendor slots queue events to match on
+    eSlotCommand = 0,
+    eSlotMark,
+    eSlotPortSettings,
+    eSlotBufferFlag,
+    eSlotResourcesAcquired,
+    eSlotComponentResumed,
+    eSlotDynamicResources,
+    eSlotPortFormat,
+    eSlotParamChanged,
+    eSlotVendor,
+    eNumSlots
+    };
+  //}}}
+  //{{{
+  class cWaiter {
+  // blocking wait in progress, an error arriving while it waits is handed to every waiter
+  public:
+    bool mHasError = false;
+    omxEvent mError;
+    };
+  //}}}
+  static int getEventSlot (OMX_EVENTTYPE eEvent);
+  static OMX_ERRORTYPE getErrorResult (const omxEvent& event);
+  bool takeSlotEvent (int slot, OMX_EVENTTYPE eEvent);
+  void removeWaiter (cWaiter* waiter);
+
   void transitionToStateLoaded();
 
   OMX_HANDLETYPE mHandle = nullptr;
@@ -122,7 +186,12 @@ private:
   unsigned int mOutputPort = 0;
 
   pthread_mutex_t mEventMutex;
-  std::vector<omxEvent> mEvents;
+  pthread_cond_t mEventConds[eNumSlots];
+  std::atomic<uint32_t> mEventPending; // bit per slot, written under mEventMutex, read lock free
+  int mEventCounts[eNumSlots] = { 0 };
+  std::vector<omxEvent> mCommandEvents;
+  std::vector<omxEvent> mVendorEvents;
+  std::vector<cWaiter*> mWaiters;
   OMX_S32 mIgnoreError = OMX_ErrorNone;
 
   OMX_CALLBACKTYPE mCallbacks;
@@ -147,7 +216,6 @@ private:
 
   pthread_cond_t mInputBufferCond;
   pthread_cond_t mOutputBufferCond;
-  pthread_cond_t mEventCond;
 
   bool mFlushInput = false;
   bool mFlushOutput = false;
@@ -178,12 +246,16 @@ public:
     if (!mSrcComponent || !mDstComponent)
       return OMX_ErrorUndefined;
 
-    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
-    OMX_PARAM_U32TYPE param;
-    OMX_INIT_STRUCTURE(param);
+    if (!mSrcComponent->getHandle() || !mDstComponent->getHandle()) {
+      //{{{  error return
+      cLog::log (LOGERROR, "cOmxTunnel::establish could not setup tunnel");
+      return OMX_ErrorUndefined;
+      }
+      //}}}
 
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
     if (mSrcComponent->getState() == OMX_StateLoaded) {
-      //{{{
+      //{{{  src to idle
       omxErr = mSrcComponent->setState (OMX_StateIdle);
       if (omxErr) {
         cLog::log (LOGERROR, "cOmxTunnel::establish - setting state to idle %s 0x%08x",
@@ -192,111 +264,93 @@ public:
         }
       }
       //}}}
-    if (mSrcComponent->getHandle() && disablePorts) {
-      //{{{
-      omxErr = mSrcComponent->disablePort (mSrcPort, false);
-      if (omxErr)
-        cLog::log (LOGERROR, "cOmxTunnel::establish - disable port %d %s 0x%08x",
-                             mSrcPort, mSrcComponent->getName().c_str(), (int)omxErr);
-      }
-      //}}}
-    if (mDstComponent->getHandle() && disablePorts) {
-      //{{{
-      omxErr = mDstComponent->disablePort (mDstPort, false);
-      if (omxErr)
-        cLog::log (LOGERROR, "cOmxTunnel::establish - disable port %d %s 0x%08x",
-                             mDstPort, mDstComponent->getName().c_str(), (int)omxErr);
-      }
-      //}}}
-    if (mSrcComponent->getHandle() && disablePorts) {
-      //{{{
-      omxErr = mSrcComponent->waitCommand (OMX_CommandPortDisable, mSrcPort);
+    if (disablePorts) {
+      //{{{  disable both ports together
+      std::vector<cOmxCommand> disables = { mSrcComponent->disablePortAsync (mSrcPort),
+                                            mDstComponent->disablePortAsync (mDstPort) };
+      omxErr = cOmxCommand::waitAll (disables);
       if (omxErr) {
-        cLog::log (LOGERROR, "cOmxTunnel::establish - waitCommand port %d %s 0x%08x",
-                             mDstPort, mSrcComponent->getName().c_str(), (int)omxErr);
+        cLog::log (LOGERROR, "cOmxTunnel::establish - disable ports %s>%s 0x%08x",
+                             mSrcComponent->getName().c_str(), mDstComponent->getName().c_str(), (int)omxErr);
         return omxErr;
         }
       }
       //}}}
-    if (mDstComponent->getHandle() && disablePorts) {
-      //{{{
-      omxErr = mDstComponent->waitCommand (OMX_CommandPortDisable, mDstPort);
-      if (omxErr) {
-        cLog::log (LOGERROR, "cOmxTunnel::establish - waitCommand port %d %s 0x%08x",
-                             mDstPort, mDstComponent->getName().c_str(), (int)omxErr);
-        return omxErr;
+
+    omxErr = setupTunnel();
+    if (omxErr)
+      return omxErr;
+
+    if (enablePorts) {
+      //{{{  enable both ports together, dst to idle once its port is enabled
+      auto srcEnable = mSrcComponent->enablePortAsync (mSrcPort);
+      auto dstEnable = mDstComponent->enablePortAsync (mDstPort);
+
+      omxErr = dstEnable.wait();
+      if (!omxErr && (mDstComponent->getState() == OMX_StateLoaded)) {
+        omxErr = mDstComponent->setState (OMX_StateIdle);
+        if (omxErr)
+          cLog::log (LOGERROR, "cOmxTunnel::establish - setting state to idle %s 0x%08x",
+                               mDstComponent->getName().c_str(), (int)omxErr);
         }
+
+      auto srcErr = srcEnable.wait();
+      if (srcErr)
+        cLog::log (LOGERROR, "cOmxTunnel::establish - enable port %d %s 0x%08x",
+                             mSrcPort, mSrcComponent->getName().c_str(), (int)srcErr);
+      if (!omxErr)
+        omxErr = srcErr;
       }
       //}}}
-    if (mSrcComponent->getHandle() && mDstComponent->getHandle()) {
-      //{{{
-      omxErr = OMX_SetupTunnel (mSrcComponent->getHandle(), mSrcPort,
-                                mDstComponent->getHandle(), mDstPort);
-      if (omxErr) {
-        cLog::log (LOGERROR, "cOmxTunnel::establish - setup tunnel src %s port %d dst %s port %d 0x%08x\n",
-                             mSrcComponent->getName().c_str(), mSrcPort,
-                             mDstComponent->getName().c_str(), mDstPort, (int)omxErr);
-        return omxErr;
+
+    return omxErr;
+    }
+  //}}}
+  //{{{
+  static OMX_ERRORTYPE establishAll (const std::vector<cOmxTunnel*>& tunnels) {
+  // establish tunnels together, loaded components go idle together,
+  // - every port enable is sent before waiting, so components negotiate buffers concurrently
+
+    std::vector<cOmxCore*> loaded;
+    for (auto tunnel : tunnels) {
+      if (!tunnel->mSrcComponent || !tunnel->mDstComponent ||
+          !tunnel->mSrcComponent->getHandle() || !tunnel->mDstComponent->getHandle()) {
+        //{{{  error return
+        cLog::log (LOGERROR, "cOmxTunnel::establishAll could not setup tunnel");
+        return OMX_ErrorUndefined;
         }
+        //}}}
+      for (auto component : { tunnel->mSrcComponent, tunnel->mDstComponent })
+        if ((component->getState() == OMX_StateLoaded) &&
+            (std::find (loaded.begin(), loaded.end(), component) == loaded.end()))
+          loaded.push_back (component);
       }
-      //}}}
-    else {
+
+    auto omxErr = cOmxCore::setStates (loaded, OMX_StateIdle);
+    if (omxErr) {
       //{{{  error return
-      cLog::log (LOGERROR, "cOmxTunnel::Establish could not setup tunnel\n");
-      return OMX_ErrorUndefined;
+      cLog::log (LOGERROR, "cOmxTunnel::establishAll - setting state to idle 0x%08x", (int)omxErr);
+      return omxErr;
       }
       //}}}
 
-    mTunnelSet = true;
-
-    if (mSrcComponent->getHandle() && enablePorts) {
-      //{{{
-      omxErr = mSrcComponent->enablePort (mSrcPort, false);
-      if (omxErr) {
-        cLog::log (LOGERROR, "cOmxTunnel::establish - enable port %d %s 0x%08x",
-                             mSrcPort, mSrcComponent->getName().c_str(), (int)omxErr);
-        return omxErr;
-        }
-      }
-      //}}}
-    if (mDstComponent->getHandle() && enablePorts) {
-      //{{{
-      omxErr = mDstComponent->enablePort (mDstPort, false);
-      if (omxErr) {
-        cLog::log (LOGERROR, "cOmxTunnel::establish - enable port %d %s 0x%08x",
-                             mDstPort, mDstComponent->getName().c_str(), (int)omxErr);
-        return omxErr;
-        }
-      }
-      //}}}
-    if (mDstComponent->getHandle() && enablePorts) {
-      //{{{
-      omxErr = mDstComponent->waitCommand(OMX_CommandPortEnable, mDstPort);
+    for (auto tunnel : tunnels) {
+      omxErr = tunnel->setupTunnel();
       if (omxErr)
         return omxErr;
-
-      if (mDstComponent->getState() == OMX_StateLoaded) {
-        omxErr = mDstComponent->setState (OMX_StateIdle);
-        if (omxErr) {
-          cLog::log (LOGERROR, "cOmxCore::establish - setting state to idle %s 0x%08x",
-                               mSrcComponent->getName().c_str(), (int)omxErr);
-          return omxErr;
-          }
-        }
       }
-      //}}}
-    if (mSrcComponent->getHandle() && enablePorts) {
-      //{{{
-      omxErr = mSrcComponent->waitCommand (OMX_CommandPortEnable, mSrcPort);
-      if (omxErr) {
-       cLog::log (LOGERROR, "cOmxCore::establish - %s waitCommand srcPort %d 0x%08x",
-                            mSrcComponent->getName().c_str(), mSrcPort, (int)omxErr);
-        return omxErr;
-        }
+
+    std::vector<cOmxCommand> enables;
+    for (auto tunnel : tunnels) {
+      enables.push_back (tunnel->mSrcComponent->enablePortAsync (tunnel->mSrcPort));
+      enables.push_back (tunnel->mDstComponent->enablePortAsync (tunnel->mDstPort));
       }
-      //}}}
 
-    return OMX_ErrorNone;
+    omxErr = cOmxCommand::waitAll (enables);
+    if (omxErr)
+      cLog::log (LOGERROR, "cOmxTunnel::establishAll - enable ports 0x%08x", (int)omxErr);
+
+    return omxErr;
     }
   //}}}
   //{{{
@@ -305,34 +359,17 @@ public:
     if (!mSrcComponent || !mDstComponent || !isInit())
       return OMX_ErrorUndefined;
 
-    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
-    if (mSrcComponent->getHandle()) {
-      omxErr = mSrcComponent->disablePort (mSrcPort, false);
-      if (omxErr)
-        cLog::log (LOGERROR, std::string(__func__) + " " + mSrcComponent->getName() +
-                             " - disable srcPort:" + dec(mSrcPort) + " " + hex(omxErr));
-      }
+    // disable both ports together
+    std::vector<cOmxCommand> disables;
+    if (mSrcComponent->getHandle())
+      disables.push_back (mSrcComponent->disablePortAsync (mSrcPort));
+    if (mDstComponent->getHandle())
+      disables.push_back (mDstComponent->disablePortAsync (mDstPort));
 
-    if (mDstComponent->getHandle()) {
-      omxErr = mDstComponent->disablePort (mDstPort, false);
-      if (omxErr)
-        cLog::log (LOGERROR, std::string(__func__) + " " + mSrcComponent->getName() +
-                             " - disable dstPort:" + dec(mDstPort) + " " + hex(omxErr));
-      }
-
-    if (mSrcComponent->getHandle()) {
-      omxErr = mSrcComponent->waitCommand (OMX_CommandPortDisable, mSrcPort);
-      if (omxErr)
-        cLog::log (LOGERROR, std::string(__func__) + " " + mSrcComponent->getName() +
-                             " - waitCommand srcPort:" + dec(mSrcPort) + " " + hex(omxErr));
-      }
-
-    if (mDstComponent->getHandle()) {
-      omxErr = mDstComponent->waitCommand (OMX_CommandPortDisable, mDstPort);
-      if (omxErr)
-        cLog::log (LOGERROR, std::string(__func__) + " " + mSrcComponent->getName() +
-                             " - waitCommand dstPort:" + dec(mDstPort) + " " + hex(omxErr));
-      }
+    auto omxErr = cOmxCommand::waitAll (disables);
+    if (omxErr)
+      cLog::log (LOGERROR, std::string(__func__) + " " + mSrcComponent->getName() + ">" +
+                           mDstComponent->getName() + " - disable ports " + hex(omxErr));
 
     if (mSrcComponent->getHandle()) {
       omxErr = OMX_SetupTunnel (mSrcComponent->getHandle(), mSrcPort, NULL, 0);
@@ -354,6 +391,25 @@ public:
   //}}}
 
 private:
+  //{{{
+  OMX_ERRORTYPE setupTunnel() {
+
+    auto omxErr = OMX_SetupTunnel (mSrcComponent->getHandle(), mSrcPort,
+                                   mDstComponent->getHandle(), mDstPort);
+    if (omxErr) {
+      //{{{  error return
+      cLog::log (LOGERROR, "cOmxTunnel::setupTunnel - src %s port %d dst %s port %d 0x%08x",
+                           mSrcComponent->getName().c_str(), mSrcPort,
+                           mDstComponent->getName().c_str(), mDstPort, (int)omxErr);
+      return omxErr;
+      }
+      //}}}
+
+    mTunnelSet = true;
+    return OMX_ErrorNone;
+    }
+  //}}}
+
   cOmxCore* mSrcComponent = nullptr;
   cOmxCore* mDstComponent = nullptr;
 
@@ -10,6 +10,10 @@
 #include "../shared/utils/cLog.h"
 
 #include "cOmxClock.h"
+#include "cHttp.h"
+#include "cHls.h"
+#include "cRecorder.h"
+#include "cMemoryBudget.h"
 
 using namespace std;
 //}}}
@@ -36,6 +40,9 @@ typedef enum {
 int64_t timeoutStart;
 int64_t timeoutDefaultDuration;
 int64_t timeoutDuration;
+
+// raw input tee, the avio callbacks only see their reader
+cRecorder* inputRecorder = nullptr;
 //}}}
 //{{{
 class cFile {
@@ -174,7 +181,10 @@ int fileRead (void* h, uint8_t* buf, int size) {
     return -1;
 
   auto file = (cFile*)h;
-  return file->read (buf, size);
+  int bytes = file->read (buf, size);
+  if (inputRecorder && (bytes > 0))
+    inputRecorder->write (buf, bytes);
+  return bytes;
   }
 //}}}
 //{{{
@@ -194,6 +204,48 @@ offset_t fileSeek (void* h, offset_t pos, int whence) {
     return file->seek (pos, whence & ~AVSEEK_FORCE);
   }
 //}}}
+//{{{
+int httpRead (void* h, uint8_t* buf, int size) {
+
+  cLog::log (LOGINFO2, "httpRead %d", size);
+  timeoutStart = currentHostCounter();
+  timeoutDuration = timeoutDefaultDuration;
+
+  auto http = (cHttpReader*)h;
+  int bytes = http->read (buf, size);
+  if (inputRecorder && (bytes > 0))
+    inputRecorder->write (buf, bytes);
+  return bytes;
+  }
+//}}}
+//{{{
+offset_t httpSeek (void* h, offset_t pos, int whence) {
+
+  cLog::log (LOGINFO2, "httpSeek %d %d", pos, whence);
+  timeoutStart = currentHostCounter();
+  timeoutDuration = timeoutDefaultDuration;
+
+  auto http = (cHttpReader*)h;
+  if (whence == AVSEEK_SIZE)
+    return http->getLength();
+  else
+    return http->seek (pos, whence & ~AVSEEK_FORCE);
+  }
+//}}}
+//{{{
+int hlsRead (void* h, uint8_t* buf, int size) {
+
+  cLog::log (LOGINFO2, "hlsRead %d", size);
+  timeoutStart = currentHostCounter();
+  timeoutDuration = timeoutDefaultDuration;
+
+  auto hls = (cHlsReader*)h;
+  int bytes = hls->read (buf, size);
+  if (inputRecorder && (bytes > 0))
+    inputRecorder->write (buf, bytes);
+  return bytes;
+  }
+//}}}
 
 // cOmxReader
 //{{{
@@ -202,6 +254,7 @@ cOmxReader::cOmxReader() {
   for (int i = 0; i < MAX_STREAMS; i++)
     mStreams[i].extradata = NULL;
 
+  mSeekTargetPts = kNoPts;
   clearStreams();
   }
 //}}}
@@ -462,6 +515,24 @@ AVMediaType cOmxReader::getPacketType (cOmxPacket* packet) {
     AVMEDIA_TYPE_UNKNOWN : mAvFormatContext->streams[packet->mStreamIndex]->codec->codec_type;
   }
 //}}}
+//{{{
+double cOmxReader::getBitrate (int streamIndex) {
+// bytes per sec of stream, measured or codec nominal until measured, 0 if unknown
+
+  if ((streamIndex < 0) || (streamIndex >= MAX_OMX_STREAMS))
+    return 0.0;
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+
+  if (mBitrate[streamIndex] > 0.0)
+    return mBitrate[streamIndex];
+
+  if (mAvFormatContext && (streamIndex < (int)mAvFormatContext->nb_streams))
+    return mAvFormatContext->streams[streamIndex]->codec->bit_rate / 8.0;
+
+  return 0.0;
+  }
+//}}}
 
 // sets
 //{{{
@@ -512,6 +583,15 @@ bool cOmxReader::setActiveStream (OMXStreamType type, unsigned int index) {
   return setActiveStreamInternal (type, index);
   }
 //}}}
+//{{{
+void cOmxReader::setRecorder (cRecorder* recorder) {
+// raw recorder tees input bytes from our avio callbacks, else its stream's packets, nullptr stops
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+  inputRecorder = (recorder && recorder->isRaw()) ? recorder : nullptr;
+  mStreamRecorder = (recorder && !recorder->isRaw()) ? recorder : nullptr;
+  }
+//}}}
 
 // actions
 //{{{
@@ -521,6 +601,7 @@ bool cOmxReader::open (const string& filename, bool dumpFormat, bool live, float
 
   timeoutDefaultDuration = (int64_t) (timeout * 1e9);
   mCurPts = kNoPts;
+  mSeekTargetPts = kNoPts;
   mFilename = filename;
   mSpeed = 1.0;
   mProgram = UINT_MAX;
@@ -561,11 +642,34 @@ bool cOmxReader::open (const string& filename, bool dumpFormat, bool live, float
   mAvFormatContext->interrupt_callback = intCb;
   mAvFormatContext->flags |= AVFMT_FLAG_NONBLOCK;
 
-  if (mFilename.substr (0,7) == "http://" ||
-      mFilename.substr (0,8) == "https://" ||
-      mFilename.substr (0,7) == "rtmp://" ||
-      mFilename.substr (0,7) == "rtsp://") {
+  if (cHlsReader::isHls (mFilename)) {
+    //{{{  try our own hls segment prefetch, else leave it to ffmpeg
+    mHls = new cHlsReader();
+    if (!mHls->open (mFilename)) {
+      delete mHls;
+      mHls = nullptr;
+      }
+    }
+    //}}}
+  else if ((mFilename.substr (0,7) == "http://") && !live) {
+    //{{{  try parallel range prefetch, else leave it to ffmpeg
+    mHttp = new cHttpReader();
+    if (!mHttp->open (mFilename)) {
+      delete mHttp;
+      mHttp = nullptr;
+      }
+    }
+    //}}}
+
+  if (!mHttp && !mHls &&
+      (mFilename.substr (0,7) == "http://" ||
+       mFilename.substr (0,8) == "https://" ||
+       mFilename.substr (0,7) == "rtmp://" ||
+       mFilename.substr (0,7) == "rtsp://")) {
     //{{{  non file input
+    if (inputRecorder)
+      cLog::log (LOGERROR, "cOmxReader::Open ffmpeg reads " + mFilename + " itself, nothing for raw recorder");
+
     // ffmpeg dislikes the useragent from AirPlay urls
     //int idx = m_filename.Find("|User-Agent=AppleCoreMedia");
     size_t idx = mFilename.find ("|");
@@ -601,25 +705,39 @@ bool cOmxReader::open (const string& filename, bool dumpFormat, bool live, float
     }
     //}}}
   else {
-    //{{{  file input
-    mFile = new cFile();
-    if (!mFile->open (mFilename, flags)) {
-      //{{{  error, return
-      cLog::log (LOGERROR, "cOmxReader::Open " + mFilename);
-      close();
-      return false;
+    //{{{  file, prefetched http or hls input
+    if (mHls) {
+      // continuous ts from segments, not byte seekable, seek by segment
+      buffer = (unsigned char*)mAvUtil.av_malloc (FFMPEG_FILE_BUFFER_SIZE);
+      mIoContext = mAvFormat.avio_alloc_context (
+        buffer, FFMPEG_FILE_BUFFER_SIZE, 0, mHls, hlsRead, NULL, NULL);
       }
-      //}}}
+    else if (mHttp) {
+      buffer = (unsigned char*)mAvUtil.av_malloc (FFMPEG_FILE_BUFFER_SIZE);
+      mIoContext = mAvFormat.avio_alloc_context (
+        buffer, FFMPEG_FILE_BUFFER_SIZE, 0, mHttp, httpRead, NULL, httpSeek);
+      }
+    else {
+      mFile = new cFile();
+      if (!mFile->open (mFilename, flags)) {
+        //{{{  error, return
+        cLog::log (LOGERROR, "cOmxReader::Open " + mFilename);
+        close();
+        return false;
+        }
+        //}}}
 
-    buffer = (unsigned char*)mAvUtil.av_malloc (FFMPEG_FILE_BUFFER_SIZE);
-    mIoContext = mAvFormat.avio_alloc_context (
-      buffer, FFMPEG_FILE_BUFFER_SIZE, 0, mFile, fileRead, NULL, fileSeek);
+      buffer = (unsigned char*)mAvUtil.av_malloc (FFMPEG_FILE_BUFFER_SIZE);
+      mIoContext = mAvFormat.avio_alloc_context (
+        buffer, FFMPEG_FILE_BUFFER_SIZE, 0, mFile, fileRead, NULL, fileSeek);
+      }
+    cMemoryBudget::get().alloc (cMemoryBudget::eReader, FFMPEG_FILE_BUFFER_SIZE);
     mIoContext->max_packet_size = 6144;
 
     if (mIoContext->max_packet_size)
       mIoContext->max_packet_size *= FFMPEG_FILE_BUFFER_SIZE / mIoContext->max_packet_size;
 
-    if (mFile->ioControl (IOCTRL_SEEK_POSSIBLE, NULL) == 0)
+    if (mHls || (mFile && (mFile->ioControl (IOCTRL_SEEK_POSSIBLE, NULL) == 0)))
       mIoContext->seekable = 0;
 
     mAvFormat.av_probe_input_buffer (mIoContext, &iformat, mFilename.c_str(), NULL, 0, 0);
@@ -645,6 +763,9 @@ bool cOmxReader::open (const string& filename, bool dumpFormat, bool live, float
   if (live)
     mAvFormatContext->flags |= AVFMT_FLAG_NOBUFFER;
 
+  if (mHls && !mHls->isLive())
+    mAvFormatContext->duration = (int64_t)(mHls->getDuration() * AV_TIME_BASE);
+
   if ((mAvFormat.avformat_find_stream_info (mAvFormatContext, NULL) < 0) || !getStreams()) {
     //{{{  no streams, exit, return
     close();
@@ -664,6 +785,44 @@ bool cOmxReader::open (const string& filename, bool dumpFormat, bool live, float
 //}}}
 //{{{
 cOmxPacket* cOmxReader::readPacket() {
+// after accurate seek, mark video before target decode only, drop everything else before target
+
+  while (true) {
+    auto packet = readAvPacket();
+    if (!packet || (mSeekTargetPts == kNoPts))
+      return packet;
+
+    double pts = (packet->mPts != kNoPts) ? packet->mPts : packet->mDts;
+    if (pts == kNoPts)
+      return packet;
+
+    bool video = packet->mCodecType == AVMEDIA_TYPE_VIDEO;
+    if (pts < mSeekTargetPts) {
+      if (video) {
+        packet->mDecodeOnly = true;
+        mDecodeOnlyPackets++;
+        mDecodeOnlyBytes += packet->mSize;
+        return packet;
+        }
+      mDroppedPackets++;
+      delete (packet);
+      continue;
+      }
+
+    // reordered video can still be before target for a few frames, window closes well after
+    if ((video && (pts > mSeekTargetPts + kPtsScale)) || (!mVideoCount && (pts >= mSeekTargetPts))) {
+      cLog::log (LOGINFO, "cOmxReader::readPacket accurate seek " + frac(mSeekTargetPts / kPtsScale, 6,2,' ') +
+                          " decodeOnly:" + dec(mDecodeOnlyPackets) + " " + dec(mDecodeOnlyBytes / 1024) + "k" +
+                          " dropped:" + dec(mDroppedPackets));
+      mSeekTargetPts = kNoPts;
+      }
+
+    return packet;
+    }
+  }
+//}}}
+//{{{
+cOmxPacket* cOmxReader::readAvPacket() {
 
   if (mEof)
     return nullptr;
@@ -705,10 +864,14 @@ cOmxPacket* cOmxReader::readPacket() {
   packet->mCodecType = stream->codec->codec_type;
   memcpy (packet->mData, avPacket.data, packet->mSize);
   packet->mStreamIndex = avPacket.stream_index;
+  packet->mKeyFrame = (avPacket.flags & AV_PKT_FLAG_KEY) != 0;
+  if (mStreamRecorder && (mStreamRecorder->getStreamIndex() == packet->mStreamIndex))
+    mStreamRecorder->write (packet->mData, packet->mSize);
   getHints (stream, &packet->mHints);
   packet->mDts = convertTimestamp (avPacket.dts, stream->time_base.den, stream->time_base.num);
   packet->mPts = convertTimestamp (avPacket.pts, stream->time_base.den, stream->time_base.num);
   packet->mDuration = ((double)avPacket.duration * stream->time_base.num / stream->time_base.den) * kPtsScale;
+  updateBitrate (packet->mStreamIndex, packet->mSize, (packet->mDts != kNoPts) ? packet->mDts : packet->mPts);
 
   // used to guess streamlength
   if ((packet->mDts != kNoPts) &&
@@ -735,7 +898,8 @@ cOmxPacket* cOmxReader::readPacket() {
   }
 //}}}
 //{{{
-bool cOmxReader::seek (float time, double& startPts) {
+bool cOmxReader::seek (float time, double& startPts, bool accurate) {
+// accurate, land on keyframe before time, readPacket then decodes up to time without presenting
 
   // secs to ms
   time *= 1000;
@@ -744,7 +908,7 @@ bool cOmxReader::seek (float time, double& startPts) {
   if (backwards)
     time = -time;
 
-  if (mFile && !mFile->ioControl (IOCTRL_SEEK_POSSIBLE, NULL)) {
+  if ((mFile && !mFile->ioControl (IOCTRL_SEEK_POSSIBLE, NULL)) || (mHls && mHls->isLive())) {
     cLog::log (LOGERROR, "cOmxReader::seek - not seekable");
     return false;
     }
@@ -758,16 +922,43 @@ bool cOmxReader::seek (float time, double& startPts) {
   if (mAvFormatContext->start_time != (int64_t)AV_NOPTS_VALUE)
     seekPts += mAvFormatContext->start_time;
 
+  // hls rewrites time to its segment start, accurate seek still targets the requested time
+  auto targetPts = time * kPtsScale / 1000.0;
+
   timeoutStart = currentHostCounter();
   timeoutDuration = timeoutDefaultDuration;
-  auto ret = mAvFormat.av_seek_frame (mAvFormatContext, -1, seekPts, backwards ? AVSEEK_FLAG_BACKWARD : 0);
-  if (ret >= 0)
-    updateCurrentPTS();
+  int ret;
+  if (mHls) {
+    //{{{  seek by segment, flush demuxer so no pes or parser state from the old segment leaks into the new
+    double segmentSecs = mHls->seekTime (time / 1000.0);
+    ret = (segmentSecs < 0.0) ? -1 : 0;
+    if (ret >= 0) {
+      time = (float)(segmentSecs * 1000.0);
+      mIoContext->eof_reached = 0;
+      mAvFormat.avformat_flush (mAvFormatContext);
+      mCurPts = kNoPts;
+      }
+    }
+    //}}}
+  else {
+    ret = mAvFormat.av_seek_frame (mAvFormatContext, -1, seekPts, (backwards || accurate) ? AVSEEK_FLAG_BACKWARD : 0);
+    if (ret >= 0)
+      updateCurrentPTS();
+    }
+
+  // keep bitrate estimates, restart their windows
+  for (int i = 0; i < MAX_OMX_STREAMS; i++)
+    mBitrateStartPts[i] = kNoPts;
 
   // in this case the start time is requested time
   if (startPts)
     startPts = time * kPtsScale / 1000.0;
 
+  mSeekTargetPts = (accurate && (ret >= 0)) ? targetPts : kNoPts;
+  mDecodeOnlyPackets = 0;
+  mDecodeOnlyBytes = 0;
+  mDroppedPackets = 0;
+
   // demuxer will return failure, if you seek to eof
   mEof = false;
   if (ret < 0) {
@@ -819,6 +1010,12 @@ void cOmxReader::clearStreams() {
     mStreams[i].id = 0;
     }
 
+  for (int i = 0; i < MAX_OMX_STREAMS; i++) {
+    mBitrate[i] = 0.0;
+    mBitrateStartPts[i] = kNoPts;
+    mBitrateBytes[i] = 0;
+    }
+
   mProgram = UINT_MAX;
   }
 //}}}
@@ -836,6 +1033,7 @@ bool cOmxReader::close() {
   if (mIoContext) {
     mAvUtil.av_free (mIoContext->buffer);
     mAvUtil.av_free (mIoContext);
+    cMemoryBudget::get().free (cMemoryBudget::eReader, FFMPEG_FILE_BUFFER_SIZE);
     }
 
   mIoContext = NULL;
@@ -844,6 +1042,12 @@ bool cOmxReader::close() {
   delete mFile;
   mFile = NULL;
 
+  delete mHttp;
+  mHttp = nullptr;
+
+  delete mHls;
+  mHls = nullptr;
+
   mAvFormat.avformat_network_deinit();
 
   mFilename = "";
@@ -972,6 +1176,30 @@ double cOmxReader::convertTimestamp (int64_t pts, int den, int num) {
   }
 //}}}
 //{{{
+void cOmxReader::updateBitrate (int streamIndex, int size, double pts) {
+
+  if (pts == kNoPts)
+    return;
+
+  if ((mBitrateStartPts[streamIndex] == kNoPts) || (pts < mBitrateStartPts[streamIndex])) {
+    // start new window, discontinuity or first packet
+    mBitrateStartPts[streamIndex] = pts;
+    mBitrateBytes[streamIndex] = 0;
+    return;
+    }
+
+  mBitrateBytes[streamIndex] += size;
+  double secs = (pts - mBitrateStartPts[streamIndex]) / kPtsScale;
+  if (secs >= 1.0) {
+    double bitrate = mBitrateBytes[streamIndex] / secs;
+    mBitrate[streamIndex] = (mBitrate[streamIndex] > 0.0) ?
+      mBitrate[streamIndex] + (bitrate - mBitrate[streamIndex]) * 0.25 : bitrate;
+    mBitrateStartPts[streamIndex] = pts;
+    mBitrateBytes[streamIndex] = 0;
+    }
+  }
+//}}}
+//{{{
 bool cOmxReader::setActiveStreamInternal (OMXStreamType type, unsigned int index) {
 
   bool ret = false;
@@ -68,10 +68,16 @@ public:
   int mStreamIndex;
   cOmxStreamInfo mHints;
   enum AVMediaType mCodecType;
+
+  bool mDecodeOnly = false; // accurate seek, decode for reference but don't present
+  bool mKeyFrame = false;   // demuxer says decoding can start here
   };
 //}}}
 
 class cFile;
+class cHttpReader;
+class cHlsReader;
+class cRecorder;
 class cOmxReader {
 public:
   cOmxReader();
@@ -104,18 +110,20 @@ public:
   bool getHints (OMXStreamType type, unsigned int index, cOmxStreamInfo& hints);
   bool getHints (OMXStreamType type, cOmxStreamInfo& hints);
   AVMediaType getPacketType (cOmxPacket* packet);
+  double getBitrate (int streamIndex);
 
   // sets
   void setSpeed (double speed);
   double selectAspect (AVStream* st, bool& forced);
   bool setActiveStream (OMXStreamType type, unsigned int index);
+  void setRecorder (cRecorder* recorder);
 
   // actions
   bool open (const std::string& filename, bool dumpFormat, bool live, float timeout,
              const std::string& cookie, const std::string& user_agent,
              const std::string& lavfdopts, const std::string& avdict);
   cOmxPacket* readPacket();
-  bool seek (float time, double& startPts);
+  bool seek (float time, double& startPts, bool accurate = false);
   void updateCurrentPTS();
   void clearStreams();
   bool close();
@@ -125,14 +133,19 @@ private:
   void addStream (int id);
 
   double convertTimestamp (int64_t pts, int den, int num);
+  void updateBitrate (int streamIndex, int size, double pts);
   bool setActiveStreamInternal (OMXStreamType type, unsigned int index);
+  cOmxPacket* readAvPacket();
 
   //{{{  vars
   std::recursive_mutex mMutex;
 
   std::string mFilename;
   cFile* mFile = nullptr;
+  cHttpReader* mHttp = nullptr;
+  cHlsReader* mHls = nullptr;
   bool mEof = false;
+  cRecorder* mStreamRecorder = nullptr;
 
   AVIOContext* mIoContext = nullptr;
   AVFormatContext* mAvFormatContext = nullptr;
@@ -155,5 +168,16 @@ private:
   int mWidth = 0;
   int mHeight = 0;
   bool mSeek = false;
+
+  // accurate seek, packets before target are decode only video or dropped
+  double mSeekTargetPts;
+  int mDecodeOnlyPackets = 0;
+  int mDecodeOnlyBytes = 0;
+  int mDroppedPackets = 0;
+
+  // running bytes per sec estimate per stream, over ~1s windows of stream time
+  double mBitrate[MAX_OMX_STREAMS];
+  double mBitrateStartPts[MAX_OMX_STREAMS];
+  int64_t mBitrateBytes[MAX_OMX_STREAMS];
   };
   //}}}
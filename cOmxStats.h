@@ -0,0 +1,164 @@
+// cOmxStats.h - versioned live stats block in shared memory, single writer seqlock, lock free readers
+//{{{  includes
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <atomic>
+//}}}
+
+const char* const kOmxStatsName = "/omxStats";
+const uint32_t kOmxStatsMagic = 0x5378436F; // "oCxS"
+const uint32_t kOmxStatsVersion = 1;
+
+//{{{
+class cOmxStatsBlock {
+// layout shared with readers, only ever append fields and bump kOmxStatsVersion
+public:
+  uint32_t mMagic;
+  uint32_t mVersion;
+  uint32_t mSize;
+  std::atomic<uint32_t> mSeq; // odd while writer is updating
+
+  uint64_t mUpdates;
+
+  double mPlayPts;
+  double mLengthPts;
+
+  uint64_t mVideoPackets;
+  uint64_t mAudioPackets;
+  int32_t mVideoQueue;
+  int32_t mAudioQueue;
+  int32_t mVideoCacheBytes;
+  int32_t mAudioCacheBytes;
+  uint32_t mVideoInputSpace;
+  uint32_t mAudioInputSpace;
+
+  double mClockAdjustment;
+  double mAudioDelay;
+
+  uint8_t mVideoEos;
+  uint8_t mAudioEos;
+  uint8_t mPaused;
+  uint8_t mBuffering;
+  int32_t mStalls;
+  double mStallSecs;
+  };
+//}}}
+
+class cOmxStats {
+public:
+  //{{{
+  ~cOmxStats() {
+  // writer unlinks, a segment left behind would be reused stale by the next reader
+
+    if (mBlock)
+      munmap (mBlock, sizeof(cOmxStatsBlock));
+    if (mCreated)
+      shm_unlink (kOmxStatsName);
+    }
+  //}}}
+
+  //{{{
+  bool create() {
+  // writer, create or reuse segment and stamp header
+
+    if (mBlock)
+      return true;
+
+    int fd = shm_open (kOmxStatsName, O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+      return false;
+
+    bool ok = ftruncate (fd, sizeof(cOmxStatsBlock)) == 0;
+    if (ok) {
+      void* block = mmap (nullptr, sizeof(cOmxStatsBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (block != MAP_FAILED) {
+        mBlock = (cOmxStatsBlock*)block;
+        memset ((void*)mBlock, 0, sizeof(cOmxStatsBlock));
+        mBlock->mMagic = kOmxStatsMagic;
+        mBlock->mVersion = kOmxStatsVersion;
+        mBlock->mSize = sizeof(cOmxStatsBlock);
+        }
+      }
+    close (fd);
+
+    mCreated = mBlock != nullptr;
+    if (!mCreated)
+      shm_unlink (kOmxStatsName);
+
+    return mBlock != nullptr;
+    }
+  //}}}
+  //{{{
+  bool attach() {
+  // reader, map existing segment readonly, check header
+
+    int fd = shm_open (kOmxStatsName, O_RDONLY, 0);
+    if (fd < 0)
+      return false;
+
+    void* block = mmap (nullptr, sizeof(cOmxStatsBlock), PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (block == MAP_FAILED)
+      return false;
+
+    mBlock = (cOmxStatsBlock*)block;
+    if ((mBlock->mMagic != kOmxStatsMagic) || (mBlock->mVersion != kOmxStatsVersion) ||
+        (mBlock->mSize != sizeof(cOmxStatsBlock))) {
+      munmap (mBlock, sizeof(cOmxStatsBlock));
+      mBlock = nullptr;
+      }
+
+    return mBlock != nullptr;
+    }
+  //}}}
+
+  //{{{
+  cOmxStatsBlock* beginWrite() {
+  // single writer, seq odd while fields are changing
+
+    if (!mBlock)
+      return nullptr;
+
+    mBlock->mSeq.store (mBlock->mSeq.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+    return mBlock;
+    }
+  //}}}
+  //{{{
+  void endWrite() {
+
+    mBlock->mUpdates++;
+    mBlock->mSeq.store (mBlock->mSeq.load (std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+  //}}}
+  //{{{
+  bool read (cOmxStatsBlock& stats) {
+  // copy consistent snapshot, retry while writer is mid update
+
+    if (!mBlock)
+      return false;
+
+    for (int tries = 0; tries < 1000; tries++) {
+      uint32_t seq = mBlock->mSeq.load (std::memory_order_acquire);
+      if (seq & 1)
+        continue;
+
+      memcpy ((void*)&stats, (const void*)mBlock, sizeof(cOmxStatsBlock));
+      std::atomic_thread_fence (std::memory_order_acquire);
+      if (mBlock->mSeq.load (std::memory_order_relaxed) == seq)
+        return true;
+      }
+
+    return false;
+    }
+  //}}}
+
+private:
+  cOmxStatsBlock* mBlock = nullptr;
+  bool mCreated = false;
+  };
@@ -0,0 +1,475 @@
+// cOmxSwVideo.cpp - libavcodec video decode for codecs without a videocore decoder, frames into video_render
+//{{{  includes
+#include <unistd.h>
+#include <chrono>
+#include <map>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+#include "cOmxAv.h"
+
+using namespace std;
+//}}}
+
+// render holds one frame on screen, one queued, one being filled
+const int kRenderBuffers = 3;
+
+// late by more than this many frames, dropped rather than shown
+const double kLateFrames = 2.0;
+
+// session headroom by codec and size, so a later clip's log says what played before
+static map<string, double> headroomByCodec;
+
+//{{{
+static double getSecs() {
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+  }
+//}}}
+
+//{{{
+cOmxSwVideo::~cOmxSwVideo() {
+  close();
+  }
+//}}}
+
+//{{{
+string cOmxSwVideo::getDebugString() {
+
+  return "sw x" + frac(getHeadroom(), 4,2,' ') + (mLateFrames ? " late:" + dec(mLateFrames) : "");
+  }
+//}}}
+//{{{
+bool cOmxSwVideo::isEOS() {
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+  return mSubmittedEos && (!mRenderSetup || mFailedEos || mRender.isEOS());
+  }
+//}}}
+//{{{
+unsigned int cOmxSwVideo::getInputBufferSpace() {
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+  return mRenderSetup ? mRender.getInputBufferSpace() : 0;
+  }
+//}}}
+//{{{
+double cOmxSwVideo::getHeadroom() {
+
+  if (!mDecodedFrames || (mDecodeSecs <= 0.0))
+    return 0.0;
+
+  return (mDecodedFrames / mDecodeSecs) / mFps;
+  }
+//}}}
+
+//{{{
+bool cOmxSwVideo::open (cOmxClock* clock, const cOmxVideoConfig& config) {
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+
+  mClock = clock;
+  mConfig = config;
+  if ((mConfig.mHints.fpsrate > 0) && (mConfig.mHints.fpsscale > 0))
+    mFps = (double)mConfig.mHints.fpsrate / mConfig.mHints.fpsscale;
+
+  mAvCodec.avcodec_register_all();
+  //{{{  codecContext
+  auto codec = mAvCodec.avcodec_find_decoder (mConfig.mHints.codec);
+  if (!codec) {
+    // error return
+    cLog::log (LOGERROR, string(__func__) + " no sw codec " + dec(mConfig.mHints.codec));
+    return false;
+    }
+
+  mCodecContext = mAvCodec.avcodec_alloc_context3 (codec);
+  mCodecContext->width = mConfig.mHints.width;
+  mCodecContext->height = mConfig.mHints.height;
+
+  // every core, frame threads where the codec has them, slices otherwise
+  mCodecContext->thread_count = (int)sysconf (_SC_NPROCESSORS_ONLN);
+  mCodecContext->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+  if (mConfig.mHints.extradata && mConfig.mHints.extrasize > 0) {
+    mCodecContext->extradata_size = mConfig.mHints.extrasize;
+    mCodecContext->extradata = (uint8_t*)mAvUtil.av_mallocz (mConfig.mHints.extrasize + FF_INPUT_BUFFER_PADDING_SIZE);
+    memcpy (mCodecContext->extradata, mConfig.mHints.extradata, mConfig.mHints.extrasize);
+    }
+
+  if (mAvCodec.avcodec_open2 (mCodecContext, codec, NULL) < 0) {
+    // error return
+    cLog::log (LOGERROR, string(__func__) + " cannot open " + codec->name);
+    return false;
+    }
+  //}}}
+
+  mFrame = mAvCodec.av_frame_alloc();
+  mCodecName = string("sw-") + codec->name;
+
+  float aspect = mConfig.mHints.aspect ?
+    (float)mConfig.mHints.aspect / mConfig.mHints.width * mConfig.mHints.height : 1.f;
+  mPixelAspect = aspect / mConfig.mDisplayAspect;
+
+  cLog::log (LOGINFO, string(__func__) + " " + mCodecName + " threads:" + dec(mCodecContext->thread_count));
+  return true;
+  }
+//}}}
+//{{{
+bool cOmxSwVideo::decode (uint8_t* data, int size, double dts, double pts, bool decodeOnly, atomic<bool>& flushRequested) {
+
+  cLog::log (LOGINFO1, __func__ + frac(pts/1000000.0,6,2,' ') + " " + dec(size));
+
+  AVPacket avPacket;
+  mAvCodec.av_init_packet (&avPacket);
+  avPacket.data = data;
+  avPacket.size = size;
+  avPacket.pts = (pts != kNoPts) ? (int64_t)pts : AV_NOPTS_VALUE;
+  avPacket.dts = (dts != kNoPts) ? (int64_t)dts : AV_NOPTS_VALUE;
+
+  return decodePacket (&avPacket, decodeOnly, flushRequested);
+  }
+//}}}
+//{{{
+void cOmxSwVideo::submitEOS() {
+// drain frames held in the decoder threads, then eos through the render
+
+  cLog::log (LOGINFO1, __func__);
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+
+  AVPacket avPacket;
+  mAvCodec.av_init_packet (&avPacket);
+  avPacket.data = NULL;
+  avPacket.size = 0;
+  atomic<bool> flushRequested (false);
+  decodePacket (&avPacket, false, flushRequested);
+
+  mSubmittedEos = true;
+  mFailedEos = false;
+  if (!mRenderSetup)
+    return;
+
+  auto omxBuffer = mRender.getInputBuffer (1000);
+  if (omxBuffer == NULL) {
+    // error return
+    cLog::log (LOGERROR, string(__func__) + " getInputBuffer");
+    mFailedEos = true;
+    return;
+    }
+
+  omxBuffer->nOffset = 0;
+  omxBuffer->nFilledLen = 0;
+  omxBuffer->nTimeStamp = toOmxTime (0LL);
+  omxBuffer->nFlags = OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_EOS | OMX_BUFFERFLAG_TIME_UNKNOWN;
+  if (mRender.emptyThisBuffer (omxBuffer)) {
+    // error return
+    cLog::log (LOGERROR, string(__func__) + " emptyThisBuffer");
+    mRender.decoderEmptyBufferDone (mRender.getHandle(), omxBuffer);
+    mFailedEos = true;
+    }
+  }
+//}}}
+//{{{
+void cOmxSwVideo::reset() {
+
+  cLog::log (LOGINFO1, __func__);
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+
+  if (mCodecContext)
+    mAvCodec.avcodec_flush_buffers (mCodecContext);
+  if (mRenderSetup) {
+    mRender.flushInput();
+    mRender.resetEos();
+    }
+
+  // seek resets the clock, it may need starting again
+  mClockStarted = false;
+  mSubmittedEos = false;
+  }
+//}}}
+//{{{
+void cOmxSwVideo::close() {
+
+  cLog::log (LOGINFO1, __func__);
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+
+  if (mDecodedFrames) {
+    //{{{  report headroom, this clip and the session so far
+    double headroom = getHeadroom();
+    string key = mCodecName + " " + dec(mWidth) + "x" + dec(mHeight);
+    headroomByCodec[key] = headroom;
+
+    cLog::log (LOGNOTICE, "swVideo " + key +
+                          " decode " + frac(mDecodedFrames / mDecodeSecs, 5,1,' ') + "fps" +
+                          " stream " + frac(mFps, 5,2,' ') + "fps" +
+                          " headroom x" + frac(headroom, 4,2,' ') +
+                          (headroom < 1.0 ? " can't keep up" : "") +
+                          " late:" + dec(mLateFrames) + "/" + dec(mPresentedFrames + mLateFrames));
+    for (auto& item : headroomByCodec)
+      cLog::log (LOGNOTICE, "swVideo headroom " + item.first + " x" + frac(item.second, 4,2,' ') +
+                            (item.second < 1.0 ? " not realtime" : " realtime"));
+    }
+    //}}}
+
+  closeRender();
+
+  if (mSwsContext) {
+    mSwScale.sws_freeContext (mSwsContext);
+    mSwsContext = nullptr;
+    }
+  if (mFrame)
+    mAvUtil.av_frame_free (&mFrame);
+  if (mCodecContext) {
+    if (mCodecContext->extradata)
+      mAvUtil.av_free (mCodecContext->extradata);
+    mCodecContext->extradata = NULL;
+    mAvCodec.avcodec_close (mCodecContext);
+    mAvUtil.av_free (mCodecContext);
+    mCodecContext = nullptr;
+    }
+
+  mDecodedFrames = 0;
+  mDecodeSecs = 0.0;
+  mClock = NULL;
+  }
+//}}}
+
+// private
+//{{{
+bool cOmxSwVideo::decodePacket (AVPacket* avPacket, bool decodeOnly, atomic<bool>& flushRequested) {
+// frame threads give back an earlier packet's frame, decodeOnly rides along in reordered_opaque,
+// an empty packet drains
+
+  mCodecContext->reordered_opaque = decodeOnly;
+
+  while (true) {
+    int gotPicture = 0;
+    double startSecs = getSecs();
+    int bytes = mAvCodec.avcodec_decode_video2 (mCodecContext, mFrame, &gotPicture, avPacket);
+    mDecodeSecs += getSecs() - startSecs;
+
+    if (bytes < 0) {
+      // skip the packet, next keyframe recovers
+      cLog::log (LOGINFO1, string(__func__) + " decode error " + dec(bytes));
+      return true;
+      }
+    if (!gotPicture)
+      return true;
+
+    mDecodedFrames++;
+    if (!mFrame->reordered_opaque) {
+      int64_t framePts = (mFrame->pkt_pts != AV_NOPTS_VALUE) ? mFrame->pkt_pts : mFrame->pkt_dts;
+      if (!present (mFrame, (framePts != AV_NOPTS_VALUE) ? (double)framePts : kNoPts, flushRequested))
+        return false;
+      }
+
+    if (avPacket->size || flushRequested)
+      return true;
+    }
+  }
+//}}}
+//{{{
+bool cOmxSwVideo::present (AVFrame* frame, double pts, atomic<bool>& flushRequested) {
+
+  if (!mRenderSetup || (frame->width != mWidth) || (frame->height != mHeight))
+    if (!setupRender (frame->width, frame->height))
+      return false;
+
+  if (pts != kNoPts) {
+    if (!mClockStarted) {
+      // nothing tunnelled to start the clock, start it from our first frame
+      if (!mClock->hasStartWaiters() && !mClock->isRunning())
+        mClock->start (pts);
+      mClockStarted = true;
+      }
+    //{{{  wait until due on the clock, drop if too late
+    bool running = false;
+    while (true) {
+      if (flushRequested)
+        return true;
+
+      if (!running && !(running = mClock->isRunning())) {
+        mClock->msSleep (10);
+        continue;
+        }
+
+      double lead = pts - mClock->getMediaTime();
+      if (lead < -kLateFrames * kPtsScale / mFps) {
+        mLateFrames++;
+        return true;
+        }
+      if (lead <= 0.0)
+        break;
+      mClock->msSleep ((unsigned int)min (10.0, lead / 1000.0) + 1);
+      }
+    //}}}
+    }
+
+  // wait for a free render buffer outside the lock, stats read the space ten times a second
+  for (int waits = 0; !getInputBufferSpace() && (waits < 50); waits++) {
+    mClock->msSleep (10);
+    if (flushRequested)
+      return true;
+    }
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+
+  auto buffer = mRender.getInputBuffer (0);
+  if (!buffer) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " timeout");
+    return false;
+    }
+    //}}}
+
+  uint8_t* dstY = buffer->pBuffer;
+  uint8_t* dstU = dstY + (mStride * mSliceHeight);
+  uint8_t* dstV = dstU + ((mStride / 2) * (mSliceHeight / 2));
+
+  if ((frame->format == AV_PIX_FMT_YUV420P) || (frame->format == AV_PIX_FMT_YUVJ420P)) {
+    //{{{  copy planes to render stride
+    for (int row = 0; row < frame->height; row++)
+      memcpy (dstY + (row * mStride), frame->data[0] + (row * frame->linesize[0]), frame->width);
+
+    for (int row = 0; row < (frame->height + 1) / 2; row++) {
+      memcpy (dstU + (row * mStride / 2), frame->data[1] + (row * frame->linesize[1]), (frame->width + 1) / 2);
+      memcpy (dstV + (row * mStride / 2), frame->data[2] + (row * frame->linesize[2]), (frame->width + 1) / 2);
+      }
+    }
+    //}}}
+  else {
+    //{{{  convert, 10 bit, 422, nv12 and friends
+    mSwsContext = mSwScale.sws_getCachedContext (mSwsContext,
+      frame->width, frame->height, (AVPixelFormat)frame->format,
+      frame->width, frame->height, AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    if (!mSwsContext) {
+      cLog::log (LOGERROR, string(__func__) + " no conversion from format " + dec(frame->format));
+      mRender.decoderEmptyBufferDone (mRender.getHandle(), buffer);
+      return false;
+      }
+
+    uint8_t* dst[4] = { dstY, dstU, dstV, NULL };
+    int dstStride[4] = { mStride, mStride / 2, mStride / 2, 0 };
+    mSwScale.sws_scale (mSwsContext, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+    }
+    //}}}
+
+  buffer->nOffset = 0;
+  buffer->nFilledLen = (mStride * mSliceHeight * 3) / 2;
+  buffer->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
+  if (pts == kNoPts)
+    buffer->nFlags |= OMX_BUFFERFLAG_TIME_UNKNOWN;
+  buffer->nTimeStamp = toOmxTime ((uint64_t)((pts != kNoPts) ? pts : 0.0));
+  if (mRender.emptyThisBuffer (buffer)) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " emptyThisBuffer");
+    mRender.decoderEmptyBufferDone (mRender.getHandle(), buffer);
+    return false;
+    }
+    //}}}
+
+  mPresentedFrames++;
+  return true;
+  }
+//}}}
+//{{{
+bool cOmxSwVideo::setupRender (int width, int height) {
+// planar yuv420 straight into video_render, redone from scratch if the size changes
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+
+  closeRender();
+
+  mWidth = width;
+  mHeight = height;
+  mStride = (width + 31) & ~31;
+  mSliceHeight = (height + 15) & ~15;
+
+  if (!mRender.init ("OMX.broadcom.video_render", OMX_IndexParamVideoInit))
+    return false;
+  if (mRender.setState (OMX_StateIdle)) {
+    //{{{  error, return
+    cLog::log (LOGERROR, string(__func__) + " setState idle");
+    return false;
+    }
+    //}}}
+
+  //{{{  set portParam yuv420 planar, size, stride, buffers
+  OMX_PARAM_PORTDEFINITIONTYPE portParam;
+  OMX_INIT_STRUCTURE(portParam);
+
+  portParam.nPortIndex = mRender.getInputPort();
+  if (mRender.getParam (OMX_IndexParamPortDefinition, &portParam)) {
+    //  error return
+    cLog::log (LOGERROR, string(__func__) + " getInputPortParam");
+    return false;
+    }
+
+  portParam.format.video.nFrameWidth = width;
+  portParam.format.video.nFrameHeight = height;
+  portParam.format.video.nStride = mStride;
+  portParam.format.video.nSliceHeight = mSliceHeight;
+  portParam.format.video.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+  portParam.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+  portParam.nBufferCountActual = max ((OMX_U32)kRenderBuffers, portParam.nBufferCountMin);
+  if (mRender.setParam (OMX_IndexParamPortDefinition, &portParam)) {
+    //  error return
+    cLog::log (LOGERROR, string(__func__) + " setInputPortParam");
+    return false;
+    }
+
+  // render sizes its buffers from the format
+  mRender.getParam (OMX_IndexParamPortDefinition, &portParam);
+  mRenderBytes = (int64_t)portParam.nBufferCountActual * portParam.nBufferSize;
+  cMemoryBudget::get().alloc (cMemoryBudget::eOmxFifo, mRenderBytes);
+  //}}}
+
+  if (mRender.allocInputBuffers()) {
+    //{{{  error, return
+    cLog::log (LOGERROR, string(__func__) + " allocInputBuffers");
+    return false;
+    }
+    //}}}
+  if (mRender.setState (OMX_StateExecuting)) {
+    //{{{  error, return
+    cLog::log (LOGERROR, string(__func__) + " setState executing");
+    return false;
+    }
+    //}}}
+
+  //{{{  set displayRegion
+  OMX_CONFIG_DISPLAYREGIONTYPE displayRegion;
+  OMX_INIT_STRUCTURE(displayRegion);
+  displayRegion.nPortIndex = mRender.getInputPort();
+  displayRegion.set = (OMX_DISPLAYSETTYPE)(OMX_DISPLAY_SET_ALPHA |
+                                           OMX_DISPLAY_SET_LAYER |
+                                           OMX_DISPLAY_SET_NUM);
+  displayRegion.alpha = 255;
+  displayRegion.layer = 0;
+  displayRegion.num = mConfig.mDisplay;
+  if (mRender.setConfig (OMX_IndexConfigDisplayRegion, &displayRegion))
+    cLog::log (LOGERROR, string(__func__) + " setDisplayRegion");
+  //}}}
+  mRenderSetup = true;
+  setVideoRect();
+
+  cLog::log (LOGINFO, string(__func__) + " " + dec(width) + "x" + dec(height) +
+                      " stride:" + dec(mStride) + " slice:" + dec(mSliceHeight) +
+                      " buffers:" + dec(portParam.nBufferCountActual) + "x" + dec(portParam.nBufferSize / 1024) + "k");
+  return true;
+  }
+//}}}
+//{{{
+void cOmxSwVideo::closeRender() {
+
+  if (mRender.isInit()) {
+    mRender.flushInput();
+    mRender.deInit();
+    }
+
+  cMemoryBudget::get().free (cMemoryBudget::eOmxFifo, mRenderBytes);
+  mRenderBytes = 0;
+  mRenderSetup = false;
+  }
+//}}}
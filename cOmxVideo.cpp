@@ -7,6 +7,8 @@
 #include "../shared/utils/cLog.h"
 #include "cOmxAv.h"
 
+#include "bcm_host.h"
+
 using namespace std;
 //}}}
 //{{{  decoder defines
@@ -35,6 +37,23 @@ cOmxVideo::~cOmxVideo() {
   }
 //}}}
 
+//{{{
+bool cOmxVideo::isMpeg2Licensed() {
+// ask firmware once, assume licensed if it can't say, a failed hw open still falls back to sw
+
+  static const bool licensed = [] {
+    char response[80] = { 0 };
+    if (vc_gencmd (response, sizeof(response), "codec_enabled MPG2")) {
+      cLog::log (LOGERROR, "cOmxVideo::isMpeg2Licensed - vc_gencmd failed, assuming licensed");
+      return true;
+      }
+    cLog::log (LOGINFO, "cOmxVideo::isMpeg2Licensed - %s", response);
+    return string (response).find ("=enabled") != string::npos;
+    }();
+
+  return licensed;
+  }
+//}}}
 //{{{
 bool cOmxVideo::isEOS() {
 
@@ -64,11 +83,30 @@ unsigned int cOmxVideo::getInputBufferSpace() {
   return mDecoder.getInputBufferSpace();
   }
 //}}}
+//{{{
+int cOmxVideo::getRenderedFrames() {
+// frames presented by render, from its input port stats, -1 if unavailable
+// - no lock, decode can hold mMutex for a whole input buffer wait
+
+  if (!mSrcChanged)
+    return 0;
+
+  OMX_CONFIG_BRCMPORTSTATSTYPE portStats;
+  OMX_INIT_STRUCTURE(portStats);
+  portStats.nPortIndex = mRender.getInputPort();
+  if (mRender.getConfig (OMX_IndexConfigBrcmPortStats, &portStats))
+    return -1;
+
+  return (int)portStats.nFrameCount;
+  }
+//}}}
 
 //{{{
-void cOmxVideo::setAlpha (int alpha) {
+void cVideoDecoder::setAlpha (int alpha) {
 
   lock_guard<recursive_mutex> lockGuard (mMutex);
+  if (!mRender.isInit())
+    return;
 
   OMX_CONFIG_DISPLAYREGIONTYPE display;
   OMX_INIT_STRUCTURE(display);
@@ -81,9 +119,12 @@ void cOmxVideo::setAlpha (int alpha) {
   }
 //}}}
 //{{{
-void cOmxVideo::setVideoRect() {
+void cVideoDecoder::setVideoRect() {
+// sw render is set up on its first frame, mConfig rects applied then
 
   lock_guard<recursive_mutex> lockGuard (mMutex);
+  if (!mRender.isInit())
+    return;
 
   OMX_CONFIG_DISPLAYREGIONTYPE displayRegion;
   OMX_INIT_STRUCTURE(displayRegion);
@@ -132,14 +173,14 @@ void cOmxVideo::setVideoRect() {
   }
 //}}}
 //{{{
-void cOmxVideo::setVideoRect (int aspectMode) {
+void cVideoDecoder::setVideoRect (int aspectMode) {
 
   mConfig.mAspectMode = aspectMode;
   setVideoRect();
   }
 //}}}
 //{{{
-void cOmxVideo::setVideoRect (const cRect& srcRect, const cRect& dstRect) {
+void cVideoDecoder::setVideoRect (const cRect& srcRect, const cRect& dstRect) {
 
   mConfig.mSrcRect = srcRect;
   mConfig.mDstRect = dstRect;
@@ -154,6 +195,8 @@ bool cOmxVideo::open (cOmxClock* clock, const cOmxVideoConfig &config) {
 
   mClock = clock;
   mConfig = config;
+  mOpenTime = mClock->getAbsoluteClock();
+  mFirstFrame = false;
 
   //{{{  init decoder
   string decoderName;
@@ -328,7 +371,17 @@ bool cOmxVideo::open (cOmxClock* clock, const cOmxVideoConfig &config) {
     }
 
   portParam.nPortIndex = mDecoder.getInputPort();
-  portParam.nBufferCountActual = mConfig.mFifoSize / portParam.nBufferSize;
+  // fifo against the memory budget, fewer input buffers rather than none
+  auto& memoryBudget = cMemoryBudget::get();
+  int64_t fifoSize = min ((int64_t)mConfig.mFifoSize, memoryBudget.getLimit (cMemoryBudget::eOmxFifo) -
+                                                      memoryBudget.getUsed (cMemoryBudget::eOmxFifo));
+  fifoSize = max (fifoSize, (int64_t)0);
+  portParam.nBufferCountActual = max ((OMX_U32)(fifoSize / portParam.nBufferSize), portParam.nBufferCountMin);
+  mFifoBytes = (int64_t)portParam.nBufferCountActual * portParam.nBufferSize;
+  memoryBudget.alloc (cMemoryBudget::eOmxFifo, mFifoBytes);
+  if (fifoSize < mConfig.mFifoSize)
+    cLog::log (LOGERROR, string(__func__) + " fifo " + dec(mConfig.mFifoSize / 1024) + "k cut to " +
+                         dec(mFifoBytes / 1024) + "k by memory budget");
   portParam.format.video.nFrameWidth = mConfig.mHints.width;
   portParam.format.video.nFrameHeight = mConfig.mHints.height;
   if (mDecoder.setParam (OMX_IndexParamPortDefinition, &portParam)) {
@@ -362,6 +415,13 @@ bool cOmxVideo::open (cOmxClock* clock, const cOmxVideoConfig &config) {
     }
   //}}}
   setNaluFormat (mConfig.mHints.codec, (uint8_t*)mConfig.mHints.extradata, mConfig.mHints.extrasize);
+  if ((mConfig.mHints.codec == AV_CODEC_ID_H264) && mConfig.mH264Parse) {
+    // avcC extradata gives the nal length prefix size, anything else is annexb
+    auto extraData = (uint8_t*)mConfig.mHints.extradata;
+    bool avcc = extraData && (mConfig.mHints.extrasize >= 7) && (extraData[0] == 1);
+    mH264Parser = new cH264Parser (avcc ? (extraData[4] & 3) + 1 : 0);
+    cLog::log (LOGINFO, string(__func__) + " h264Parser " + (avcc ? "avcc" : "annexb"));
+    }
 
   // alloc bufers for omx input port.
   if (mDecoder.allocInputBuffers()) {
@@ -385,72 +445,32 @@ bool cOmxVideo::open (cOmxClock* clock, const cOmxVideoConfig &config) {
   mPixelAspect = aspect / mConfig.mDisplayAspect;
 
   mSetStartTime = true;
+  cLog::log (LOGINFO, string(__func__) + " took " + getSinceOpen());
   return true;
   }
 //}}}
 //{{{
-bool cOmxVideo::decode (uint8_t* data, int size, double dts, double pts, std::atomic<bool>& flushRequested) {
+bool cOmxVideo::decode (uint8_t* data, int size, double dts, double pts, bool decodeOnly, std::atomic<bool>& flushRequested) {
+// decodeOnly, reference frame ahead of accurate seek target, decoded but not presented
 
   cLog::log (LOGINFO1, __func__ + frac(pts/1000000.0,6,2,' ') + " " + dec(size));
 
-  while (size > (int)getInputBufferSpace()) {
-    mClock->msSleep (10);
-    if (flushRequested)
-      return true;
-    }
+  if (!mH264Parser)
+    return submit (data, size, dts, pts, decodeOnly, false, flushRequested);
 
-  lock_guard<recursive_mutex> lockGuard (mMutex);
-
-  unsigned int bytesLeft = (unsigned int)size;
-  OMX_U32 nFlags = 0;
-  if (mSetStartTime) {
-    nFlags |= OMX_BUFFERFLAG_STARTTIME;
-    cLog::log (LOGINFO1, string(__func__) +  "startTime:" + frac (pts/kPtsScale,6,2,' '));
-    mSetStartTime = false;
+  cH264Parser::cAccessUnit accessUnit;
+  if (!mH264Parser->isAnnexB()) {
+    mH264Parser->classify (data, size, accessUnit);
+    return submit (data, size, dts, pts, decodeOnly, accessUnit.mSync, flushRequested);
     }
-  if ((pts == kNoPts) && (dts == kNoPts))
-    nFlags |= OMX_BUFFERFLAG_TIME_UNKNOWN;
-  else if (pts == kNoPts)
-    nFlags |= OMX_BUFFERFLAG_TIME_IS_DTS;
-
-  while (bytesLeft) {
-    // 500ms timeout
-    auto buffer = mDecoder.getInputBuffer (500);
-    if (!buffer) {
-      //{{{  error return
-      cLog::log (LOGERROR, string(__func__) + " timeout");
-      return false;
-      }
-      //}}}
 
-    buffer->nFlags = nFlags;
-    buffer->nOffset = 0;
-    buffer->nTimeStamp = toOmxTime ((uint64_t)((pts != kNoPts) ? pts : (dts != kNoPts) ? dts : 0.0));
-    buffer->nFilledLen = min ((OMX_U32)bytesLeft, buffer->nAllocLen);
-    memcpy (buffer->pBuffer, data, buffer->nFilledLen);
-    bytesLeft -= buffer->nFilledLen;
-    data += buffer->nFilledLen;
-    if (bytesLeft == 0)
-      buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
-    if (mDecoder.emptyThisBuffer (buffer)) {
-      //{{{  error return
-      cLog::log (LOGERROR, string(__func__) + " emptyThisBuffer");
-      mDecoder.decoderEmptyBufferDone (mDecoder.getHandle(), buffer);
+  // annexb, each access unit goes out when the next one starts, timestamps from the packet it started in
+  mH264Parser->push (data, size, pts, dts, decodeOnly);
+  while (!flushRequested && mH264Parser->next (accessUnit))
+    if (!submit (accessUnit.mData, accessUnit.mSize,
+                 accessUnit.mHasTime ? accessUnit.mDts : kNoPts, accessUnit.mHasTime ? accessUnit.mPts : kNoPts,
+                 accessUnit.mDecodeOnly, accessUnit.mSync, flushRequested))
       return false;
-      }
-      //}}}
-    if (mDecoder.waitEvent (OMX_EventPortSettingsChanged, 0) == OMX_ErrorNone) {
-      if (!srcChanged()) {
-        //{{{  error return
-        cLog::log (LOGERROR, string(__func__) + " srcChanged");
-        return false;
-        }
-        //}}}
-      }
-    if (mDecoder.waitEvent (OMX_EventParamOrConfigChanged, 0) == OMX_ErrorNone)
-      if (!srcChanged())
-        cLog::log (LOGERROR, string(__func__) + " paramChanged");
-    }
 
   return true;
   }
@@ -462,6 +482,16 @@ void cOmxVideo::submitEOS() {
 
   lock_guard<recursive_mutex> lockGuard (mMutex);
 
+  if (mH264Parser) {
+    // last access unit has no following start code to end it
+    cH264Parser::cAccessUnit accessUnit;
+    atomic<bool> flushRequested (false);
+    while (mH264Parser->flush (accessUnit))
+      submit (accessUnit.mData, accessUnit.mSize,
+              accessUnit.mHasTime ? accessUnit.mDts : kNoPts, accessUnit.mHasTime ? accessUnit.mPts : kNoPts,
+              accessUnit.mDecodeOnly, accessUnit.mSync, flushRequested);
+    }
+
   mSubmittedEos = true;
   mFailedEos = false;
 
@@ -493,6 +523,8 @@ void cOmxVideo::reset() {
   lock_guard<recursive_mutex> lockGuard (mMutex);
 
   mSetStartTime = true;
+  if (mH264Parser)
+    mH264Parser->reset();
 
   mDecoder.flushInput();
   if (mDeInterlace)
@@ -523,6 +555,15 @@ void cOmxVideo::close() {
 
   mDeInterlace = false;
   mClock = NULL;
+
+  if (mH264Parser) {
+    cLog::log (LOGNOTICE, "h264Parser " + mH264Parser->getDebugString());
+    delete mH264Parser;
+    mH264Parser = nullptr;
+    }
+
+  cMemoryBudget::get().free (cMemoryBudget::eOmxFifo, mFifoBytes);
+  mFifoBytes = 0;
   }
 //}}}
 
@@ -620,6 +661,82 @@ bool cOmxVideo::setNaluFormat (enum AVCodecID codec, uint8_t* in_extradata, int
   }
 //}}}
 
+//{{{
+bool cOmxVideo::submit (const uint8_t* data, int size, double dts, double pts, bool decodeOnly, bool syncFrame,
+                        std::atomic<bool>& flushRequested) {
+// one frame across as many input buffers as it takes, ENDOFFRAME on the last
+
+  while (size > (int)getInputBufferSpace()) {
+    mClock->msSleep (10);
+    if (flushRequested)
+      return true;
+    }
+
+  lock_guard<recursive_mutex> lockGuard (mMutex);
+
+  unsigned int bytesLeft = (unsigned int)size;
+  OMX_U32 nFlags = 0;
+  if (syncFrame)
+    nFlags |= OMX_BUFFERFLAG_SYNCFRAME;
+  if (decodeOnly)
+    nFlags |= OMX_BUFFERFLAG_DECODEONLY;
+  else if (mSetStartTime) {
+    // clock starts from the first presented frame
+    nFlags |= OMX_BUFFERFLAG_STARTTIME;
+    cLog::log (LOGINFO1, string(__func__) +  "startTime:" + frac (pts/kPtsScale,6,2,' '));
+    mSetStartTime = false;
+    }
+  if ((pts == kNoPts) && (dts == kNoPts))
+    nFlags |= OMX_BUFFERFLAG_TIME_UNKNOWN;
+  else if (pts == kNoPts)
+    nFlags |= OMX_BUFFERFLAG_TIME_IS_DTS;
+
+  while (bytesLeft) {
+    // 500ms timeout
+    auto buffer = mDecoder.getInputBuffer (500);
+    if (!buffer) {
+      //{{{  error return
+      cLog::log (LOGERROR, string(__func__) + " timeout");
+      return false;
+      }
+      //}}}
+
+    buffer->nFlags = nFlags;
+    buffer->nOffset = 0;
+    buffer->nTimeStamp = toOmxTime ((uint64_t)((pts != kNoPts) ? pts : (dts != kNoPts) ? dts : 0.0));
+    buffer->nFilledLen = min ((OMX_U32)bytesLeft, buffer->nAllocLen);
+    memcpy (buffer->pBuffer, data, buffer->nFilledLen);
+    bytesLeft -= buffer->nFilledLen;
+    data += buffer->nFilledLen;
+    if (bytesLeft == 0)
+      buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+    if (mDecoder.emptyThisBuffer (buffer)) {
+      //{{{  error return
+      cLog::log (LOGERROR, string(__func__) + " emptyThisBuffer");
+      mDecoder.decoderEmptyBufferDone (mDecoder.getHandle(), buffer);
+      return false;
+      }
+      //}}}
+    if (mDecoder.waitEvent (OMX_EventPortSettingsChanged, 0) == OMX_ErrorNone) {
+      if (!srcChanged()) {
+        //{{{  error return
+        cLog::log (LOGERROR, string(__func__) + " srcChanged");
+        return false;
+        }
+        //}}}
+      }
+    if (mDecoder.waitEvent (OMX_EventParamOrConfigChanged, 0) == OMX_ErrorNone)
+      if (!srcChanged())
+        cLog::log (LOGERROR, string(__func__) + " paramChanged");
+    }
+
+  if (mSrcChanged && !mFirstFrame)
+    checkFirstFrame();
+
+  return true;
+  }
+//}}}
+
 //{{{
 bool cOmxVideo::srcChanged() {
 
@@ -665,6 +782,16 @@ bool cOmxVideo::srcChanged() {
     }
     //}}}
 
+  double phaseTime = mClock->getAbsoluteClock();
+  string phases;
+  //{{{
+  auto phase = [&](const char* name) {
+    double now = mClock->getAbsoluteClock();
+    phases += string(" ") + name + ":" + dec(int((now - phaseTime) / 1000.0)) + "ms";
+    phaseTime = now;
+    };
+  //}}}
+
   if (!mRender.init ("OMX.broadcom.video_render", OMX_IndexParamVideoInit))
     return false;
   mRender.resetEos();
@@ -782,60 +909,61 @@ bool cOmxVideo::srcChanged() {
     }
     //}}}
 
-  // wire up components and startup
+  phase ("init");
+
+  // wire up components and startup, independent components change state together,
+  // all tunnel ports are enabled before waiting on any of them
   mTunnelSched.init (&mScheduler, mScheduler.getOutputPort(), &mRender, mRender.getInputPort());
   mTunnelClock.init (mClock->getOmxCore(), mClock->getOmxCore()->getInputPort() + 1,
                      &mScheduler, mScheduler.getOutputPort() + 1);
-  if (mTunnelClock.establish()) {
-    //{{{  error return
-    cLog::log (LOGERROR,  string(__func__) + " mTunnelClock.establish");
-    return false;
-    }
-    //}}}
-  if (mTunnelDecoder.establish()) {
-    //{{{  error return
-    cLog::log (LOGERROR,  string(__func__) + " mTunnelDecoder.establish");
-    return false;
-    }
-    //}}}
-  if (mDeInterlace) {
-    if (mTunnelImageFx.establish()) {
-      //{{{  error return
-      cLog::log (LOGERROR,  string(__func__) + " mTunnelImageFx.establish");
-      return false;
-      }
-      //}}}
-    if (mImageFx.setState (OMX_StateExecuting)) {
-      //{{{  error return
-      cLog::log (LOGERROR,  string(__func__) + " mImageFx.setState");
-      return false;
-      }
-      //}}}
-    }
-  if (mTunnelSched.establish()) {
+
+  if (cOmxCore::setStates ({ &mRender, &mScheduler, &mImageFx }, OMX_StateIdle)) {
     //{{{  error return
-    cLog::log (LOGERROR, string(__func__) + " mTunnelSched.establish");
+    cLog::log (LOGERROR, string(__func__) + " setStates idle");
     return false;
     }
     //}}}
-  if (mScheduler.setState (OMX_StateExecuting)) {
+  phase ("idle");
+
+  vector<cOmxTunnel*> tunnels = { &mTunnelClock, &mTunnelDecoder, &mTunnelSched };
+  if (mDeInterlace)
+    tunnels.push_back (&mTunnelImageFx);
+  if (cOmxTunnel::establishAll (tunnels)) {
     //{{{  error return
-    cLog::log (LOGERROR, string(__func__) + "mScheduler.setState");
+    cLog::log (LOGERROR, string(__func__) + " establishAll");
     return false;
     }
     //}}}
-  if (mRender.setState (OMX_StateExecuting)) {
+  phase ("tunnel");
+
+  if (cOmxCore::setStates ({ &mImageFx, &mScheduler, &mRender }, OMX_StateExecuting)) {
     //{{{  error return
-    cLog::log (LOGERROR, string(__func__) + "mRender.setState");
+    cLog::log (LOGERROR, string(__func__) + " setStates executing");
     return false;
     }
     //}}}
+  phase ("execute");
+
+  cLog::log (LOGINFO, string(__func__) + phases + " at " + getSinceOpen());
 
   mSrcChanged = true;
   return true;
   }
 //}}}
 //{{{
+void cOmxVideo::checkFirstFrame() {
+// log open to first frame once
+
+  int frames = getRenderedFrames();
+  if (frames < 0)
+    mFirstFrame = true;
+  else if (frames > 0) {
+    cLog::log (LOGINFO, string(__func__) + " rendered at " + getSinceOpen());
+    mFirstFrame = true;
+    }
+  }
+//}}}
+//{{{
 void cOmxVideo::logSrcChanged (OMX_PARAM_PORTDEFINITIONTYPE port,
                                enum OMX_INTERLACETYPE interlaceMode) {
 
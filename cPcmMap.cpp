@@ -8,6 +8,10 @@
 #include <cassert>
 #include <climits>
 #include <cmath>
+#include <map>
+#include <array>
+#include <mutex>
+#include <chrono>
 
 #include "cPcmMap.h"
 #include "../shared/utils/cLog.h"
@@ -71,6 +75,59 @@ void cPcmMap::getDownmixMatrix (float *downmix) {
   }
 //}}}
 
+//{{{
+void cPcmMap::getCachedDownmixMatrix (unsigned int inChannels, enum PCMChannels* inMap,
+                                      unsigned int outChannels, enum PCMChannels* outMap,
+                                      enum PCMLayout channelLayout, bool dontnormalize, float* downmix) {
+// memoized getDownmixMatrix, the layout combinations are few and the result only depends on them
+
+  static mutex cacheMutex;
+  static map <pair<uint64_t,uint64_t>, array<float,8*8>> cache;
+
+  if ((inChannels > 8) || (outChannels > 8)) {
+    // too many to key, resolve uncached
+    cPcmMap pcmMap;
+    pcmMap.reset();
+    pcmMap.setInputFormat (inChannels, inMap, 0, 0, channelLayout, dontnormalize);
+    pcmMap.setOutputFormat (outChannels, outMap, false);
+    pcmMap.getDownmixMatrix (downmix);
+    return;
+    }
+
+  auto timePoint = chrono::steady_clock::now();
+
+  // key packs everything the resolver looks at, 5 bits per channel, at most 8 channels each way
+  pair<uint64_t,uint64_t> key (inChannels, outChannels);
+  for (auto i = 0u; i < inChannels; i++)
+    key.first |= uint64_t(inMap[i] + 1) << (8 + (5 * i));
+  for (auto i = 0u; i < outChannels; i++)
+    key.second |= uint64_t(outMap[i] + 1) << (8 + (5 * i));
+  key.first |= uint64_t(channelLayout) << 48;
+  key.second |= uint64_t(dontnormalize) << 48;
+
+  lock_guard<mutex> lockGuard (cacheMutex);
+
+  auto it = cache.find (key);
+  bool hit = it != cache.end();
+  if (!hit) {
+    cPcmMap pcmMap;
+    pcmMap.reset();
+    pcmMap.setInputFormat (inChannels, inMap, 0, 0, channelLayout, dontnormalize);
+    pcmMap.setOutputFormat (outChannels, outMap, false);
+
+    array<float,8*8> matrix;
+    pcmMap.getDownmixMatrix (matrix.data());
+    it = cache.insert (make_pair (key, matrix)).first;
+    }
+
+  memcpy (downmix, it->second.data(), sizeof(float) * 8*8);
+
+  auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - timePoint).count();
+  cLog::log (LOGINFO1, "cPcmMap - downmix matrix " + to_string (inChannels) + "->" + to_string (outChannels) +
+                       (hit ? " cached " : " resolved ") + to_string (us) + "us");
+  }
+//}}}
+
 //{{{
 enum PCMChannels* cPcmMap::setInputFormat (unsigned int channels, enum PCMChannels *channelMap,
                                            unsigned int sampleSize, unsigned int sampleRate,
@@ -140,7 +197,7 @@ void cPcmMap::reset() {
 //{{{
 /* resolves the channels recursively and returns the new index of tablePtr */
 struct PCMMapInfo* cPcmMap::resolveChannel (enum PCMChannels channel, float level, bool ifExists,
-                                            vector<enum PCMChannels> path, struct PCMMapInfo *tablePtr) {
+                                            vector<enum PCMChannels>& path, struct PCMMapInfo *tablePtr) {
 
   if (channel == PCM_INVALID)
     return tablePtr;
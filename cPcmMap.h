@@ -62,6 +62,9 @@ struct PCMMapInfo
 class cPcmMap {
 public:
   void getDownmixMatrix (float* downmix);
+  static void getCachedDownmixMatrix (unsigned int inChannels, enum PCMChannels* inMap,
+                                      unsigned int outChannels, enum PCMChannels* outMap,
+                                      enum PCMLayout channelLayout, bool dontnormalize, float* downmix);
 
   enum PCMChannels* setInputFormat (unsigned int channels, enum PCMChannels* channelMap,
                                     unsigned int sampleSize, unsigned int sampleRate,
@@ -71,7 +74,7 @@ public:
   void reset();
 
 private:
-  struct PCMMapInfo* resolveChannel (enum PCMChannels channel, float level, bool ifExists, std::vector<enum PCMChannels> path, struct PCMMapInfo *tablePtr);
+  struct PCMMapInfo* resolveChannel (enum PCMChannels channel, float level, bool ifExists, std::vector<enum PCMChannels>& path, struct PCMMapInfo *tablePtr);
   void resolveChannels();
 
   void buildMap();
@@ -0,0 +1,293 @@
+// cRecorder.cpp - tee bytes to disk through a writer thread, play path copies and never waits on disk
+//{{{  includes
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <chrono>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cRecorder.h"
+#include "cMemoryBudget.h"
+
+using namespace std;
+//}}}
+const int kBlockAlign = 4096;
+const double kLogSecs = 10.0;
+
+// uk dvb-t2 multiplex, 256qam 32k 1/128, the fastest broadcast input we tee
+const double kDvbT2MuxBitrate = 40.2e6;
+
+//{{{
+static double getSecs() {
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+  }
+//}}}
+
+//{{{
+cRecorder::cRecorder (const string& fileName, int streamIndex, float maxLatencyMs, int blockSize, int blocks) :
+    mFileName(fileName), mStreamIndex(streamIndex), mMaxLatencyMs(maxLatencyMs),
+    mBlockSize(((blockSize + kBlockAlign - 1) / kBlockAlign) * kBlockAlign), mBlocks(blocks) {
+
+  mInBytes = 0;
+  mWrittenBytes = 0;
+  mDroppedBytes = 0;
+  mDrops = 0;
+  mLatencyAlarms = 0;
+  }
+//}}}
+//{{{
+void cRecorder::bench (const string& fileName, float secs) {
+// feed ts sized chunks as fast as the copy goes, sustained write rate against a full t2 multiplex
+
+  cRecorder recorder (fileName);
+  if (!recorder.start())
+    return;
+
+  vector<uint8_t> chunk (7 * 188);
+  for (size_t i = 0; i < chunk.size(); i++)
+    chunk[i] = (i % 188) ? uint8_t(i) : 0x47;
+
+  double startSecs = getSecs();
+  while (getSecs() - startSecs < secs)
+    for (int i = 0; i < 1000; i++)
+      recorder.write (chunk.data(), (int)chunk.size());
+  recorder.stop();
+
+  double rate = (recorder.mWriteSecs > 0.0) ? recorder.mWrittenBytes * 8.0 / recorder.mWriteSecs : 0.0;
+  double sustained = recorder.mWrittenBytes * 8.0 / (getSecs() - startSecs);
+  cLog::log (LOGNOTICE, "recorder bench " + fileName +
+                        " write:" + frac(rate / 1e6, 6,1,' ') + "mbit/s" +
+                        " sustained:" + frac(sustained / 1e6, 6,1,' ') + "mbit/s" +
+                        " x" + frac(sustained / kDvbT2MuxBitrate, 4,1,' ') + " t2 mux" +
+                        " maxLatency:" + frac(recorder.mMaxLatencyMsSeen, 5,1,' ') + "ms" +
+                        string(recorder.mDirect ? " direct" : " buffered"));
+
+  unlink (fileName.c_str());
+  }
+//}}}
+
+//{{{
+string cRecorder::getDebugString() {
+
+  return "rec " + dec(mWrittenBytes / (1024 * 1024)) + "m" +
+         " drop:" + dec(mDrops) + "/" + dec(mDroppedBytes / 1024) + "k" +
+         " alarm:" + dec(mLatencyAlarms);
+  }
+//}}}
+
+//{{{
+bool cRecorder::start() {
+
+  // O_DIRECT keeps recording out of the page cache, not every filesystem takes it
+  mFd = open (mFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+  mDirect = mFd >= 0;
+  if (!mDirect)
+    mFd = open (mFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (mFd < 0) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " unable to open " + mFileName + " " + strerror (errno));
+    return false;
+    }
+    //}}}
+
+  // as many blocks as the memory budget allows, two at least
+  for (int i = 0; i < mBlocks; i++) {
+    if ((i >= 2) && !cMemoryBudget::get().tryAlloc (cMemoryBudget::eRecorder, mBlockSize))
+      break;
+    if (i < 2)
+      cMemoryBudget::get().alloc (cMemoryBudget::eRecorder, mBlockSize);
+
+    void* block = nullptr;
+    if (posix_memalign (&block, kBlockAlign, mBlockSize)) {
+      //{{{  error return
+      cLog::log (LOGERROR, string(__func__) + " unable to allocate blocks");
+      cMemoryBudget::get().free (cMemoryBudget::eRecorder, mBlockSize);
+      stop();
+      return false;
+      }
+      //}}}
+    mAllocs.push_back ((uint8_t*)block);
+    mFree.push_back ((uint8_t*)block);
+    }
+
+  mFill = mFree.front();
+  mFree.pop_front();
+  mFillSize = 0;
+
+  mExit = false;
+  mStartSecs = getSecs();
+  mThread = thread ([=]() { writerThread(); });
+
+  cLog::log (LOGINFO, string(__func__) + " " + mFileName +
+                      (isRaw() ? " raw" : " stream:" + dec(mStreamIndex)) +
+                      " " + dec((int)mAllocs.size()) + "x" + dec(mBlockSize / 1024) + "k" +
+                      string(mDirect ? " direct" : " buffered"));
+  return true;
+  }
+//}}}
+//{{{
+void cRecorder::write (const uint8_t* data, int size) {
+// play path, copy into fill block, hand full blocks to the writer, drop if it has none free
+
+  mInBytes += size;
+
+  while (size > 0) {
+    if (!mFill) {
+      lock_guard<mutex> lockGuard (mMutex);
+      if (mFree.empty()) {
+        mDrops++;
+        mDroppedBytes += size;
+        return;
+        }
+      mFill = mFree.front();
+      mFree.pop_front();
+      mFillSize = 0;
+      }
+
+    int bytes = min (size, mBlockSize - mFillSize);
+    memcpy (mFill + mFillSize, data, bytes);
+    mFillSize += bytes;
+    data += bytes;
+    size -= bytes;
+
+    if (mFillSize == mBlockSize)
+      handOff();
+    }
+  }
+//}}}
+//{{{
+void cRecorder::stop() {
+// from the play side, after the last write, writer drains the queue then we write the tail
+
+  if (mThread.joinable()) {
+    {
+    lock_guard<mutex> lockGuard (mMutex);
+    mExit = true;
+    }
+    mFullCond.notify_one();
+    mThread.join();
+    }
+
+  if (mFd >= 0) {
+    if (mFill && mFillSize) {
+      // tail isn't a whole block, O_DIRECT won't take it
+      if (mDirect)
+        fcntl (mFd, F_SETFL, fcntl (mFd, F_GETFL) & ~O_DIRECT);
+      writeBlock (mFill, mFillSize);
+      }
+    close (mFd);
+    mFd = -1;
+    logThroughput (true);
+    }
+
+  for (auto block : mAllocs)
+    free (block);
+  cMemoryBudget::get().free (cMemoryBudget::eRecorder, (int64_t)mAllocs.size() * mBlockSize);
+  mAllocs.clear();
+  mFree.clear();
+  mFull.clear();
+  mFill = nullptr;
+  mFillSize = 0;
+  }
+//}}}
+
+// private
+//{{{
+void cRecorder::handOff() {
+
+  lock_guard<mutex> lockGuard (mMutex);
+
+  mFull.push_back (mFill);
+  mQueueHigh = max (mQueueHigh, (int)mFull.size());
+  mFullCond.notify_one();
+
+  mFill = nullptr;
+  if (!mFree.empty()) {
+    mFill = mFree.front();
+    mFree.pop_front();
+    }
+  mFillSize = 0;
+  }
+//}}}
+//{{{
+void cRecorder::writerThread() {
+
+  cLog::setThreadName ("rec ");
+
+  double logSecs = getSecs();
+  unique_lock<mutex> lock (mMutex);
+  while (true) {
+    if (mFull.empty()) {
+      if (mExit)
+        break;
+      mFullCond.wait (lock);
+      continue;
+      }
+
+    auto block = mFull.front();
+    mFull.pop_front();
+    lock.unlock();
+
+    writeBlock (block, mBlockSize);
+    if (getSecs() - logSecs > kLogSecs) {
+      logSecs = getSecs();
+      logThroughput (false);
+      }
+
+    lock.lock();
+    mFree.push_back (block);
+    }
+
+  cLog::log (LOGINFO1, "exit");
+  }
+//}}}
+//{{{
+bool cRecorder::writeBlock (const uint8_t* data, int size) {
+// whole block, retry short writes, time it against the latency alarm
+
+  double startSecs = getSecs();
+
+  int written = 0;
+  while (written < size) {
+    auto bytes = ::write (mFd, data + written, size - written);
+    if (bytes < 0) {
+      if (errno == EINTR)
+        continue;
+      //{{{  error return
+      cLog::log (LOGERROR, string(__func__) + " " + mFileName + " " + strerror (errno));
+      return false;
+      }
+      //}}}
+    written += bytes;
+    }
+
+  double secs = getSecs() - startSecs;
+  mWriteSecs += secs;
+  mWrittenBytes += size;
+
+  double latencyMs = secs * 1000.0;
+  mMaxLatencyMsSeen = max (mMaxLatencyMsSeen, latencyMs);
+  if (latencyMs > mMaxLatencyMs) {
+    mLatencyAlarms++;
+    cLog::log (LOGERROR, string(__func__) + " " + mFileName + " write took " + frac(latencyMs, 6,1,' ') + "ms");
+    }
+
+  return true;
+  }
+//}}}
+//{{{
+void cRecorder::logThroughput (bool final) {
+
+  double secs = getSecs() - mStartSecs;
+  cLog::log (final ? LOGNOTICE : LOGINFO, "cRecorder " + mFileName +
+             " in:" + frac(secs > 0.0 ? mInBytes * 8.0 / secs / 1e6 : 0.0, 6,2,' ') + "mbit/s" +
+             " write:" + frac(mWriteSecs > 0.0 ? mWrittenBytes * 8.0 / mWriteSecs / 1e6 : 0.0, 6,1,' ') + "mbit/s" +
+             " queueHigh:" + dec(mQueueHigh) + "/" + dec((int)mAllocs.size()) +
+             " maxLatency:" + frac(mMaxLatencyMsSeen, 5,1,' ') + "ms" +
+             " " + getDebugString());
+  }
+//}}}
@@ -0,0 +1,70 @@
+// cRecorder.h - tee bytes to disk through a writer thread, play path copies and never waits on disk
+//{{{  includes
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+//}}}
+
+class cRecorder {
+public:
+  // streamIndex -1 records raw input bytes, else that stream's packets
+  cRecorder (const std::string& fileName, int streamIndex = -1, float maxLatencyMs = 250.f,
+             int blockSize = 1024 * 1024, int blocks = 16);
+  ~cRecorder() { stop(); }
+
+  static void bench (const std::string& fileName, float secs);
+
+  bool isRaw() { return mStreamIndex < 0; }
+  int getStreamIndex() { return mStreamIndex; }
+  std::string getDebugString();
+
+  bool start();
+  void write (const uint8_t* data, int size);
+  void stop();
+
+private:
+  void handOff();
+  void writerThread();
+  bool writeBlock (const uint8_t* data, int size);
+  void logThroughput (bool final);
+
+  // vars
+  const std::string mFileName;
+  const int mStreamIndex;
+  const float mMaxLatencyMs;
+  const int mBlockSize;
+  const int mBlocks;
+
+  int mFd = -1;
+  bool mDirect = false;
+
+  // blocks are aligned for O_DIRECT, play path fills one, writer drains the full queue
+  std::vector <uint8_t*> mAllocs;
+  uint8_t* mFill = nullptr;
+  int mFillSize = 0;
+
+  std::mutex mMutex;
+  std::condition_variable mFullCond;
+  std::deque <uint8_t*> mFree;
+  std::deque <uint8_t*> mFull;
+  std::thread mThread;
+  bool mExit = false;
+
+  // stats, backpressure is no free block, those bytes are dropped rather than block the play path
+  std::atomic<int64_t> mInBytes;
+  std::atomic<int64_t> mWrittenBytes;
+  std::atomic<int64_t> mDroppedBytes;
+  std::atomic<int> mDrops;
+  int mQueueHigh = 0;
+  double mWriteSecs = 0.0;
+  double mMaxLatencyMsSeen = 0.0;
+  std::atomic<int> mLatencyAlarms;
+  double mStartSecs = 0.0;
+  };
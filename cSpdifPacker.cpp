@@ -0,0 +1,227 @@
+// cSpdifPacker.cpp - pack ac3, eac3, dts frames into IEC 61937 bursts
+//{{{  includes
+#include <string.h>
+#include <algorithm>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cSpdifPacker.h"
+
+using namespace std;
+//}}}
+//{{{  IEC 61937 defines
+#define IEC61937_PREAMBLE_BYTES 8
+#define IEC61937_SYNC1          0xF872
+#define IEC61937_SYNC2          0x4E1F
+
+#define IEC61937_AC3            0x01
+#define IEC61937_DTS1           0x0B  //  512 samples
+#define IEC61937_DTS2           0x0C  // 1024 samples
+#define IEC61937_DTS3           0x0D  // 2048 samples
+#define IEC61937_EAC3           0x15
+
+#define AC3_FRAME_SAMPLES       1536
+#define EAC3_BURST_SAMPLES      6144  // 4x rate, 6 blocks of 256 samples
+//}}}
+// ac3 bitrates in kbps indexed by frmsizecod/2
+const int kAc3Bitrates[19] = { 32, 40, 48, 56, 64, 80, 96, 112, 128, 160,
+                               192, 224, 256, 320, 384, 448, 512, 576, 640 };
+const int kEac3Blocks[4] = { 1, 2, 3, 6 };
+
+// gets
+//{{{
+int cSpdifPacker::getOutputRate (int sampleRate) {
+// eac3 bursts go out at 4x the stream rate, ac3 and dts at the stream rate
+
+  return (mCodec == AV_CODEC_ID_EAC3) ? sampleRate * 4 : sampleRate;
+  }
+//}}}
+
+// sets
+//{{{
+bool cSpdifPacker::setCodec (enum AVCodecID codec) {
+
+  reset();
+
+  switch (codec) {
+    case AV_CODEC_ID_AC3:
+    case AV_CODEC_ID_EAC3:
+    case AV_CODEC_ID_DTS:
+      mCodec = codec;
+      return true;
+
+    default:
+      mCodec = AV_CODEC_ID_NONE;
+      return false;
+    }
+  }
+//}}}
+
+// actions
+//{{{
+void cSpdifPacker::addData (const uint8_t* data, int size) {
+  mInput.insert (mInput.end(), data, data + size);
+  }
+//}}}
+//{{{
+uint8_t* cSpdifPacker::getBurst (int& size) {
+// return next complete burst of 2ch 16bit little endian samples, nullptr if need more data
+
+  size = 0;
+
+  int used = 0;
+  uint8_t* burst = nullptr;
+  while (!burst) {
+    int frameSize;
+    int samples;
+    int dataType;
+    int found = parseFrame (mInput.data() + used, (int)mInput.size() - used, frameSize, samples, dataType);
+    if (found == 0)
+      break;
+    if (found < 0) {
+      // lost sync, skip a byte
+      used++;
+      continue;
+      }
+
+    const uint8_t* frame = mInput.data() + used;
+    if (mCodec == AV_CODEC_ID_EAC3) {
+      //{{{  accumulate eac3 frames, dependent substreams add no samples
+      mEac3Frames.insert (mEac3Frames.end(), frame, frame + frameSize);
+      mEac3Samples += samples;
+      if (mEac3Samples >= AC3_FRAME_SAMPLES) {
+        // eac3 length code is in bytes
+        packBurst (dataType, mEac3Frames.data(), (int)mEac3Frames.size(), (int)mEac3Frames.size(),
+                   EAC3_BURST_SAMPLES * 4);
+        mEac3Frames.clear();
+        mEac3Samples = 0;
+        burst = mBurst.data();
+        }
+      }
+      //}}}
+    else if (frameSize + IEC61937_PREAMBLE_BYTES <= samples * 4) {
+      // ac3, dts length code is in bits
+      packBurst (dataType, frame, frameSize, frameSize * 8, samples * 4);
+      burst = mBurst.data();
+      }
+    else
+      cLog::log (LOGERROR, string(__func__) + " frame too big for burst " + dec(frameSize));
+
+    used += frameSize;
+    }
+
+  if (used)
+    mInput.erase (mInput.begin(), mInput.begin() + used);
+
+  if (burst)
+    size = (int)mBurst.size();
+  return burst;
+  }
+//}}}
+//{{{
+void cSpdifPacker::reset() {
+
+  mInput.clear();
+  mEac3Frames.clear();
+  mEac3Samples = 0;
+  }
+//}}}
+
+// private
+//{{{
+int cSpdifPacker::parseFrame (const uint8_t* data, int size, int& frameSize, int& samples, int& dataType) {
+// parse syncFrame header at data, return 1 if frame complete, 0 if need more data, -1 if no sync
+
+  if (size < 8)
+    return 0;
+
+  if ((mCodec == AV_CODEC_ID_AC3) || (mCodec == AV_CODEC_ID_EAC3)) {
+    if ((data[0] != 0x0B) || (data[1] != 0x77))
+      return -1;
+
+    int bsid = data[5] >> 3;
+    if (bsid <= 10) {
+      //{{{  ac3
+      int fscod = data[4] >> 6;
+      int frmsizecod = data[4] & 0x3F;
+      if ((fscod == 3) || (frmsizecod > 37))
+        return -1;
+
+      int bitrate = kAc3Bitrates[frmsizecod >> 1];
+      int words = (fscod == 0) ? bitrate * 2 :
+                  (fscod == 1) ? (bitrate * 320 / 147) + (frmsizecod & 1) : bitrate * 3;
+      frameSize = words * 2;
+      samples = AC3_FRAME_SAMPLES;
+
+      // bsmod goes in the data type dependent bits
+      dataType = IEC61937_AC3 | ((data[5] & 0x07) << 8);
+      }
+      //}}}
+    else if (bsid <= 16) {
+      //{{{  eac3
+      int strmtyp = data[2] >> 6;
+      int frmsiz = ((data[2] & 0x07) << 8) | data[3];
+      int fscod = data[4] >> 6;
+      int numblkscod = (data[4] >> 4) & 0x03;
+      frameSize = (frmsiz + 1) * 2;
+      samples = (strmtyp == 1) ? 0 : 256 * ((fscod == 3) ? 6 : kEac3Blocks[numblkscod]);
+      dataType = IEC61937_EAC3;
+      }
+      //}}}
+    else
+      return -1;
+    }
+
+  else if (mCodec == AV_CODEC_ID_DTS) {
+    //{{{  dts core, 16bit big endian sync only
+    if ((data[0] != 0x7F) || (data[1] != 0xFE) || (data[2] != 0x80) || (data[3] != 0x01))
+      return -1;
+
+    int nblks = ((data[4] & 0x01) << 6) | (data[5] >> 2);
+    int fsize = ((data[5] & 0x03) << 12) | (data[6] << 4) | (data[7] >> 4);
+    frameSize = fsize + 1;
+    samples = (nblks + 1) * 32;
+
+    switch (samples) {
+      case 512:  dataType = IEC61937_DTS1; break;
+      case 1024: dataType = IEC61937_DTS2; break;
+      case 2048: dataType = IEC61937_DTS3; break;
+      default:   return -1;
+      }
+    }
+    //}}}
+
+  else
+    return -1;
+
+  return (frameSize <= size) ? 1 : 0;
+  }
+//}}}
+//{{{
+void cSpdifPacker::packBurst (int dataType, const uint8_t* payload, int payloadSize, int lengthCode, int period) {
+// burst is Pa,Pb,Pc,Pd preamble then payload as 16bit words, padded with zeros to the repetition period
+
+  mBurst.assign (period, 0);
+  uint8_t* burst = mBurst.data();
+
+  burst[0] = IEC61937_SYNC1 & 0xFF;
+  burst[1] = IEC61937_SYNC1 >> 8;
+  burst[2] = IEC61937_SYNC2 & 0xFF;
+  burst[3] = IEC61937_SYNC2 >> 8;
+  burst[4] = dataType & 0xFF;
+  burst[5] = dataType >> 8;
+  burst[6] = lengthCode & 0xFF;
+  burst[7] = (lengthCode >> 8) & 0xFF;
+
+  // payload is big endian words, swap to little endian samples
+  payloadSize = min (payloadSize, period - IEC61937_PREAMBLE_BYTES);
+  uint8_t* dst = burst + IEC61937_PREAMBLE_BYTES;
+  for (int i = 0; i + 1 < payloadSize; i += 2) {
+    dst[i] = payload[i+1];
+    dst[i+1] = payload[i];
+    }
+  if (payloadSize & 1)
+    dst[payloadSize] = payload[payloadSize-1];
+  }
+//}}}
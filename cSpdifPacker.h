@@ -0,0 +1,33 @@
+// cSpdifPacker.h - pack ac3, eac3, dts frames into IEC 61937 bursts
+//{{{  includes
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "avLibs.h"
+//}}}
+
+class cSpdifPacker {
+public:
+  bool setCodec (enum AVCodecID codec);
+  int getOutputRate (int sampleRate);
+
+  void addData (const uint8_t* data, int size);
+  uint8_t* getBurst (int& size);
+  void reset();
+
+private:
+  int parseFrame (const uint8_t* data, int size, int& frameSize, int& samples, int& dataType);
+  void packBurst (int dataType, const uint8_t* payload, int payloadSize, int lengthCode, int period);
+
+  // vars
+  enum AVCodecID mCodec = AV_CODEC_ID_NONE;
+
+  std::vector<uint8_t> mInput;
+  std::vector<uint8_t> mBurst;
+
+  // eac3 bursts carry 6 blocks, accumulate frames until we have them
+  std::vector<uint8_t> mEac3Frames;
+  int mEac3Samples = 0;
+  };
@@ -0,0 +1,203 @@
+// cStartCode.cpp - 00 00 01 start code and 00 00 03 emulation prevention scan, neon or sse2, scalar tail
+//{{{  includes
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define SIMD_NEON
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+  #define SIMD_SSE2
+#endif
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cStartCode.h"
+
+using namespace std;
+//}}}
+
+// most of a file read into memory, scanned from there so the disk isn't measured
+const int kMaxBenchBytes = 64 * 1024 * 1024;
+
+//{{{
+static double getSecs() {
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+  }
+//}}}
+
+//{{{
+const char* cStartCode::getSimdName() {
+
+#if defined(SIMD_NEON)
+  return "neon";
+#elif defined(SIMD_SSE2)
+  return "sse2";
+#else
+  return "scalar";
+#endif
+  }
+//}}}
+
+//{{{
+int cStartCode::unescape (const uint8_t* src, int size, uint8_t* dst) {
+// copy the runs between escapes, the zero count restarts after a dropped 03
+
+  const uint8_t* end = src + size;
+  uint8_t* out = dst;
+
+  while (src < end) {
+    auto escape = findEscape (src, end);
+    int run = escape ? int(escape - src) + 2 : int(end - src);
+    memmove (out, src, run);
+    out += run;
+    src += run + (escape ? 1 : 0);
+    }
+
+  return int(out - dst);
+  }
+//}}}
+//{{{
+int cStartCode::getMpeg2PictureType (const uint8_t* data, int size) {
+// picture_start_code 00 00 01 00, 10 bits temporal_reference, 3 bits picture_coding_type
+
+  const uint8_t* end = data + size;
+  const uint8_t* ptr = data;
+
+  while ((ptr = find (ptr, end))) {
+    if ((ptr + 6 <= end) && (ptr[3] == 0x00))
+      return (ptr[5] >> 3) & 0x07;
+    ptr += 3;
+    }
+
+  return 0;
+  }
+//}}}
+//{{{
+void cStartCode::bench (const string& fileName, float secs) {
+// start code and escape counts must match scalar, rate over the whole buffer repeated for secs
+
+  //{{{  read file
+  FILE* file = fopen (fileName.c_str(), "rb");
+  if (!file) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " can't open " + fileName);
+    return;
+    }
+    //}}}
+
+  vector<uint8_t> buffer (kMaxBenchBytes);
+  int size = (int)fread (buffer.data(), 1, buffer.size(), file);
+  fclose (file);
+  if (size <= 0) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " nothing read from " + fileName);
+    return;
+    }
+    //}}}
+  //}}}
+
+  const uint8_t* begin = buffer.data();
+  const uint8_t* end = begin + size;
+
+  // simd, scalar, escapes
+  const char* names[3] = { getSimdName(), "scalar", "escape" };
+  int counts[3] = { 0 };
+  double rates[3] = { 0.0 };
+
+  for (int pass = 0; pass < 3; pass++) {
+    int64_t bytes = 0;
+    double startSecs = getSecs();
+    do {
+      int count = 0;
+      const uint8_t* ptr = begin;
+      while (true) {
+        if (pass == 0)
+          ptr = find (ptr, end);
+        else if (pass == 1)
+          ptr = findScalar (ptr, end);
+        else
+          ptr = findEscape (ptr, end);
+        if (!ptr)
+          break;
+        count++;
+        ptr += 3;
+        }
+      counts[pass] = count;
+      bytes += size;
+      } while (getSecs() - startSecs < secs / 3.f);
+    rates[pass] = bytes / (getSecs() - startSecs) / 1e9;
+    }
+
+  string str = "startCode bench " + fileName + " " + dec(size / (1024 * 1024)) + "m";
+  for (int pass = 0; pass < 3; pass++)
+    str += " " + string(names[pass]) + ":" + frac(rates[pass], 5,2,' ') + "GB/s " + dec(counts[pass]);
+  if (counts[0] != counts[1])
+    str += " mismatch";
+  cLog::log ((counts[0] != counts[1]) ? LOGERROR : LOGNOTICE, str);
+  }
+//}}}
+
+// private
+//{{{
+const uint8_t* cStartCode::findPattern (const uint8_t* ptr, const uint8_t* end, uint8_t third) {
+// 16 bytes at a time, 00 00 pairs from the block and the block one on, each pair then checked for third
+
+#if defined(SIMD_NEON)
+  uint8x16_t zero = vdupq_n_u8 (0);
+  while (end - ptr >= 18) {
+    uint8x16_t pairs = vandq_u8 (vceqq_u8 (vld1q_u8 (ptr), zero), vceqq_u8 (vld1q_u8 (ptr + 1), zero));
+    uint8x8_t fold = vorr_u8 (vget_low_u8 (pairs), vget_high_u8 (pairs));
+    if (vget_lane_u64 (vreinterpret_u64_u8 (fold), 0)) {
+      for (int i = 0; i < 16; i++)
+        if (!ptr[i] && !ptr[i+1] && (ptr[i+2] == third))
+          return ptr + i;
+      }
+    ptr += 16;
+    }
+
+#elif defined(SIMD_SSE2)
+  __m128i zero = _mm_setzero_si128();
+  while (end - ptr >= 18) {
+    __m128i block = _mm_loadu_si128 ((const __m128i*)ptr);
+    __m128i blockOn = _mm_loadu_si128 ((const __m128i*)(ptr + 1));
+    int mask = _mm_movemask_epi8 (_mm_and_si128 (_mm_cmpeq_epi8 (block, zero), _mm_cmpeq_epi8 (blockOn, zero)));
+    while (mask) {
+      int i = __builtin_ctz (mask);
+      if (ptr[i+2] == third)
+        return ptr + i;
+      mask &= mask - 1;
+      }
+    ptr += 16;
+    }
+#endif
+
+  return findPatternScalar (ptr, end, third);
+  }
+//}}}
+//{{{
+const uint8_t* cStartCode::findPatternScalar (const uint8_t* ptr, const uint8_t* end, uint8_t third) {
+// looks at every third byte, only a 0 or the third byte can be part of a match
+
+  if (end - ptr < 3)
+    return nullptr;
+
+  ptr += 2;
+  while (ptr < end) {
+    if (*ptr == 0)
+      ptr++;
+    else if (*ptr != third)
+      ptr += 3;
+    else if (!ptr[-1] && !ptr[-2])
+      return ptr - 2;
+    else
+      ptr += 3;
+    }
+
+  return nullptr;
+  }
+//}}}
@@ -0,0 +1,32 @@
+// cStartCode.h - 00 00 01 start code and 00 00 03 emulation prevention scan, neon or sse2, scalar tail
+//{{{  includes
+#pragma once
+
+#include <stdint.h>
+#include <string>
+//}}}
+
+class cStartCode {
+public:
+  static const char* getSimdName();
+
+  // first 00 00 01 wholly inside ptr..end, nullptr if none
+  static const uint8_t* find (const uint8_t* ptr, const uint8_t* end) { return findPattern (ptr, end, 1); }
+  static const uint8_t* findScalar (const uint8_t* ptr, const uint8_t* end) { return findPatternScalar (ptr, end, 1); }
+
+  // first 00 00 03 wholly inside ptr..end, nullptr if none
+  static const uint8_t* findEscape (const uint8_t* ptr, const uint8_t* end) { return findPattern (ptr, end, 3); }
+
+  // nal payload to rbsp, drops each 00 00 03's 03, dst at least size, returns rbsp size, in place ok
+  static int unescape (const uint8_t* src, int size, uint8_t* dst);
+
+  // mpeg2 picture_coding_type of the first picture header, 1 I, 2 P, 3 B, 0 none found
+  static int getMpeg2PictureType (const uint8_t* data, int size);
+
+  // scan a real stream from file held in memory, simd against scalar, GB/s
+  static void bench (const std::string& fileName, float secs);
+
+private:
+  static const uint8_t* findPattern (const uint8_t* ptr, const uint8_t* end, uint8_t third);
+  static const uint8_t* findPatternScalar (const uint8_t* ptr, const uint8_t* end, uint8_t third);
+  };
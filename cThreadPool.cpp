@@ -0,0 +1,329 @@
+// cThreadPool.cpp - owns the long lived threads, affinity and scheduling by role, timed joins, per thread cpu
+//{{{  includes
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <chrono>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cThreadPool.h"
+#include "cTracer.h"
+
+using namespace std;
+//}}}
+//{{{
+const char* kRoleNames[eRoleCount] = {
+  "ui", "dvbCap", "dvbGrab", "dvbRead", "play", "vid", "aud", "bgnd" };
+//}}}
+
+//{{{
+static double getCpuSecs (clockid_t clockId) {
+
+  struct timespec ts;
+  if (clock_gettime (clockId, &ts) != 0)
+    return 0.0;
+  return ts.tv_sec + (ts.tv_nsec / 1e9);
+  }
+//}}}
+//{{{
+static uint32_t parseCpus (const string& cpus) {
+// 1-3 or 0,2 or 0,2-3
+
+  uint32_t mask = 0;
+  size_t pos = 0;
+  while (pos < cpus.size()) {
+    size_t comma = cpus.find (',', pos);
+    string range = cpus.substr (pos, (comma == string::npos) ? string::npos : comma - pos);
+
+    int first = atoi (range.c_str());
+    int last = first;
+    size_t dash = range.find ('-');
+    if (dash != string::npos)
+      last = atoi (range.c_str() + dash + 1);
+    for (int cpu = first; (cpu <= last) && (cpu < 32); cpu++)
+      mask |= 1u << cpu;
+
+    if (comma == string::npos)
+      break;
+    pos = comma + 1;
+    }
+
+  return mask;
+  }
+//}}}
+
+// cThreadPolicy
+//{{{
+string cThreadPolicy::getString() {
+
+  string str = mCpus ? "cpus:" + hex(mCpus) : "cpus:any";
+  switch (mSched) {
+    case SCHED_FIFO: str += " fifo:" + dec(mPriority); break;
+    case SCHED_RR:   str += " rr:" + dec(mPriority); break;
+    case SCHED_IDLE: str += " idle"; break;
+    default: break;
+    }
+  if (mNice)
+    str += " nice:" + dec(mNice);
+  return str;
+  }
+//}}}
+
+// cThreadPool
+//{{{
+cThreadPool::cThreadPool() : mShared (make_shared<cShared>()) {
+// dvb capture and grab keep the core the usb interrupts land on, decode and demux kept off it
+
+  int maxRr = sched_get_priority_max (SCHED_RR);
+  mPolicies[eRoleDvbCapture].mSched = SCHED_RR;
+  mPolicies[eRoleDvbCapture].mPriority = maxRr;
+  mPolicies[eRoleDvbGrab].mSched = SCHED_RR;
+  mPolicies[eRoleDvbGrab].mPriority = maxRr - 1;
+  mPolicies[eRoleBackground].mNice = 19;
+
+  if (sysconf (_SC_NPROCESSORS_ONLN) >= 4) {
+    mPolicies[eRoleDvbCapture].mCpus = 0x1;
+    mPolicies[eRoleDvbGrab].mCpus = 0x1;
+    mPolicies[eRolePlayer].mCpus = 0xE;
+    mPolicies[eRoleVideo].mCpus = 0xE;
+    mPolicies[eRoleAudio].mCpus = 0xE;
+    mPolicies[eRoleBackground].mCpus = 0xE;
+    }
+  }
+//}}}
+
+//{{{
+const char* cThreadPool::getRoleName (eThreadRole role) {
+  return (role < eRoleCount) ? kRoleNames[role] : "unknown";
+  }
+//}}}
+
+//{{{
+bool cThreadPool::setPolicy (const string& spec) {
+
+  size_t colon = spec.find (':');
+  string roleName = spec.substr (0, colon);
+
+  int role = 0;
+  while ((role < eRoleCount) && (roleName != kRoleNames[role]))
+    role++;
+  if (role == eRoleCount) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " unknown role " + roleName);
+    return false;
+    }
+    //}}}
+
+  cThreadPolicy policy;
+  while (colon != string::npos) {
+    size_t next = spec.find (':', colon + 1);
+    string item = spec.substr (colon + 1, (next == string::npos) ? string::npos : next - colon - 1);
+    colon = next;
+
+    size_t equals = item.find ('=');
+    string key = item.substr (0, equals);
+    string value = (equals == string::npos) ? "" : item.substr (equals + 1);
+
+    if (key == "cpu")
+      policy.mCpus = parseCpus (value);
+    else if (key == "fifo") {
+      policy.mSched = SCHED_FIFO;
+      policy.mPriority = atoi (value.c_str());
+      }
+    else if (key == "rr") {
+      policy.mSched = SCHED_RR;
+      policy.mPriority = atoi (value.c_str());
+      }
+    else if (key == "idle")
+      policy.mSched = SCHED_IDLE;
+    else if (key == "nice")
+      policy.mNice = atoi (value.c_str());
+    else {
+      //{{{  error return
+      cLog::log (LOGERROR, string(__func__) + " unknown key " + key + " in " + spec);
+      return false;
+      }
+      //}}}
+    }
+
+  mPolicies[role] = policy;
+  cLog::log (LOGINFO, string(__func__) + " " + roleName + " " + policy.getString());
+  return true;
+  }
+//}}}
+
+//{{{
+int cThreadPool::launch (const string& name, eThreadRole role, function<void()> func) {
+
+  auto entry = make_shared<cEntry>();
+  entry->mName = name;
+  entry->mRole = role;
+  entry->mPolicy = mPolicies[role];
+
+  // thread gets shared state and its entry, never the pool
+  auto shared = mShared;
+  lock_guard<mutex> lockGuard (shared->mMutex);
+  int id = mNextId++;
+  mEntries[id] = entry;
+  entry->mThread = thread ([=]() { runEntry (shared, entry, func); });
+  return id;
+  }
+//}}}
+//{{{
+bool cThreadPool::join (int id, float timeoutSecs) {
+// wait for thread to finish its function, false and left running if it doesn't in time
+
+  unique_lock<mutex> lock (mShared->mMutex);
+
+  auto it = mEntries.find (id);
+  if (it == mEntries.end())
+    return true;
+  auto entry = it->second;
+
+  if (!mShared->mDoneCond.wait_for (lock, chrono::duration<float>(timeoutSecs), [=]() { return entry->mDone; })) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " " + entry->mName + " still running after " +
+                         frac(timeoutSecs, 4,1,' ') + "s");
+    return false;
+    }
+    //}}}
+
+  lock.unlock();
+  entry->mThread.join();
+  lock.lock();
+
+  cLog::log (LOGINFO1, string(__func__) + " " + entry->mName + " cpu:" + frac(entry->mCpuSecs, 6,2,' ') + "s");
+  mEntries.erase (id);
+  return true;
+  }
+//}}}
+//{{{
+void cThreadPool::joinAll (float timeoutSecs) {
+// on exit, anything stuck in a blocking read past the timeout is detached, we're going anyway,
+// it holds its entry and the shared state, so it can still finish after the pool is gone
+
+  report();
+
+  auto deadline = chrono::steady_clock::now() + chrono::duration<float>(timeoutSecs);
+
+  unique_lock<mutex> lock (mShared->mMutex);
+  while (!mEntries.empty()) {
+    auto it = mEntries.begin();
+    auto entry = it->second;
+
+    if (mShared->mDoneCond.wait_until (lock, deadline, [=]() { return entry->mDone; })) {
+      lock.unlock();
+      entry->mThread.join();
+      lock.lock();
+      }
+    else {
+      cLog::log (LOGERROR, string(__func__) + " " + entry->mName + " didn't exit, detached");
+      entry->mThread.detach();
+      }
+
+    mEntries.erase (it);
+    }
+  }
+//}}}
+
+//{{{
+double cThreadPool::getCpuSecs (int id) {
+
+  lock_guard<mutex> lockGuard (mShared->mMutex);
+
+  auto it = mEntries.find (id);
+  if (it == mEntries.end())
+    return 0.0;
+
+  auto entry = it->second;
+  return entry->mRunning ? ::getCpuSecs (entry->mClockId) : entry->mCpuSecs;
+  }
+//}}}
+//{{{
+void cThreadPool::report() {
+
+  lock_guard<mutex> lockGuard (mShared->mMutex);
+
+  for (auto& item : mEntries) {
+    auto entry = item.second;
+    double cpuSecs = entry->mRunning ? ::getCpuSecs (entry->mClockId) : entry->mCpuSecs;
+    cLog::log (LOGNOTICE, "thread " + entry->mName +
+                          " " + getRoleName (entry->mRole) +
+                          " " + entry->mPolicy.getString() +
+                          (entry->mPolicyOk ? "" : " policy failed") +
+                          " cpu:" + frac(cpuSecs, 7,2,' ') + "s" +
+                          (entry->mDone ? " done" : ""));
+    }
+  }
+//}}}
+
+// private
+//{{{
+bool cThreadPool::applyPolicy (const cThreadPolicy& policy) {
+// on the thread itself, rt priorities and negative nice need root, failures are logged and we carry on
+
+  bool ok = true;
+
+  if (policy.mCpus) {
+    cpu_set_t cpuSet;
+    CPU_ZERO (&cpuSet);
+    for (int cpu = 0; cpu < 32; cpu++)
+      if (policy.mCpus & (1u << cpu))
+        CPU_SET (cpu, &cpuSet);
+    if (pthread_setaffinity_np (pthread_self(), sizeof(cpuSet), &cpuSet) != 0) {
+      cLog::log (LOGERROR, string(__func__) + " affinity " + hex(policy.mCpus) + " failed");
+      ok = false;
+      }
+    }
+
+  sched_param schedParam;
+  memset (&schedParam, 0, sizeof(schedParam));
+  if ((policy.mSched == SCHED_FIFO) || (policy.mSched == SCHED_RR))
+    schedParam.sched_priority = policy.mPriority;
+  if ((policy.mSched != SCHED_OTHER) &&
+      (pthread_setschedparam (pthread_self(), policy.mSched, &schedParam) != 0)) {
+    cLog::log (LOGERROR, string(__func__) + " sched " + dec(policy.mSched) + ":" + dec(policy.mPriority) + " failed");
+    ok = false;
+    }
+
+  // nice is per thread on linux, by tid
+  if (policy.mNice && (setpriority (PRIO_PROCESS, (id_t)syscall (SYS_gettid), policy.mNice) != 0)) {
+    cLog::log (LOGERROR, string(__func__) + " nice " + dec(policy.mNice) + " failed");
+    ok = false;
+    }
+
+  return ok;
+  }
+//}}}
+//{{{
+void cThreadPool::runEntry (shared_ptr<cShared> shared, shared_ptr<cEntry> entry, function<void()> func) {
+// static, no pool access, a detached thread may finish after the pool is destroyed
+
+  cLog::setThreadName (entry->mName);
+  cTracer::setThreadName (entry->mName);
+
+  bool policyOk = applyPolicy (entry->mPolicy);
+
+  {
+  lock_guard<mutex> lockGuard (shared->mMutex);
+  entry->mPolicyOk = policyOk;
+  pthread_getcpuclockid (pthread_self(), &entry->mClockId);
+  entry->mRunning = true;
+  }
+
+  func();
+
+  double cpuSecs = ::getCpuSecs (CLOCK_THREAD_CPUTIME_ID);
+
+  lock_guard<mutex> lockGuard (shared->mMutex);
+  entry->mCpuSecs = cpuSecs;
+  entry->mRunning = false;
+  entry->mDone = true;
+  shared->mDoneCond.notify_all();
+  }
+//}}}
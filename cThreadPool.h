@@ -0,0 +1,95 @@
+// cThreadPool.h - owns the long lived threads, affinity and scheduling by role, timed joins, per thread cpu
+//{{{  includes
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+//}}}
+
+//{{{
+enum eThreadRole {
+  eRoleUi = 0,       // keyboard, window
+  eRoleDvbCapture,   // dvb frontend reads, the usb interrupt load
+  eRoleDvbGrab,
+  eRoleDvbRead,      // ts from file
+  eRolePlayer,       // demux, feeds the players
+  eRoleVideo,        // "vid " packets to omx
+  eRoleAudio,        // "aud " decode, mix, omx or sink
+  eRoleBackground,   // anything that can wait
+  eRoleCount
+  };
+//}}}
+//{{{
+class cThreadPolicy {
+public:
+  uint32_t mCpus = 0;          // affinity mask, 0 any
+  int mSched = SCHED_OTHER;    // SCHED_OTHER, SCHED_FIFO, SCHED_RR, SCHED_IDLE
+  int mPriority = 0;           // SCHED_FIFO, SCHED_RR only, 1..99
+  int mNice = 0;               // SCHED_OTHER, SCHED_IDLE only
+
+  std::string getString();
+  };
+//}}}
+
+class cThreadPool {
+public:
+  cThreadPool();
+  ~cThreadPool() { joinAll (1.f); }
+
+  static const char* getRoleName (eThreadRole role);
+
+  // role:key=value:..., keys cpu=1-3 or cpu=0,2 fifo=n rr=n idle nice=n, false if unparsable
+  bool setPolicy (const std::string& spec);
+  void setPolicy (eThreadRole role, const cThreadPolicy& policy) { mPolicies[role] = policy; }
+  cThreadPolicy getPolicy (eThreadRole role) { return mPolicies[role]; }
+
+  int launch (const std::string& name, eThreadRole role, std::function<void()> func);
+  bool join (int id, float timeoutSecs);
+  void joinAll (float timeoutSecs);
+
+  double getCpuSecs (int id);
+  void report();
+
+private:
+  //{{{
+  class cEntry {
+  public:
+    std::string mName;
+    eThreadRole mRole;
+    cThreadPolicy mPolicy;
+    std::thread mThread;
+
+    clockid_t mClockId = 0;
+    bool mRunning = false;
+    bool mDone = false;
+    double mCpuSecs = 0.0;
+    bool mPolicyOk = true;
+    };
+  //}}}
+  //{{{
+  class cShared {
+  // what a thread touches once launched, a detached thread keeps it alive past the pool
+  public:
+    std::mutex mMutex;
+    std::condition_variable mDoneCond;
+    };
+  //}}}
+
+  static bool applyPolicy (const cThreadPolicy& policy);
+  static void runEntry (std::shared_ptr<cShared> shared, std::shared_ptr<cEntry> entry, std::function<void()> func);
+
+  // vars
+  cThreadPolicy mPolicies[eRoleCount];
+
+  std::shared_ptr<cShared> mShared;
+  std::map <int, std::shared_ptr<cEntry>> mEntries;
+  int mNextId = 0;
+  };
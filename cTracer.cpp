@@ -0,0 +1,190 @@
+// cTracer.cpp - per thread ring buffer span tracer, writes chrome://tracing json, near free when disabled
+//{{{  includes
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <vector>
+#include <mutex>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cTracer.h"
+
+using namespace std;
+//}}}
+const uint32_t kRingEvents = 0x8000; // power of 2, oldest overwritten
+
+//{{{
+class cTraceEvent {
+public:
+  const char* mName;
+  int64_t mStartUs;
+  int64_t mDurUs; // -1 for instant
+  };
+//}}}
+//{{{
+class cTraceRing {
+// written only by its own thread, read by write() after the fact
+public:
+  cTraceRing (int tid, const string& name) : mTid(tid), mName(name), mEvents(kRingEvents) { mCount = 0; }
+
+  int mTid;
+  string mName;
+  vector<cTraceEvent> mEvents;
+  atomic<uint32_t> mCount;
+  };
+//}}}
+
+// rings outlive their threads so a trace still shows threads that have exited
+static mutex gRingsMutex;
+static vector<cTraceRing*> gRings;
+
+static thread_local cTraceRing* tRing = nullptr;
+static thread_local char tName[32] = { 0 };
+
+//{{{
+static cTraceRing* getRing() {
+
+  if (!tRing) {
+    int tid = (int)syscall (SYS_gettid);
+    tRing = new cTraceRing (tid, tName[0] ? string (tName) : "thread " + dec(tid));
+
+    lock_guard<mutex> lockGuard (gRingsMutex);
+    gRings.push_back (tRing);
+    }
+
+  return tRing;
+  }
+//}}}
+//{{{
+static string escape (const char* str) {
+// json string body, quotes, backslashes and control chars escaped
+
+  string escaped;
+  for (; *str; str++) {
+    if ((*str == '"') || (*str == '\\')) {
+      escaped += '\\';
+      escaped += *str;
+      }
+    else if ((uint8_t)*str < 0x20) {
+      char hexChars[8];
+      snprintf (hexChars, sizeof(hexChars), "\\u%04x", (uint8_t)*str);
+      escaped += hexChars;
+      }
+    else
+      escaped += *str;
+    }
+
+  return escaped;
+  }
+//}}}
+//{{{
+static void addEvent (const char* name, int64_t startUs, int64_t durUs) {
+
+  auto ring = getRing();
+  auto count = ring->mCount.load (memory_order_relaxed);
+
+  auto& event = ring->mEvents[count & (kRingEvents - 1)];
+  event.mName = name;
+  event.mStartUs = startUs;
+  event.mDurUs = durUs;
+
+  ring->mCount.store (count + 1, memory_order_release);
+  }
+//}}}
+
+atomic<bool> cTracer::mEnabled (false);
+
+//{{{
+int64_t cTracer::getUs() {
+
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return ((int64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+  }
+//}}}
+
+//{{{
+void cTracer::setEnabled (bool enabled) {
+
+  mEnabled = enabled;
+  cLog::log (LOGINFO, string(__func__) + (enabled ? " on" : " off"));
+  }
+//}}}
+//{{{
+void cTracer::setThreadName (const string& name) {
+// remember name for this thread's ring, ring is only allocated when something is traced
+
+  strncpy (tName, name.c_str(), sizeof(tName) - 1);
+  if (tRing)
+    tRing->mName = name;
+  }
+//}}}
+
+//{{{
+void cTracer::addSpan (const char* name, int64_t startUs, int64_t endUs) {
+  addEvent (name, startUs, endUs - startUs);
+  }
+//}}}
+//{{{
+void cTracer::addInstant (const char* name) {
+
+  if (isEnabled())
+    addEvent (name, getUs(), -1);
+  }
+//}}}
+//{{{
+bool cTracer::write (const string& fileName) {
+// chrome trace event json, complete X events and instant i events, thread names as metadata,
+// safe while tracing, each ring copied then anything its thread may have overwritten meanwhile dropped
+
+  FILE* file = fopen (fileName.c_str(), "w");
+  if (!file) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " unable to open " + fileName);
+    return false;
+    }
+    //}}}
+
+  lock_guard<mutex> lockGuard (gRingsMutex);
+
+  int events = 0;
+  vector<cTraceEvent> copy;
+  fprintf (file, "{\"traceEvents\":[\n");
+  for (auto ring : gRings) {
+    fprintf (file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+             events++ ? ",\n" : "", ring->mTid, escape (ring->mName.c_str()).c_str());
+
+    // only records published before the count was read, copied out before the producer can lap them
+    uint32_t count = ring->mCount.load (memory_order_acquire);
+    uint32_t first = (count > kRingEvents) ? count - kRingEvents : 0;
+    copy.clear();
+    for (uint32_t i = first; i < count; i++)
+      copy.push_back (ring->mEvents[i & (kRingEvents - 1)]);
+    atomic_thread_fence (memory_order_acquire);
+
+    // record n overwrites n - kRingEvents, the one being written now as well as those published
+    int64_t lapped = (int64_t)ring->mCount.load (memory_order_relaxed) + 1 - kRingEvents - first;
+    lapped = max ((int64_t)0, min (lapped, (int64_t)copy.size()));
+
+    for (size_t i = (size_t)lapped; i < copy.size(); i++) {
+      auto& event = copy[i];
+      if (event.mDurUs < 0)
+        fprintf (file, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%lld}",
+                 escape (event.mName).c_str(), ring->mTid, (long long)event.mStartUs);
+      else
+        fprintf (file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+                 escape (event.mName).c_str(), ring->mTid, (long long)event.mStartUs, (long long)event.mDurUs);
+      events++;
+      }
+    }
+  fprintf (file, "\n]}\n");
+  fclose (file);
+
+  cLog::log (LOGNOTICE, string(__func__) + " " + dec(events) + " events to " + fileName);
+  return true;
+  }
+//}}}
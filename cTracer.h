@@ -0,0 +1,44 @@
+// cTracer.h - per thread ring buffer span tracer, writes chrome://tracing json, near free when disabled
+//{{{  includes
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+//}}}
+
+class cTracer {
+public:
+  static bool isEnabled() { return mEnabled.load (std::memory_order_relaxed); }
+  static int64_t getUs();
+
+  static void setEnabled (bool enabled);
+  static void setThreadName (const std::string& name);
+
+  static void addSpan (const char* name, int64_t startUs, int64_t endUs);
+  static void addInstant (const char* name);
+  static bool write (const std::string& fileName);
+
+private:
+  static std::atomic<bool> mEnabled;
+  };
+
+//{{{
+class cTraceSpan {
+// scoped span, name must be a string literal, only records if tracer enabled on entry
+public:
+  cTraceSpan (const char* name) : mName(cTracer::isEnabled() ? name : nullptr) {
+    if (mName)
+      mStartUs = cTracer::getUs();
+    }
+
+  ~cTraceSpan() {
+    if (mName)
+      cTracer::addSpan (mName, mStartUs, cTracer::getUs());
+    }
+
+private:
+  const char* mName;
+  int64_t mStartUs = 0;
+  };
+//}}}
@@ -0,0 +1,154 @@
+// cWavSink.cpp - pcm sink to a WAVE_FORMAT_EXTENSIBLE s16 wav file, as fast as it is produced
+//{{{  includes
+#include <string.h>
+
+#include "../shared/utils/utils.h"
+#include "../shared/utils/cLog.h"
+
+#include "cOmxAv.h"
+#include "cWavSink.h"
+
+using namespace std;
+//}}}
+//{{{
+const uint32_t kChanMasks[9] = {
+  0,
+  SPEAKER_FRONT_CENTER,
+  SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT,
+  SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER,
+  SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT,
+  SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT,
+  SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY |
+    SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT,
+  SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY |
+    SPEAKER_BACK_CENTER | SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT,
+  SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY |
+    SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT | SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT
+  };
+//}}}
+
+//{{{
+cWavSink::~cWavSink() {
+
+  if (mFile) {
+    writeHeader();
+    fclose (mFile);
+    cLog::log (LOGNOTICE, "cWavSink " + getDebugString());
+    }
+  }
+//}}}
+
+//{{{
+bool cWavSink::open (int sampleRate, int chans, uint64_t chanLayout) {
+
+  mFile = fopen (mFileName.c_str(), "wb");
+  if (!mFile) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " unable to open " + mFileName);
+    return false;
+    }
+    //}}}
+
+  mSampleRate = sampleRate;
+  mChans = chans;
+  mChanLayout = chanLayout;
+  mDataBytes = 0;
+
+  // placeholder sizes, rewritten on drain and close
+  writeHeader();
+  return true;
+  }
+//}}}
+//{{{
+bool cWavSink::write (const int16_t* samples, int frames) {
+
+  if (!mFile)
+    return false;
+
+  uint32_t bytes = frames * mChans * sizeof(int16_t);
+  if (mDataBytes + (uint64_t)bytes > 0xFFFFFF00u) {
+    //{{{  error return, riff sizes are 32bit
+    cLog::log (LOGERROR, string(__func__) + " " + mFileName + " full");
+    return false;
+    }
+    //}}}
+
+  if (fwrite (samples, 1, bytes, mFile) != bytes) {
+    //{{{  error return
+    cLog::log (LOGERROR, string(__func__) + " " + mFileName + " write failed");
+    return false;
+    }
+    //}}}
+
+  mDataBytes += bytes;
+  return true;
+  }
+//}}}
+//{{{
+void cWavSink::drain() {
+// eos, leave a complete file behind even if we never close
+
+  if (mFile) {
+    writeHeader();
+    fflush (mFile);
+    }
+  }
+//}}}
+
+//{{{
+string cWavSink::getDebugString() {
+
+  double secs = (mSampleRate && mChans) ? (double)mDataBytes / (mSampleRate * mChans * sizeof(int16_t)) : 0.0;
+  return "wav " + mFileName + " " + frac(secs, 6,1,' ') + "s";
+  }
+//}}}
+
+// private
+//{{{
+uint32_t cWavSink::getChanMask() {
+// AV_CH_ bits are the SPEAKER_ bits, first 18 of them, the layout is used if it matches the chans,
+// else guessed from the count, 3.0 and 2.1 or 5.0 and quad+lfe can't be told apart that way
+
+  uint32_t mask = (uint32_t)(mChanLayout & 0x3FFFF);
+  if (mask && (__builtin_popcount (mask) == mChans))
+    return mask;
+
+  return (mChans <= 8) ? kChanMasks[mChans] : 0;
+  }
+//}}}
+//{{{
+void cWavSink::writeHeader() {
+// riff wave, fmt chunk is WAVEFORMATEXTENSIBLE, data chunk follows, file position kept
+
+  WAVEFORMATEXTENSIBLE format;
+  memset (&format, 0, sizeof(format));
+  format.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+  format.Format.nChannels = mChans;
+  format.Format.nSamplesPerSec = mSampleRate;
+  format.Format.nBlockAlign = mChans * sizeof(int16_t);
+  format.Format.nAvgBytesPerSec = mSampleRate * format.Format.nBlockAlign;
+  format.Format.wBitsPerSample = 16;
+  format.Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+  format.Samples.wValidBitsPerSample = 16;
+  format.dwChannelMask = getChanMask();
+  format.SubFormat = KSDATAFORMAT_SUBTYPE_PCM;
+
+  uint32_t fmtBytes = sizeof(format);
+  uint32_t riffBytes = 4 + (8 + fmtBytes) + (8 + mDataBytes);
+
+  long pos = ftell (mFile);
+  fseek (mFile, 0, SEEK_SET);
+
+  fwrite ("RIFF", 1, 4, mFile);
+  fwrite (&riffBytes, 4, 1, mFile);
+  fwrite ("WAVE", 1, 4, mFile);
+  fwrite ("fmt ", 1, 4, mFile);
+  fwrite (&fmtBytes, 4, 1, mFile);
+  fwrite (&format, fmtBytes, 1, mFile);
+  fwrite ("data", 1, 4, mFile);
+  fwrite (&mDataBytes, 4, 1, mFile);
+
+  if (pos > ftell (mFile))
+    fseek (mFile, pos, SEEK_SET);
+  }
+//}}}
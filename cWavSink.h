@@ -0,0 +1,37 @@
+// cWavSink.h - pcm sink to a WAVE_FORMAT_EXTENSIBLE s16 wav file, as fast as it is produced
+//{{{  includes
+#pragma once
+
+#include <stdio.h>
+
+#include "cAudioSink.h"
+//}}}
+
+class cWavSink : public cAudioSink {
+public:
+  cWavSink (const std::string& fileName) : mFileName(fileName) {}
+  virtual ~cWavSink();
+
+  bool isRealtime() { return false; }
+
+  bool open (int sampleRate, int chans, uint64_t chanLayout);
+  bool write (const int16_t* samples, int frames);
+  void flush() {}
+  void drain();
+
+  double getDelay() { return 0.0; }
+  std::string getDebugString();
+
+private:
+  uint32_t getChanMask();
+  void writeHeader();
+
+  // vars
+  std::string mFileName;
+  FILE* mFile = nullptr;
+
+  int mSampleRate = 0;
+  int mChans = 0;
+  uint64_t mChanLayout = 0;
+  uint32_t mDataBytes = 0;
+  };
@@ -8,8 +8,12 @@
 #include <ftw.h>
 
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <thread>
+#include <mutex>
 
 #include "../shared/utils/date.h"
 #include "../shared/utils/utils.h"
@@ -26,6 +30,13 @@
 #include "cOmxClock.h"
 #include "cOmxReader.h"
 #include "cOmxAv.h"
+#include "cOmxStats.h"
+#include "cMediaInfo.h"
+#include "cRecorder.h"
+#include "cThreadPool.h"
+#include "cMemoryBudget.h"
+#include "cStartCode.h"
+#include "cTracer.h"
 
 #include "../shared/nanoVg/cRaspWindow.h"
 #include "../shared/widgets/cTextBox.h"
@@ -42,6 +53,11 @@ using namespace std;
 //}}}
 
 volatile sig_atomic_t gAbort = false;
+
+// power map box copy, secs either side of play pts, refreshed this often
+const double kPowerMapSecs = 30.0;
+const double kPowerMapPublishSecs = 0.1;
+
 //{{{
 void sigHandler (int sig) {
 
@@ -57,6 +73,33 @@ void sigHandler (int sig) {
   abort();
   }
 //}}}
+//{{{
+void benchEventCheck() {
+// time the two per input buffer decoder event checks, idle and with an event pending
+
+  const int kChecks = 1000000;
+  cOmxCore core;
+
+  auto start = chrono::steady_clock::now();
+  int hits = 0;
+  for (int i = 0; i < kChecks; i++) {
+    hits += core.waitEvent (OMX_EventPortSettingsChanged, 0) == OMX_ErrorNone;
+    hits += core.waitEvent (OMX_EventParamOrConfigChanged, 0) == OMX_ErrorNone;
+    }
+  double idleNs = chrono::duration<double,nano>(chrono::steady_clock::now() - start).count() / kChecks;
+
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < kChecks; i++) {
+    core.addEvent (OMX_EventPortSettingsChanged, 0, 0);
+    hits += core.waitEvent (OMX_EventPortSettingsChanged, 0) == OMX_ErrorNone;
+    hits += core.waitEvent (OMX_EventParamOrConfigChanged, 0) == OMX_ErrorNone;
+    }
+  double pendingNs = chrono::duration<double,nano>(chrono::steady_clock::now() - start).count() / kChecks;
+
+  cLog::log (LOGNOTICE, "eventCheck per buffer idle:" + frac(idleNs,6,1,' ') +
+                        "ns pending:" + frac(pendingNs,6,1,' ') + "ns hits:" + dec(hits));
+  }
+//}}}
 
 class cAppWindow : public cRaspWindow {
 public:
@@ -66,56 +109,86 @@ public:
     mDebugStr = "omx " + root + " " + string(VERSION_DATE);
 
     mKeyboard.setKeymap (cKeyConfig::getKeymap());
-    thread ([=]() { mKeyboard.run(); } ).detach();
     }
   //}}}
   //{{{
   void run (const string& inTs, int frequency) {
 
+    mThreads.launch ("key", eRoleUi, [=]() { mKeyboard.run(); });
+
     initialise (1.f, 0);
     setChangeCountDown (4);
 
     add (new cTextBox (mDebugStr, 0.f));
+    add (new cTextBox (mInfoStr, 0.f));
     if (frequency) {
       add (new cTextBox (mDvb.mPacketStr, 15.f));
       add (new cTextBox (mDvb.mSignalStr, 14.f));
       add (new cTextBox (mDvb.mTuneStr, 13.f));
       mTsBox = add (new cTransportStreamBox (&mDvb.mTs, 0.f,-2.f));
       }
-    float list = frequency ? 2.f : 1.0f;
+    float list = frequency ? 3.f : 2.f;
     mListWidget = addAt (new cListWidget (mFileNames, mFileNum, mFileChanged, 0.f,-list), 0.f,list);
     addBottomRight (new cTimecodeBox (mPlayPts, mLengthPts, 17.f, 2.f));
     addBottomRight (new cPowerBox (mPower, mChans, 4.f, 2.f));
-    addBottomLeft (new cPowerMapBox (mPlayPts, mPowerMap, mChans, 0.f, 4.f));
+    addBottomLeft (new cLockedPowerMapBox (mPowerMapMutex, mPlayPts, mPowerMap, mChans, 0.f, 4.f));
 
+    if (mInfoThreads)
+      mInfoPool = new cMediaInfoPool (mInfoCacheDir, mInfoThreads);
     updateFileNames();
 
-    thread dvbCaptureThread;
-    thread dvbGrabThread;
     if (frequency) {
-      // launch dvbThread
-      dvbCaptureThread = thread ([=]() { mDvb.captureThread (frequency); });
-      sched_param sch_params;
-      sch_params.sched_priority = sched_get_priority_max (SCHED_RR);
-      pthread_setschedparam (dvbCaptureThread.native_handle(), SCHED_RR, &sch_params);
-      dvbCaptureThread.detach();
-
-      dvbGrabThread = thread ([=]() { mDvb.grabThread(); } );
-      sch_params.sched_priority = sched_get_priority_max (SCHED_RR)-1;
-      pthread_setschedparam (dvbGrabThread.native_handle(), SCHED_RR, &sch_params);
-      dvbGrabThread.detach();
+      mThreads.launch ("dvbCap", eRoleDvbCapture, [=]() { mDvb.captureThread (frequency); });
+      mThreads.launch ("dvbGrab", eRoleDvbGrab, [=]() { mDvb.grabThread(); });
       }
     else if (!inTs.empty())
-      thread ([=]() { mDvb.readThread (inTs); } ).detach();
+      mThreads.launch ("dvbRead", eRoleDvbRead, [=]() { mDvb.readThread (inTs); });
 
-    thread ([=]() { player (mFileNames[mFileNum]); } ).detach();
+    int playerThread = mThreads.launch ("play", eRolePlayer, [=]() { player (mFileNames[mFileNum]); });
 
     cRaspWindow::run();
+
+    // player sees exit, tears down the players, then anything still blocked is left behind
+    mExit = true;
+    if (mThreads.join (playerThread, 5.f)) {
+      // player reads it every loop, its workers are joined and stats logged here
+      delete mInfoPool;
+      mInfoPool = nullptr;
+      }
+    mThreads.joinAll (1.f);
     }
   //}}}
   cOmxVideoConfig mVideoConfig;
   cOmxAudioConfig mAudioConfig;
 
+  // long lived threads, role policies set before run
+  cThreadPool mThreads;
+
+  // prebuffer, hold clock until queues reach high watermark, rebuffer below low watermark
+  float mPrebufferSecs = 1.f;
+  float mUnderrunSecs = 0.1f;
+  float mPrebufferTimeout = 5.f;
+
+  // seek, shorter watermark before clock restarts, scripted seeks to benchmark seek to first frame
+  float mSeekPrebufferSecs = 0.25f;
+  int mSeekScript = 0;
+  bool mAccurateSeek = false;
+
+  // video decode on the arm cores even when videocore has a decoder for it
+  bool mSwVideo = false;
+
+  // record while watching, raw input or one stream's packets, through a writer thread
+  string mRecordFileName;
+  int mRecordStream = -1;
+  float mRecordLatencyMs = 250.f;
+
+  // file list info, background pool, 0 threads for none
+  int mInfoThreads = 1;
+  string mInfoCacheDir = "/home/pi/.omxinfo";
+
+  // chrome trace json written here when player exits, empty for none
+  string mTraceFileName;
+
 protected:
   //{{{
   class cKeyConfig {
@@ -217,6 +290,23 @@ protected:
     };
   //}}}
   //{{{
+  class cLockedPowerMapBox : public cPowerMapBox {
+  // draws under mPowerMapMutex, player thread swaps the copy under it
+  public:
+    cLockedPowerMapBox (mutex& powerMapMutex, double& playPts, map <uint64_t,array<float,6>>*& powerMap,
+                        int& chans, float width, float height)
+      : cPowerMapBox (playPts, powerMap, chans, width, height), mPowerMapMutex(powerMapMutex) {}
+
+    void onDraw (iDraw* draw) {
+      lock_guard<mutex> lockGuard (mPowerMapMutex);
+      cPowerMapBox::onDraw (draw);
+      }
+
+  private:
+    mutex& mPowerMapMutex;
+    };
+  //}}}
+  //{{{
   void pollKeyboard() {
 
     //cLog::log (LOGINFO, "pollKeyboard");
@@ -273,10 +363,10 @@ protected:
 
       case cKeyConfig::ACT_PLAYPAUSE: mPause = !mPause; break;
       case cKeyConfig::ACT_STEP: mOmxClock.step (1); break;
-      case cKeyConfig::ACT_SEEK_DEC_SMALL: mSeekIncSec = -10.0; break;
-      case cKeyConfig::ACT_SEEK_INC_SMALL: mSeekIncSec = +10.0; break;
-      case cKeyConfig::ACT_SEEK_DEC_LARGE: mSeekIncSec = -60.0; break;
-      case cKeyConfig::ACT_SEEK_INC_LARGE: mSeekIncSec = +60.0; break;
+      case cKeyConfig::ACT_SEEK_DEC_SMALL: addSeek (-10); break;
+      case cKeyConfig::ACT_SEEK_INC_SMALL: addSeek (+10); break;
+      case cKeyConfig::ACT_SEEK_DEC_LARGE: addSeek (-60); break;
+      case cKeyConfig::ACT_SEEK_INC_LARGE: addSeek (+60); break;
 
       //{{{
       case cKeyConfig::ACT_DEC_VOLUME:
@@ -332,6 +422,8 @@ private:
 
     mFileNames.clear();
     nftw (mRoot.c_str(), addFile, 20, 0);
+    if (mInfoPool)
+      mInfoPool->add (mFileNames);
     changed();
     }
   //}}}
@@ -339,8 +431,6 @@ private:
   //{{{
   void player (string fileName) {
 
-    cLog::setThreadName ("play");
-
     //{{{  set videoConfig aspect
     TV_DISPLAY_STATE_T state;
     memset (&state, 0, sizeof(TV_DISPLAY_STATE_T));
@@ -381,6 +471,16 @@ private:
     vc_dispmanx_update_submit_sync (update);
     //}}}
 
+    if (!mRecordFileName.empty()) {
+      mRecorder = new cRecorder (mRecordFileName, mRecordStream, mRecordLatencyMs);
+      if (mRecorder->start())
+        mOmxReader.setRecorder (mRecorder);
+      else {
+        delete mRecorder;
+        mRecorder = nullptr;
+        }
+      }
+
     bool ok = true;
     while (ok) {
       cLog::log (LOGINFO, "opening " + fileName);
@@ -406,7 +506,13 @@ private:
       fileName = mFileNames[mFileNum];
       }
 
+    mOmxReader.setRecorder (nullptr);
+    delete mRecorder;
+    mRecorder = nullptr;
+
     cLog::log (LOGNOTICE, "player - exit");
+    if (!mTraceFileName.empty())
+      cTracer::write (mTraceFileName);
 
     // make sure everybody sees exit
     mExit = true;
@@ -425,10 +531,11 @@ private:
     if (mOmxReader.getVideoStreamCount())
       mOmxVideoPlayer = new cOmxVideoPlayer();
     mOmxReader.getHints (OMXSTREAM_VIDEO, mVideoConfig.mHints);
+    mVideoConfig.mHints.software = mSwVideo;
 
     if (mOmxVideoPlayer) {
       if (mOmxVideoPlayer->open (&mOmxClock, mVideoConfig))
-        thread ([=]() { mOmxVideoPlayer->run ("vid "); } ).detach();
+        mVideoThread = mThreads.launch ("vid ", eRoleVideo, [=]() { mOmxVideoPlayer->run ("vid "); });
       else {
         delete (mOmxVideoPlayer);  // crashes
         mOmxVideoPlayer = nullptr;
@@ -442,15 +549,18 @@ private:
 
     if (mOmxAudioPlayer) {
       if (mOmxAudioPlayer->open (&mOmxClock, mAudioConfig))
-        thread ([=]() { mOmxAudioPlayer->run("aud "); } ).detach();
+        mAudioThread = mThreads.launch ("aud ", eRoleAudio, [=]() { mOmxAudioPlayer->run ("aud "); });
       else {
         delete (mOmxAudioPlayer);  // crashes ?
         mOmxAudioPlayer = nullptr;
         }
       }
 
-    mOmxClock.reset (mOmxVideoPlayer, mOmxAudioPlayer);
+    resetClock();
     mOmxClock.stateExecute();
+
+    if (!mStats.create())
+      cLog::log (LOGERROR, "unable to create stats " + string(kOmxStatsName));
     }
   //}}}
   //{{{
@@ -460,38 +570,71 @@ private:
     bool submitEos = false;
     double lastSeekPosSec = 0.0;
 
+    mBuffering = true;
+    mBufferTargetSecs = mPrebufferSecs;
+    bool stalled = false;
+    double bufferingStart = mOmxClock.getAbsoluteClock();
+    double statsTime = 0.0;
+    double memoryTime = 0.0;
+
+    mSeeking = false;
+    mSeekIncSec = 0;
+
     cOmxPacket* packet = nullptr;
     while (!mEntered && !mExit && !gAbort) {
-      if (mSeekIncSec != 0.0) {
-        //{{{  seek
+      if (mSeekIncSec != 0) {
+        //{{{  seek, replaces one still in flight, increments made meanwhile coalesced
+        cTraceSpan span ("seek");
+        if (mSeeking)
+          cLog::log (LOGINFO, "seek replaced after " +
+                              frac((mOmxClock.getAbsoluteClock() - mSeekStart) / 1000.0, 5,1,' ') + "ms");
+        mSeeking = false;
+        mSeekStart = mOmxClock.getAbsoluteClock();
+        mSeeks++;
+
         double pts = mOmxClock.getMediaTime();
-        double seekPosSec = (pts ? (pts / 1000000.0) : lastSeekPosSec) + mSeekIncSec;
+        double seekPosSec = (pts ? (pts / 1000000.0) : lastSeekPosSec) + mSeekIncSec.exchange (0);
         lastSeekPosSec = seekPosSec;
 
         double seekPts = 0;
-        if (mOmxReader.seek (seekPosSec, seekPts)) {
+        bool seeked = mOmxReader.seek (seekPosSec, seekPts, mAccurateSeek);
+        if (seeked) {
           mOmxClock.stop();
           mOmxClock.pause();
 
-          if (mOmxVideoPlayer)
-            mOmxVideoPlayer->flush();
-          if (mOmxAudioPlayer)
-            mOmxAudioPlayer->flush();
+          flushPlayers();
           delete (packet);
           packet = nullptr;
 
           if (pts != kNoPts)
             mOmxClock.setMediaTime (seekPts);
           }
-
-        sentStarted = false;
-
-        if (mOmxVideoPlayer)
+        else if (mOmxVideoPlayer)
           mOmxVideoPlayer->reset();
+
+        // restart clock now, waits for start time from the primed decoders
         mOmxClock.pause();
+        resetClock();
+        sentStarted = true;
 
-        cLog::log (LOGINFO, "seekPos:"  + frac(seekPosSec,6,5,' '));
-        mSeekIncSec = 0.0;
+        if (seeked) {
+          mSeekFrames = mOmxVideoPlayer ? mOmxVideoPlayer->getRenderedFrames() : -1;
+          mSeekDecodeOnlyPackets = mOmxVideoPlayer ? mOmxVideoPlayer->getDecodeOnlyPackets() : 0;
+          mSeekDecodeOnlyUs = mOmxVideoPlayer ? mOmxVideoPlayer->getDecodeOnlyUs() : 0;
+          int primed = primePlayers (packet);
+          mSeeking = true;
+          cLog::log (LOGINFO, "seekPos:"  + frac(seekPosSec,6,5,' ') + " primed:" + dec(primed) +
+                              " took:" + frac((mOmxClock.getAbsoluteClock() - mSeekStart) / 1000.0, 5,1,' ') + "ms");
+          }
+        else {
+          mSeekDone = mOmxClock.getAbsoluteClock();
+          cLog::log (LOGERROR, "seekPos:"  + frac(seekPosSec,6,5,' ') + " failed");
+          }
+
+        mBuffering = true;
+        mBufferTargetSecs = mSeekPrebufferSecs;
+        stalled = false;
+        bufferingStart = mOmxClock.getAbsoluteClock();
         }
         //}}}
 
@@ -506,28 +649,153 @@ private:
                  " vol:" + frac(mOmxAudioPlayer ? mOmxAudioPlayer->getVolume() : 0.f, 3,2,' ') +
                  " " + string(mOmxVideoPlayer ? mOmxVideoPlayer->getDebugString() : "noVideo") +
                  " " + string(mOmxAudioPlayer ? mOmxAudioPlayer->getDebugString() : "noAudio") +
-                 " " + string(mPause ? "paused":"playing");
+                 " " + cMemoryBudget::get().getDebugString() +
+                 " stalls:" + dec(mStalls) + "/" + frac(mStallSecs, 4,1,' ') + "s" +
+                 " " + string(mPause ? "paused" : mBuffering ? "buffering" : "playing") +
+                 (mRecorder ? " " + mRecorder->getDebugString() : "");
       mDebugStr = str;
+
+      if (mInfoPool) {
+        // highlighted file, background yields while playback is short of data
+        mInfoPool->setYield (mBuffering || mSeeking);
+        if (mFileNum < mFileNames.size())
+          mInfoStr = mInfoPool->getString (mFileNames[mFileNum]);
+        }
       //{{{  update power
       if (mOmxAudioPlayer) {
         mChans = mOmxAudioPlayer->getChans();
         mPower = mOmxAudioPlayer->getPower (mPlayPts);
-        mPowerMap = mOmxAudioPlayer->getPowerMap();
+        double now = mOmxClock.getAbsoluteClock();
+        if ((now - mPowerMapPublished > kPowerMapPublishSecs * kPtsScale) || !mPowerMap) {
+          // copy outside the lock, swap it in under the lock the box draws with
+          map <uint64_t,array<float,6>> powerMap;
+          mOmxAudioPlayer->getPowerMap (mPlayPts, kPowerMapSecs, powerMap);
+          lock_guard<mutex> lockGuard (mPowerMapMutex);
+          mPowerMapCopy.swap (powerMap);
+          mPowerMap = &mPowerMapCopy;
+          mPowerMapPublished = now;
+          }
         }
       else {
         mPower = {0.f};
+        lock_guard<mutex> lockGuard (mPowerMapMutex);
         mPowerMap = nullptr;
         }
       //}}}
 
+      //{{{  prebuffer watermark
+      double now = mOmxClock.getAbsoluteClock();
+      if (mBuffering) {
+        if (mOmxReader.isEof() ||
+            ((now - bufferingStart) > (mPrebufferTimeout * kPtsScale)) ||
+            (isBuffered (mOmxVideoPlayer) && isBuffered (mOmxAudioPlayer))) {
+          mBuffering = false;
+          if (stalled)
+            mStallSecs += (now - bufferingStart) / kPtsScale;
+          cLog::log (LOGINFO, string(stalled ? "stall" : "prebuffer") +
+                              " took:" + frac((now - bufferingStart) / kPtsScale, 5,3,' ') + "s" +
+                              " v:" + frac(mOmxVideoPlayer ? mOmxVideoPlayer->getCacheDuration() : 0.0, 5,2,' ') +
+                              " a:" + frac(mOmxAudioPlayer ? mOmxAudioPlayer->getCacheDuration() : 0.0, 5,2,' '));
+          }
+        }
+      else if (!mPause && !packet && !mOmxReader.isEof() &&
+               (isUnderrun (mOmxVideoPlayer) || isUnderrun (mOmxAudioPlayer))) {
+        // starved of input, not held up by a full cache
+        mBuffering = true;
+        mBufferTargetSecs = mPrebufferSecs;
+        stalled = true;
+        bufferingStart = now;
+        mStalls++;
+        cLog::log (LOGINFO, "underrun " + dec(mStalls));
+        }
+      //}}}
+      if (mSeeking) {
+        //{{{  seek complete on first frame rendered after flush, clock running if no frame count, refilled if paused
+        int frames = mOmxVideoPlayer ? mOmxVideoPlayer->getRenderedFrames() : -1;
+        bool shown = ((frames >= 0) && (mSeekFrames >= 0)) ? (frames > mSeekFrames) : !mOmxClock.isPaused();
+
+        if (!shown && mPause && !mBuffering) {
+          // paused clock presents nothing, flushed and primed decoders refilled to the watermark is as far as it gets
+          mSeeking = false;
+          mSeekDone = now;
+          cLog::log (LOGINFO, "seek refilled while paused " + frac((now - mSeekStart) / 1000.0, 5,1,' ') + "ms");
+          }
+        else if (shown) {
+          mSeeking = false;
+          mSeekDone = now;
+          mSeekTimes.push_back ((now - mSeekStart) / 1000.0);
+
+          // decode only packets sent before first frame, the cost of accurate seek
+          int decodeOnlyPackets = mOmxVideoPlayer ? mOmxVideoPlayer->getDecodeOnlyPackets() - mSeekDecodeOnlyPackets : 0;
+          int decodeOnlyUs = mOmxVideoPlayer ? mOmxVideoPlayer->getDecodeOnlyUs() - mSeekDecodeOnlyUs : 0;
+          mSeekDecodeOnlyMs += decodeOnlyUs / 1000.0;
+          cLog::log (LOGINFO, "seek to first frame " + frac(mSeekTimes.back(), 5,1,' ') + "ms" +
+                              (mAccurateSeek ? " decodeOnly:" + dec(decodeOnlyPackets) +
+                                               " " + frac(decodeOnlyUs / 1000.0, 5,1,' ') + "ms" : ""));
+          }
+        else if ((now - mSeekStart) > (mPrebufferTimeout * kPtsScale)) {
+          mSeeking = false;
+          mSeekDone = now;
+          cLog::log (LOGERROR, "seek timeout, no frame after " + frac(mPrebufferTimeout, 4,1,' ') + "s");
+          }
+        }
+        //}}}
+      else if (mSeekScript) {
+        //{{{  scripted seeks, alternate forward and back once settled for a sec
+        if (mSeeks >= mSeekScript) {
+          logSeekTimes();
+          mSeekScript = 0;
+          }
+        else if (!mBuffering && !mPause && (mSeekIncSec == 0) && ((now - mSeekDone) > kPtsScale))
+          addSeek ((mSeeks & 1) ? -25 : +15);
+        }
+        //}}}
+
+      if (now - memoryTime > kPtsScale) {
+        // memory pressure, packet caches and power history shrink to their reduced limits
+        memoryTime = now;
+        cMemoryBudget::get().update();
+        }
+
+      if (now - statsTime > kPtsScale / 10.0) {
+        //{{{  publish stats, ten times a sec
+        statsTime = now;
+        auto stats = mStats.beginWrite();
+        if (stats) {
+          stats->mPlayPts = mPlayPts;
+          stats->mLengthPts = mLengthPts;
+
+          stats->mVideoPackets = mVideoPackets;
+          stats->mAudioPackets = mAudioPackets;
+          stats->mVideoQueue = mOmxVideoPlayer ? mOmxVideoPlayer->getNumPackets() : 0;
+          stats->mAudioQueue = mOmxAudioPlayer ? mOmxAudioPlayer->getNumPackets() : 0;
+          stats->mVideoCacheBytes = mOmxVideoPlayer ? mOmxVideoPlayer->getPacketCacheSize() : 0;
+          stats->mAudioCacheBytes = mOmxAudioPlayer ? mOmxAudioPlayer->getPacketCacheSize() : 0;
+          stats->mVideoInputSpace = mOmxVideoPlayer ? mOmxVideoPlayer->getInputBufferSpace() : 0;
+          stats->mAudioInputSpace = mOmxAudioPlayer ? mOmxAudioPlayer->getLastInputBufferSpace() : 0;
+
+          stats->mClockAdjustment = mOmxClock.getClockAdjustment();
+          stats->mAudioDelay = mOmxAudioPlayer ? mOmxAudioPlayer->getDelay() : 0.0;
+
+          stats->mVideoEos = mOmxVideoPlayer && mOmxVideoPlayer->isEOS();
+          stats->mAudioEos = mOmxAudioPlayer && mOmxAudioPlayer->isEOS();
+          stats->mPaused = mPause;
+          stats->mBuffering = mBuffering;
+          stats->mStalls = mStalls;
+          stats->mStallSecs = mStallSecs;
+          mStats.endWrite();
+          }
+        }
+        //}}}
+
       // pause control
-      if (mPause && !mOmxClock.isPaused()) {
+      if ((mPause || mBuffering) && !mOmxClock.isPaused()) {
         //{{{  pause
-        cLog::log (LOGINFO, "pause");
+        cLog::log (LOGINFO, mPause ? "pause" : "buffering");
         mOmxClock.pause();
         }
         //}}}
-      if (!mPause && mOmxClock.isPaused()) {
+      if (!mPause && !mBuffering && mOmxClock.isPaused()) {
         //{{{  resume
         cLog::log (LOGINFO, "resume");
         mOmxClock.resume();
@@ -536,34 +804,23 @@ private:
 
       if (!sentStarted) {
         //{{{  clock reset
-        mOmxClock.reset (mOmxVideoPlayer, mOmxAudioPlayer);
+        resetClock();
         sentStarted = true;
         }
         //}}}
 
-      if (!packet)
+      if (!packet) {
+        cTraceSpan span ("readPacket");
         packet = mOmxReader.readPacket();
+        }
       if (packet) {
         //{{{  got packet
         submitEos = false;
 
-        if (mOmxVideoPlayer && mOmxReader.isActive (OMXSTREAM_VIDEO, packet->mStreamIndex)) {
-          if (mOmxVideoPlayer->addPacket (packet))
-            packet = NULL;
-          else
-            mOmxClock.msSleep (20);
-          }
-
-        else if (mOmxAudioPlayer && mOmxReader.isActive (OMXSTREAM_AUDIO, packet->mStreamIndex)) {
-          if (mOmxAudioPlayer->addPacket (packet))
-            packet = NULL;
-          else
-            mOmxClock.msSleep (20);
-          }
-
-        else {
-          delete (packet);
-          packet = nullptr;
+        bool video = isVideo (packet);
+        if (!sendPacket (packet)) {
+          cTraceSpan span (video ? "videoFull" : "audioFull");
+          mOmxClock.msSleep (20);
           }
         }
         //}}}
@@ -596,26 +853,171 @@ private:
   //}}}
   //{{{
   void endPlay() {
+  // players' threads must be out of run before their player goes, one stuck in omx is leaked instead
 
     mOmxClock.stop();
     mOmxClock.stateIdle();
 
-    delete (mOmxVideoPlayer);
+    if (mOmxVideoPlayer)
+      mOmxVideoPlayer->abort();
+    if (mOmxAudioPlayer)
+      mOmxAudioPlayer->abort();
+
+    if ((mVideoThread < 0) || mThreads.join (mVideoThread, 2.f))
+      delete (mOmxVideoPlayer);
     mOmxVideoPlayer = nullptr;
+    mVideoThread = -1;
 
+    mPowerMapMutex.lock();
     mPowerMap = nullptr;
-    delete (mOmxAudioPlayer);
+    mPowerMapMutex.unlock();
+    if ((mAudioThread < 0) || mThreads.join (mAudioThread, 2.f))
+      delete (mOmxAudioPlayer);
     mOmxAudioPlayer = nullptr;
+    mAudioThread = -1;
+    }
+  //}}}
+
+  //{{{
+  void resetClock() {
+  // clock waits for start time from omx renders, a sink or sw video isn't one
+    mOmxClock.reset (mOmxVideoPlayer && !mOmxVideoPlayer->isSoftware(),
+                     mOmxAudioPlayer && !mOmxAudioPlayer->isSink());
+    }
+  //}}}
+  //{{{
+  void addSeek (int incSec) {
+  // called from keyboard thread, accumulates until playLoop takes it
+    mSeekIncSec += incSec;
+    }
+  //}}}
+  //{{{
+  void flushPlayers() {
+  // flush both omx graphs concurrently, each flush waits on its own components
+
+    thread audioFlush;
+    if (mOmxAudioPlayer)
+      audioFlush = thread ([=]() { mOmxAudioPlayer->flush(); } );
+
+    // video reset flushes
+    if (mOmxVideoPlayer)
+      mOmxVideoPlayer->reset();
+
+    if (audioFlush.joinable())
+      audioFlush.join();
+    }
+  //}}}
+  //{{{
+  int primePlayers (cOmxPacket*& packet) {
+  // after seek, queue packets up to and including the first of the primary stream,
+  // - the keyframe the demux landed on, so the decoder starts work before the clock runs
+
+    for (int packets = 0; packets < 200; packets++) {
+      packet = mOmxReader.readPacket();
+      if (!packet)
+        return packets;
+
+      bool primary = mOmxVideoPlayer ? isVideo (packet) : isAudio (packet);
+      if (!sendPacket (packet) || primary)
+        return packets + 1;
+      }
+
+    return 200;
+    }
+  //}}}
+  //{{{
+  void logSeekTimes() {
+  // seek to first frame percentiles over scripted seeks
+
+    if (mSeekTimes.empty()) {
+      cLog::log (LOGNOTICE, "seek bench - no seeks completed");
+      return;
+      }
+
+    auto times = mSeekTimes;
+    sort (times.begin(), times.end());
+    auto percentile = [&](double p) { return times[min (times.size() - 1, (size_t)(p * times.size()))]; };
+
+    cLog::log (LOGNOTICE, "seek bench " + dec((int)times.size()) + "/" + dec(mSeeks) +
+                          " p50:" + frac(percentile (0.5), 5,1,' ') + "ms" +
+                          " p99:" + frac(percentile (0.99), 5,1,' ') + "ms" +
+                          " max:" + frac(times.back(), 5,1,' ') + "ms" +
+                          " prebuffer:" + frac(mSeekPrebufferSecs, 4,2,' ') + "s" +
+                          (mAccurateSeek ? " accurate decodeOnly mean:" +
+                                           frac(mSeekDecodeOnlyMs / times.size(), 5,1,' ') + "ms" : ""));
+    }
+  //}}}
+
+  //{{{
+  bool isVideo (cOmxPacket* packet) {
+    return mOmxVideoPlayer && mOmxReader.isActive (OMXSTREAM_VIDEO, packet->mStreamIndex);
+    }
+  //}}}
+  //{{{
+  bool isAudio (cOmxPacket* packet) {
+    return mOmxAudioPlayer && mOmxReader.isActive (OMXSTREAM_AUDIO, packet->mStreamIndex);
+    }
+  //}}}
+  //{{{
+  bool sendPacket (cOmxPacket*& packet) {
+  // route packet to its player, unwanted packets deleted, false if player cache full and packet kept
+
+    if (isVideo (packet)) {
+      mOmxVideoPlayer->setBitrate (mOmxReader.getBitrate (packet->mStreamIndex));
+      if (!mOmxVideoPlayer->addPacket (packet))
+        return false;
+      mVideoPackets++;
+      }
+
+    else if (isAudio (packet)) {
+      mOmxAudioPlayer->setBitrate (mOmxReader.getBitrate (packet->mStreamIndex));
+      if (!mOmxAudioPlayer->addPacket (packet))
+        return false;
+      mAudioPackets++;
+      }
+
+    else
+      delete (packet);
+
+    packet = nullptr;
+    return true;
+    }
+  //}}}
+
+  //{{{
+  bool isBuffered (cOmxPlayer* player) {
+  // queue reached high watermark, or cache full
+
+    return !player ||
+           (player->getCacheDuration() >= mBufferTargetSecs) ||
+           (player->getPacketCacheSize() >= (player->getPacketMaxCacheSize() / 10) * 9);
+    }
+  //}}}
+  //{{{
+  bool isUnderrun (cOmxPlayer* player) {
+  // queue below low watermark, nearly empty cache
+
+    return player &&
+           (player->getCacheDuration() < mUnderrunSecs) &&
+           (player->getPacketCacheSize() < (player->getPacketMaxCacheSize() / 10));
     }
   //}}}
 
   //{{{  vars
   string mDebugStr;
+  string mInfoStr;
+  cMediaInfoPool* mInfoPool = nullptr;
 
   cOmxClock mOmxClock;
   cOmxReader mOmxReader;
   cOmxVideoPlayer* mOmxVideoPlayer = nullptr;
   cOmxAudioPlayer* mOmxAudioPlayer = nullptr;
+  int mVideoThread = -1;
+  int mAudioThread = -1;
+  cOmxStats mStats;
+  cRecorder* mRecorder = nullptr;
+  uint64_t mVideoPackets = 0;
+  uint64_t mAudioPackets = 0;
 
   cKeyboard mKeyboard;
 
@@ -626,7 +1028,21 @@ private:
   cWidget* mTsBox = nullptr;
 
   bool mPause = false;
-  double mSeekIncSec = 0.0;
+  bool mBuffering = false;
+  int mStalls = 0;
+  double mStallSecs = 0.0;
+  float mBufferTargetSecs = 1.f;
+
+  atomic<int> mSeekIncSec { 0 };
+  bool mSeeking = false;
+  int mSeeks = 0;
+  int mSeekFrames = 0;
+  double mSeekStart = 0.0;
+  double mSeekDone = 0.0;
+  vector<double> mSeekTimes;
+  int mSeekDecodeOnlyPackets = 0;
+  int mSeekDecodeOnlyUs = 0;
+  double mSeekDecodeOnlyMs = 0.0;
   double mPlayPts = 0.0;
   double mLengthPts = 0.0;
 
@@ -637,7 +1053,11 @@ private:
 
   int mChans = 2;
   array<float,6> mPower;
-  map <uint64_t,array<float,6>>* mPowerMap;
+  // copy around mPlayPts for cPowerMapBox, swapped and drawn under mPowerMapMutex
+  mutex mPowerMapMutex;
+  map <uint64_t,array<float,6>> mPowerMapCopy;
+  map <uint64_t,array<float,6>>* mPowerMap = nullptr;
+  double mPowerMapPublished = 0.0;
   //}}}
   };
 vector<string> cAppWindow::mFileNames;
@@ -659,6 +1079,38 @@ int main (int argc, char* argv[]) {
   int vFifo = 1024;
   int vCache = 2 * 1024;
   int aCache = 512;
+  float vCacheSecs = 3.f;
+  float aCacheSecs = 3.f;
+  int maxCache = 32;
+  int memoryBudget = 64;
+  string audioDevice = "omx:local";
+  int sinkPeriodFrames = 1024;
+  int sinkPeriods = 4;
+  bool passthrough = false;
+  bool softMix = false;
+  float driftTarget = 0.f;
+  float prebufferSecs = 1.f;
+  float underrunSecs = 0.1f;
+  float prebufferTimeout = 5.f;
+  string traceFileName;
+  float seekPrebufferSecs = 0.25f;
+  int seekScript = 0;
+  bool accurateSeek = false;
+  bool eventBench = false;
+  string recordFileName;
+  int recordStream = -1;
+  float recordLatencyMs = 250.f;
+  string recordBenchFileName;
+  int infoThreads = 1;
+  string infoCacheDir = "/home/pi/.omxinfo";
+  vector<string> threadPolicies;
+  bool h264Parse = true;
+  bool dropLate = true;
+  float dropLateSecs = 0.1f;
+  float skipGopSecs = 0.5f;
+  bool h264Bench = false;
+  string startCodeBenchFileName;
+  bool swVideo = false;
   cOmxVideoConfig::eDeInterlaceMode deInterlaceMode = cOmxVideoConfig::eDeInterlaceAuto;
 
   for (auto arg = 1; arg < argc; arg++)
@@ -676,18 +1128,96 @@ int main (int argc, char* argv[]) {
     else if (!strcmp(argv[arg], "hd"))  frequency = 706;
     else if (!strcmp(argv[arg], "ac")) aCache = atoi (argv[++arg]);
     else if (!strcmp(argv[arg], "vc")) vCache = atoi (argv[++arg]);
+    else if (!strcmp(argv[arg], "acs")) aCacheSecs = (float)atof (argv[++arg]);
+    else if (!strcmp(argv[arg], "vcs")) vCacheSecs = (float)atof (argv[++arg]);
+    else if (!strcmp(argv[arg], "mc")) maxCache = atoi (argv[++arg]);
+    else if (!strcmp(argv[arg], "mb")) memoryBudget = atoi (argv[++arg]);
     else if (!strcmp(argv[arg], "vf")) vFifo = atoi (argv[++arg]);
+    else if (!strcmp(argv[arg], "ad")) audioDevice = argv[++arg];
+    else if (!strcmp(argv[arg], "asp")) sinkPeriodFrames = atoi (argv[++arg]);
+    else if (!strcmp(argv[arg], "asn")) sinkPeriods = atoi (argv[++arg]);
+    else if (!strcmp(argv[arg], "pt")) passthrough = true;
+    else if (!strcmp(argv[arg], "sm")) softMix = true;
+    else if (!strcmp(argv[arg], "dc")) driftTarget = (float)atof (argv[++arg]);
+    else if (!strcmp(argv[arg], "pb")) prebufferSecs = (float)atof (argv[++arg]);
+    else if (!strcmp(argv[arg], "ub")) underrunSecs = (float)atof (argv[++arg]);
+    else if (!strcmp(argv[arg], "pbt")) prebufferTimeout = (float)atof (argv[++arg]);
+    else if (!strcmp(argv[arg], "tr")) traceFileName = argv[++arg];
+    else if (!strcmp(argv[arg], "eb")) eventBench = true;
+    else if (!strcmp(argv[arg], "spb")) seekPrebufferSecs = (float)atof (argv[++arg]);
+    else if (!strcmp(argv[arg], "sk")) seekScript = atoi (argv[++arg]);
+    else if (!strcmp(argv[arg], "as")) accurateSeek = true;
+    else if (!strcmp(argv[arg], "rec")) recordFileName = argv[++arg];
+    else if (!strcmp(argv[arg], "recs")) recordStream = atoi (argv[++arg]);
+    else if (!strcmp(argv[arg], "recl")) recordLatencyMs = (float)atof (argv[++arg]);
+    else if (!strcmp(argv[arg], "rb")) recordBenchFileName = argv[++arg];
+    else if (!strcmp(argv[arg], "mi")) infoThreads = atoi (argv[++arg]);
+    else if (!strcmp(argv[arg], "mic")) infoCacheDir = argv[++arg];
+    else if (!strcmp(argv[arg], "tp")) threadPolicies.push_back (argv[++arg]);
+    else if (!strcmp(argv[arg], "hp")) h264Parse = atoi (argv[++arg]) != 0;
+    else if (!strcmp(argv[arg], "hb")) h264Bench = true;
+    else if (!strcmp(argv[arg], "sb")) startCodeBenchFileName = argv[++arg];
+    else if (!strcmp(argv[arg], "sw")) swVideo = true;
+    else if (!strcmp(argv[arg], "ld")) dropLate = atoi (argv[++arg]) != 0;
+    else if (!strcmp(argv[arg], "lds")) dropLateSecs = (float)atof (argv[++arg]);
+    else if (!strcmp(argv[arg], "lgs")) skipGopSecs = (float)atof (argv[++arg]);
     else if (!strcmp(argv[arg], "d")) deInterlaceMode = (cOmxVideoConfig::eDeInterlaceMode)atoi (argv[++arg]);
 
   cLog::init (logLevel, false, "");
   cLog::log (LOGNOTICE, "omx " + root + " " + string(VERSION_DATE));
+  if (eventBench) {
+    benchEventCheck();
+    return EXIT_SUCCESS;
+    }
+  if (!recordBenchFileName.empty()) {
+    cRecorder::bench (recordBenchFileName, 10.f);
+    return EXIT_SUCCESS;
+    }
+  if (h264Bench) {
+    cH264Parser::bench (10.f);
+    return EXIT_SUCCESS;
+    }
+  if (!startCodeBenchFileName.empty()) {
+    cStartCode::bench (startCodeBenchFileName, 9.f);
+    return EXIT_SUCCESS;
+    }
 
   cAppWindow appWindow (root);
-  appWindow.mAudioConfig.mDevice = "omx:local";
+  appWindow.mAudioConfig.mDevice = audioDevice;
+  appWindow.mAudioConfig.mSinkPeriodFrames = sinkPeriodFrames;
+  appWindow.mAudioConfig.mSinkPeriods = sinkPeriods;
+  appWindow.mAudioConfig.mPassthrough = passthrough;
+  appWindow.mAudioConfig.mSoftMix = softMix;
+  appWindow.mAudioConfig.mDriftTarget = driftTarget;
   appWindow.mAudioConfig.mPacketMaxCacheSize = aCache * 1024;
   appWindow.mVideoConfig.mPacketMaxCacheSize = vCache * 1024;
+  appWindow.mAudioConfig.mPacketMaxCacheSecs = aCacheSecs;
+  appWindow.mVideoConfig.mPacketMaxCacheSecs = vCacheSecs;
+  cMemoryBudget::get().setTotal ((int64_t)memoryBudget * 1024 * 1024);
+  cMemoryBudget::get().setQuota (cMemoryBudget::ePackets, (int64_t)maxCache * 1024 * 1024);
   appWindow.mVideoConfig.mFifoSize = vFifo * 1024;
   appWindow.mVideoConfig.mDeInterlaceMode = deInterlaceMode;
+  appWindow.mVideoConfig.mH264Parse = h264Parse;
+  appWindow.mVideoConfig.mDropLate = dropLate;
+  appWindow.mVideoConfig.mDropLateSecs = dropLateSecs;
+  appWindow.mVideoConfig.mSkipGopSecs = skipGopSecs;
+  appWindow.mPrebufferSecs = prebufferSecs;
+  appWindow.mUnderrunSecs = underrunSecs;
+  appWindow.mPrebufferTimeout = prebufferTimeout;
+  appWindow.mSeekPrebufferSecs = seekPrebufferSecs;
+  appWindow.mSeekScript = seekScript;
+  appWindow.mAccurateSeek = accurateSeek;
+  appWindow.mSwVideo = swVideo;
+  appWindow.mRecordFileName = recordFileName;
+  appWindow.mRecordStream = recordStream;
+  appWindow.mRecordLatencyMs = recordLatencyMs;
+  appWindow.mInfoThreads = infoThreads;
+  appWindow.mInfoCacheDir = infoCacheDir;
+  for (auto& threadPolicy : threadPolicies)
+    appWindow.mThreads.setPolicy (threadPolicy);
+  appWindow.mTraceFileName = traceFileName;
+  if (!traceFileName.empty())
+    cTracer::setEnabled (true);
   appWindow.run (inTs, frequency);
 
   return EXIT_SUCCESS;
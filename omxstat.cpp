@@ -0,0 +1,45 @@
+// omxstat.cpp - sample omx shared memory stats block
+//{{{  includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cOmxStats.h"
+//}}}
+
+int main (int argc, char* argv[]) {
+
+  int intervalMs = (argc > 1) ? atoi (argv[1]) : 1000;
+  int count = (argc > 2) ? atoi (argv[2]) : 0;
+
+  cOmxStats stats;
+  if (!stats.attach()) {
+    fprintf (stderr, "omxstat - no omx stats at %s, or version mismatch\n", kOmxStatsName);
+    return EXIT_FAILURE;
+    }
+
+  printf ("    play    length vPkts aPkts vQ aQ  vCacheK aCacheK vSpaceK aSpaceK   clkAdj aDelay eos state stalls\n");
+  for (int i = 0; !count || (i < count); i++) {
+    cOmxStatsBlock block;
+    if (!stats.read (block)) {
+      fprintf (stderr, "omxstat - no consistent sample\n");
+      return EXIT_FAILURE;
+      }
+
+    printf ("%8.2f %9.2f %5llu %5llu %2d %2d %8d %7d %7u %7u %8.0f %6.3f  %c%c %s %3d/%.1fs\n",
+            block.mPlayPts / 1000000.0, block.mLengthPts / 1000000.0,
+            (unsigned long long)block.mVideoPackets, (unsigned long long)block.mAudioPackets,
+            block.mVideoQueue, block.mAudioQueue,
+            block.mVideoCacheBytes / 1024, block.mAudioCacheBytes / 1024,
+            block.mVideoInputSpace / 1024, block.mAudioInputSpace / 1024,
+            block.mClockAdjustment, block.mAudioDelay,
+            block.mVideoEos ? 'v' : '-', block.mAudioEos ? 'a' : '-',
+            block.mPaused ? "paused   " : block.mBuffering ? "buffering" : "playing  ",
+            block.mStalls, block.mStallSecs);
+    fflush (stdout);
+
+    usleep (intervalMs * 1000);
+    }
+
+  return EXIT_SUCCESS;
+  }